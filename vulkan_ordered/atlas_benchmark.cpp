@@ -0,0 +1,382 @@
+#include "atlas_benchmark.h"
+
+#include <cstdint>
+#include <atomic>
+
+#define NOMINMAX
+#include <Windows.h>
+
+#include "och_fmt.h"
+#include "och_fio.h"
+#include "och_timer.h"
+
+#include "sdf_glyph_atlas.h"
+#include "truetype.h"
+#include "heap_buffer.h"
+
+#define TEMP_STATUS_MACRO to_status(och::status(1, och::error_type::och))
+
+static constexpr const char* DEFAULT_FONTS[]
+{
+	"C:/Windows/Fonts/calibri.ttf",
+	"C:/Windows/Fonts/arial.ttf",
+	"C:/Windows/Fonts/consola.ttf",
+};
+
+static constexpr uint32_t GLYPH_SIZES[]{ 16, 32, 64 };
+
+// Worker thread counts as in glyph_atlas_build_options, 0 meaning one per logical processor
+static constexpr uint32_t THREAD_CNTS[]{ 1, 0 };
+
+struct atlas_benchmark_range_set
+{
+	const char* name;
+
+	glyph_atlas::codept_range ranges[3];
+
+	uint32_t range_cnt;
+};
+
+static constexpr atlas_benchmark_range_set RANGE_SETS[]
+{
+	{ "ascii",                { { 32, 127 } },                                  1 },
+	{ "latin",                { { 32, 127 }, { 160, 0x250 } },                  2 },
+	{ "latin_greek_cyrillic", { { 32, 127 }, { 160, 0x250 }, { 0x370, 0x530 } }, 3 },
+};
+
+// Each configuration is built this many times, keeping the stats of the fastest run
+static constexpr uint32_t BENCHMARK_RUNS = 3;
+
+static constexpr float BENCHMARK_SDF_CLAMP = 0.0625F;
+
+static constexpr uint32_t BENCHMARK_PADDING = 2;
+
+static constexpr uint32_t BENCHMARK_MAP_WIDTH = 1024;
+
+// Time taken to decode the outline of every codepoint in ranges once on a single thread, which measure and render both repeat.
+// Not part of glyph_atlas::create, so it is reported in addition to its stages.
+static och::status time_outline_decode(const char* ttf_filename, const glyph_atlas::codept_range* ranges, uint32_t range_cnt, int64_t& out_us) noexcept
+{
+	truetype_file file;
+
+	check(file.create(ttf_filename));
+
+	glyph_scratch_arena scratch;
+
+	och::timer timer;
+
+	for (uint32_t i = 0; i != range_cnt; ++i)
+		for (uint32_t cp = ranges[i].beg; cp != ranges[i].end; ++cp)
+			glyph_data glyph = file.get_glyph_data_from_codepoint(cp, scratch);
+
+	out_us = timer.read().microseconds();
+
+	file.close();
+
+	return {};
+}
+
+// Number of times each thread of check_concurrent_decode goes through all glyphs of the font
+static constexpr uint32_t CONCURRENT_DECODE_ROUNDS = 4;
+
+// Glyphs decoded per call to truetype_file::decode_glyphs by check_concurrent_decode
+static constexpr uint32_t CONCURRENT_DECODE_BATCH_SIZE = 32;
+
+static uint64_t glyph_outline_hash(const glyph_data& glyph) noexcept
+{
+	uint64_t hash = 0xCBF2'9CE4'8422'2325;
+
+	const auto mix = [&hash](const void* data, size_t bytes) noexcept
+	{
+		for (size_t i = 0; i != bytes; ++i)
+			hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 0x0000'0100'0000'01B3;
+	};
+
+	mix(&glyph.metrics(), sizeof(glyph_metrics));
+
+	for (uint32_t i = 0; i != glyph.point_cnt(); ++i)
+		mix(&glyph[i], sizeof(och::vec2));
+
+	for (uint32_t i = 0; i != glyph.contour_cnt(); ++i)
+	{
+		const uint32_t end = glyph.contour_end_index(i);
+
+		mix(&end, sizeof(end));
+	}
+
+	return hash;
+}
+
+// Shared by all threads of check_concurrent_decode
+struct concurrent_decode_check
+{
+	const truetype_file* file;
+
+	// Decoded on a single thread before the cmap table existed
+	const uint64_t* expected_hashes;
+
+	const uint32_t* expected_bmp_ids;
+
+	uint32_t glyph_cnt;
+
+	uint32_t thread_cnt;
+
+	std::atomic<uint32_t> next_thread_idx;
+
+	std::atomic<uint32_t> mismatch_cnt;
+};
+
+static DWORD WINAPI concurrent_decode_thread_fn(void* param) noexcept
+{
+	concurrent_decode_check& check_data = *static_cast<concurrent_decode_check*>(param);
+
+	const truetype_file& file = *check_data.file;
+
+	const uint32_t thread_idx = check_data.next_thread_idx.fetch_add(1, std::memory_order::relaxed);
+
+	// All threads race to build the cmap table, while those that lose may already be looking up codepoints through it
+	file.build_cmap_table();
+
+	uint32_t mismatch_cnt = 0;
+
+	for (uint32_t cp = thread_idx; cp < 0x10000; cp += check_data.thread_cnt)
+		mismatch_cnt += file.get_glyph_id_from_codept(static_cast<char32_t>(cp)) != check_data.expected_bmp_ids[cp];
+
+	glyph_scratch_arena scratch;
+
+	outline_batch batch;
+
+	uint32_t ids[CONCURRENT_DECODE_BATCH_SIZE];
+
+	// Each thread starts at a different glyph and alternates between both decoding paths, so the same glyphs are decoded by
+	// different threads in different ways at the same time
+
+	const uint32_t glyph_cnt = check_data.glyph_cnt;
+
+	for (uint32_t round = 0; round != CONCURRENT_DECODE_ROUNDS; ++round)
+	{
+		const uint32_t first_id = static_cast<uint32_t>((static_cast<uint64_t>(thread_idx) * glyph_cnt / check_data.thread_cnt + round * CONCURRENT_DECODE_BATCH_SIZE) % glyph_cnt);
+
+		if ((thread_idx + round) & 1)
+		{
+			for (uint32_t i = 0; i != glyph_cnt; ++i)
+			{
+				const uint32_t id = (first_id + i) % glyph_cnt;
+
+				mismatch_cnt += glyph_outline_hash(file.get_glyph_data_from_id(id, scratch)) != check_data.expected_hashes[id];
+			}
+		}
+		else
+		{
+			for (uint32_t batch_beg = 0; batch_beg < glyph_cnt; batch_beg += CONCURRENT_DECODE_BATCH_SIZE)
+			{
+				const uint32_t batch_cnt = glyph_cnt - batch_beg < CONCURRENT_DECODE_BATCH_SIZE ? glyph_cnt - batch_beg : CONCURRENT_DECODE_BATCH_SIZE;
+
+				for (uint32_t i = 0; i != batch_cnt; ++i)
+					ids[i] = (first_id + batch_beg + i) % glyph_cnt;
+
+				batch.reset();
+
+				file.decode_glyphs(ids, batch_cnt, batch);
+
+				for (uint32_t i = 0; i != batch_cnt; ++i)
+					mismatch_cnt += glyph_outline_hash(batch.glyph(i)) != check_data.expected_hashes[ids[i]];
+			}
+		}
+	}
+
+	check_data.mismatch_cnt.fetch_add(mismatch_cnt, std::memory_order::relaxed);
+
+	return 0;
+}
+
+// Stress test for decoding glyphs from a single truetype_file on one thread per logical processor at once.
+// Every codepoint of the basic multilingual plane and every glyph decoded by the threads is compared against a single-threaded reference.
+// Fails if any of them differ, so the benchmark does not time a font that cannot be decoded concurrently.
+static och::status check_concurrent_decode(const char* ttf_filename) noexcept
+{
+	truetype_file file;
+
+	check(file.create(ttf_filename));
+
+	const uint32_t glyph_cnt = file.glyph_cnt();
+
+	heap_buffer<uint64_t> expected_hashes(glyph_cnt);
+
+	heap_buffer<uint32_t> expected_bmp_ids(0x10000);
+
+	{
+		glyph_scratch_arena scratch;
+
+		for (uint32_t id = 0; id != glyph_cnt; ++id)
+			expected_hashes[id] = glyph_outline_hash(file.get_glyph_data_from_id(id, scratch));
+
+		for (uint32_t cp = 0; cp != 0x10000; ++cp)
+			expected_bmp_ids[cp] = file.get_glyph_id_from_codept(static_cast<char32_t>(cp));
+	}
+
+	SYSTEM_INFO sys_info;
+
+	GetSystemInfo(&sys_info);
+
+	// Two threads at the very least, so there is something to race even on a single processor
+	const uint32_t thread_cnt = sys_info.dwNumberOfProcessors > 2 ? sys_info.dwNumberOfProcessors : 2;
+
+	concurrent_decode_check check_data{ &file, expected_hashes.data(), expected_bmp_ids.data(), glyph_cnt, thread_cnt, 0, 0 };
+
+	heap_buffer<HANDLE> threads(thread_cnt);
+
+	och::timer timer;
+
+	uint32_t created_thread_cnt = 0;
+
+	for (; created_thread_cnt != thread_cnt; ++created_thread_cnt)
+	{
+		DWORD thread_id;
+
+		if (!(threads[created_thread_cnt] = CreateThread(nullptr, 0, concurrent_decode_thread_fn, &check_data, 0, &thread_id)))
+			break;
+	}
+
+	for (uint32_t i = 0; i != created_thread_cnt; ++i)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+
+		CloseHandle(threads[i]);
+	}
+
+	const int64_t elapsed_us = timer.read().microseconds();
+
+	file.close();
+
+	const uint32_t mismatch_cnt = check_data.mismatch_cnt.load(std::memory_order::relaxed);
+
+	och::print("{}: decoded {} glyphs {} times on each of {} threads sharing one truetype_file in {} us, {} mismatches\n", ttf_filename, glyph_cnt, CONCURRENT_DECODE_ROUNDS, created_thread_cnt, elapsed_us, mismatch_cnt);
+
+	if (created_thread_cnt != thread_cnt || mismatch_cnt != 0)
+		return TEMP_STATUS_MACRO;
+
+	return {};
+}
+
+// Fastest of BENCHMARK_RUNS builds of all GLYPH_SIZES with a single call to glyph_atlas::create_multi_size
+static och::status time_multi_size(const char* ttf_filename, glyph_atlas::codept_range* ranges, uint32_t range_cnt, uint32_t thread_cnt, int64_t& out_us) noexcept
+{
+	constexpr uint32_t SIZE_CNT = sizeof(GLYPH_SIZES) / sizeof(*GLYPH_SIZES);
+
+	glyph_atlas::size_params sizes[SIZE_CNT];
+
+	for (uint32_t i = 0; i != SIZE_CNT; ++i)
+		sizes[i] = { GLYPH_SIZES[i], BENCHMARK_PADDING, BENCHMARK_SDF_CLAMP };
+
+	out_us = INT64_MAX;
+
+	for (uint32_t run = 0; run != BENCHMARK_RUNS; ++run)
+	{
+		glyph_atlas_build_stats stats[SIZE_CNT];
+
+		glyph_atlas_build_options options{};
+		options.worker_thread_cnt = thread_cnt;
+		options.stats = stats;
+
+		glyph_atlas atlases[SIZE_CNT];
+
+		check(glyph_atlas::create_multi_size(ttf_filename, och::range<glyph_atlas::size_params>(sizes, sizes + SIZE_CNT), BENCHMARK_MAP_WIDTH, och::range<glyph_atlas::codept_range>(ranges, ranges + range_cnt), atlases, options));
+
+		int64_t total_us = 0;
+
+		for (const glyph_atlas_build_stats& s : stats)
+			total_us += s.total_us;
+
+		if (total_us < out_us)
+			out_us = total_us;
+	}
+
+	return {};
+}
+
+och::status run_atlas_benchmark(int argc, const char** argv)
+{
+	const char* output_filename = argc >= 3 ? argv[2] : "atlas_benchmark.csv";
+
+	const char* const* fonts = argc >= 4 ? argv + 3 : DEFAULT_FONTS;
+
+	const uint32_t font_cnt = argc >= 4 ? static_cast<uint32_t>(argc - 3) : static_cast<uint32_t>(sizeof(DEFAULT_FONTS) / sizeof(*DEFAULT_FONTS));
+
+	och::iohandle output_file;
+
+	check(och::open_file(output_file, output_filename, och::fio::access::write, och::fio::open::truncate, och::fio::open::normal));
+
+	och::print(output_file, "font,glyph_size,ranges,threads,codepoints,glyphs,rendered_glyphs,glyphs_per_sec,total_us,open_us,codept_sort_us,cmap_us,glyph_id_sort_us,measure_us,dedupe_us,pack_us,render_us,index_us,mip_us,bc4_us,lookup_us,decode_us,image_bytes,peak_alloc_bytes\n");
+
+	for (uint32_t f = 0; f != font_cnt; ++f)
+		check(check_concurrent_decode(fonts[f]));
+
+	for (uint32_t f = 0; f != font_cnt; ++f)
+		for (const atlas_benchmark_range_set& range_set : RANGE_SETS)
+		{
+			int64_t decode_us;
+
+			int64_t multi_size_us;
+
+			check(time_outline_decode(fonts[f], range_set.ranges, range_set.range_cnt, decode_us));
+
+			glyph_atlas::codept_range ranges[3];
+
+			for (uint32_t i = 0; i != range_set.range_cnt; ++i)
+				ranges[i] = range_set.ranges[i];
+
+			// Sum of the fastest runs of each size, to compare against building all sizes at once
+			int64_t separate_total_us[sizeof(THREAD_CNTS) / sizeof(*THREAD_CNTS)]{};
+
+			for (const uint32_t glyph_size : GLYPH_SIZES)
+				for (uint32_t t = 0; t != sizeof(THREAD_CNTS) / sizeof(*THREAD_CNTS); ++t)
+				{
+					const uint32_t thread_cnt = THREAD_CNTS[t];
+
+					glyph_atlas_build_stats best{};
+
+					best.total_us = INT64_MAX;
+
+					for (uint32_t run = 0; run != BENCHMARK_RUNS; ++run)
+					{
+						glyph_atlas_build_stats stats;
+
+						glyph_atlas_build_options options{};
+						options.worker_thread_cnt = thread_cnt;
+						options.stats = &stats;
+
+						glyph_atlas atlas;
+
+						check(atlas.create(fonts[f], glyph_size, BENCHMARK_PADDING, BENCHMARK_SDF_CLAMP, BENCHMARK_MAP_WIDTH, och::range<glyph_atlas::codept_range>(ranges, ranges + range_set.range_cnt), options));
+
+						if (stats.total_us < best.total_us)
+							best = stats;
+					}
+
+					const float glyphs_per_sec = best.total_us != 0 ? static_cast<float>(best.glyph_cnt * 1'000'000.0 / static_cast<double>(best.total_us)) : 0.0F;
+
+					och::print(output_file, "{},{},{},{},{},{},{},{:.1},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}\n",
+						fonts[f], glyph_size, range_set.name, thread_cnt, best.codept_cnt, best.glyph_cnt, best.rendered_glyph_cnt, glyphs_per_sec,
+						best.total_us, best.open_us, best.codept_sort_us, best.cmap_us, best.glyph_id_sort_us, best.measure_us, best.dedupe_us, best.pack_us,
+						best.render_us, best.index_us, best.mip_us, best.bc4_us, best.lookup_us, decode_us, best.image_bytes, best.peak_alloc_bytes);
+
+					och::print("{} / {} / {}px / {} threads: {} us\n", fonts[f], range_set.name, glyph_size, thread_cnt, best.total_us);
+
+					separate_total_us[t] += best.total_us;
+				}
+
+			for (uint32_t t = 0; t != sizeof(THREAD_CNTS) / sizeof(*THREAD_CNTS); ++t)
+			{
+				check(time_multi_size(fonts[f], ranges, range_set.range_cnt, THREAD_CNTS[t], multi_size_us));
+
+				och::print("{} / {} / all sizes / {} threads: {} us separately, {} us with create_multi_size\n", fonts[f], range_set.name, THREAD_CNTS[t], separate_total_us[t], multi_size_us);
+			}
+		}
+
+	check(och::close_file(output_file));
+
+	och::print("\nWrote results to {}\n", output_filename);
+
+	return {};
+}
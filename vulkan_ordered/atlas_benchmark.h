@@ -0,0 +1,8 @@
+#pragma once
+
+#include "och_err.h"
+
+// Builds glyph atlases for every combination of a set of fonts, glyph sizes, codepoint ranges and thread counts,
+// writing the time spent in each stage of glyph_atlas::create as CSV.
+// Each font is first decoded on many threads sharing one truetype_file, failing if the results differ from decoding on a single thread.
+och::status run_atlas_benchmark(int argc, const char** argv);
@@ -0,0 +1,220 @@
+#include "bc4_codec.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <immintrin.h>
+
+#include "sdf_kernels.h"
+
+static constexpr uint32_t BC4_BLOCK_DIM = 4;
+
+static constexpr uint32_t BC4_BLOCK_BYTES = 8;
+
+// Palette entries are referred to by their position between the endpoints, 0 being the maximum and 7 the minimum.
+// This converts a position to the index stored in the block, in which the maximum and minimum come first.
+static uint32_t bc4_index_from_position(uint32_t pos) noexcept
+{
+	return pos == 0 ? 0 : pos == 7 ? 1 : pos + 1;
+}
+
+static uint32_t bc4_palette_value(uint32_t max, uint32_t min, uint32_t pos) noexcept
+{
+	return ((7 - pos) * max + pos * min + 3) / 7;
+}
+
+// Copies the 4x4 block at (x_beg, y_beg) into out, repeating the last column and row for blocks extending past the image's edge
+static void gather_block(const uint8_t* image, uint32_t width, uint32_t height, uint32_t x_beg, uint32_t y_beg, uint8_t(&out)[16]) noexcept
+{
+	if (x_beg + BC4_BLOCK_DIM <= width && y_beg + BC4_BLOCK_DIM <= height)
+	{
+		for (uint32_t y = 0; y != BC4_BLOCK_DIM; ++y)
+			memcpy(out + y * BC4_BLOCK_DIM, image + (y_beg + y) * width + x_beg, BC4_BLOCK_DIM);
+
+		return;
+	}
+
+	for (uint32_t y = 0; y != BC4_BLOCK_DIM; ++y)
+	{
+		const uint32_t src_y = y_beg + y < height ? y_beg + y : height - 1;
+
+		for (uint32_t x = 0; x != BC4_BLOCK_DIM; ++x)
+		{
+			const uint32_t src_x = x_beg + x < width ? x_beg + x : width - 1;
+
+			out[y * BC4_BLOCK_DIM + x] = image[src_y * width + src_x];
+		}
+	}
+}
+
+static void write_block(uint8_t* out, uint32_t max, uint32_t min, uint64_t index_bits) noexcept
+{
+	out[0] = static_cast<uint8_t>(max);
+
+	out[1] = static_cast<uint8_t>(min);
+
+	for (uint32_t i = 0; i != 6; ++i)
+		out[2 + i] = static_cast<uint8_t>(index_bits >> (i * 8));
+}
+
+static void encode_block_scalar(const uint8_t(&block)[16], uint8_t* out) noexcept
+{
+	uint32_t max = block[0], min = block[0];
+
+	for (uint32_t i = 1; i != 16; ++i)
+	{
+		if (block[i] > max)
+			max = block[i];
+
+		if (block[i] < min)
+			min = block[i];
+	}
+
+	// With equal endpoints every index decodes to the endpoint
+	if (max == min)
+	{
+		write_block(out, max, min, 0);
+
+		return;
+	}
+
+	// A pixel at or below threshold k is closer to palette entry k than to entry k - 1, so counting these thresholds gives its position
+	uint32_t thresholds[8];
+
+	for (uint32_t k = 1; k != 8; ++k)
+		thresholds[k] = (bc4_palette_value(max, min, k - 1) + bc4_palette_value(max, min, k)) >> 1;
+
+	uint64_t index_bits = 0;
+
+	for (uint32_t i = 0; i != 16; ++i)
+	{
+		uint32_t pos = 0;
+
+		for (uint32_t k = 1; k != 8; ++k)
+			pos += block[i] <= thresholds[k];
+
+		index_bits |= static_cast<uint64_t>(bc4_index_from_position(pos)) << (i * 3);
+	}
+
+	write_block(out, max, min, index_bits);
+}
+
+static void encode_block_sse2(const uint8_t(&block)[16], uint8_t* out) noexcept
+{
+	const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+
+	__m128i max_v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+	max_v = _mm_max_epu8(max_v, _mm_srli_si128(max_v, 4));
+	max_v = _mm_max_epu8(max_v, _mm_srli_si128(max_v, 2));
+	max_v = _mm_max_epu8(max_v, _mm_srli_si128(max_v, 1));
+
+	__m128i min_v = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+	min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 4));
+	min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 2));
+	min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 1));
+
+	const uint32_t max = static_cast<uint32_t>(_mm_cvtsi128_si32(max_v)) & 0xFF;
+
+	const uint32_t min = static_cast<uint32_t>(_mm_cvtsi128_si32(min_v)) & 0xFF;
+
+	if (max == min)
+	{
+		write_block(out, max, min, 0);
+
+		return;
+	}
+
+	// Count the thresholds each pixel is at or below. Subtracting the all-ones compare mask adds one per threshold.
+	__m128i pos = _mm_setzero_si128();
+
+	for (uint32_t k = 1; k != 8; ++k)
+	{
+		const __m128i threshold = _mm_set1_epi8(static_cast<char>((bc4_palette_value(max, min, k - 1) + bc4_palette_value(max, min, k)) >> 1));
+
+		pos = _mm_sub_epi8(pos, _mm_cmpeq_epi8(_mm_min_epu8(v, threshold), v));
+	}
+
+	// bc4_index_from_position: (pos + 1) & 7 is correct except for positions 0 and 7, which it maps to 1 and 0 instead of 0 and 1
+	const __m128i is_endpoint = _mm_or_si128(_mm_cmpeq_epi8(pos, _mm_setzero_si128()), _mm_cmpeq_epi8(pos, _mm_set1_epi8(7)));
+
+	const __m128i idx = _mm_xor_si128(_mm_and_si128(_mm_add_epi8(pos, _mm_set1_epi8(1)), _mm_set1_epi8(7)), _mm_and_si128(is_endpoint, _mm_set1_epi8(1)));
+
+	// Pack the 3-bit indices by repeatedly merging neighbouring lanes: 16 x 3 bits -> 8 x 6 bits -> 4 x 12 bits -> 2 x 24 bits
+	const __m128i pairs = _mm_or_si128(_mm_and_si128(idx, _mm_set1_epi16(0xFF)), _mm_slli_epi16(_mm_srli_epi16(idx, 8), 3));
+
+	const __m128i quads = _mm_or_si128(_mm_and_si128(pairs, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(_mm_srli_epi32(pairs, 16), 6));
+
+	const __m128i octets = _mm_or_si128(_mm_and_si128(quads, _mm_set1_epi64x(0xFFFFFFFF)), _mm_slli_epi64(_mm_srli_epi64(quads, 32), 12));
+
+	// Each half holds only 24 bits, so 32-bit moves suffice, which unlike _mm_cvtsi128_si64 are also available on x86
+	const uint64_t lo = static_cast<uint32_t>(_mm_cvtsi128_si32(octets));
+
+	const uint64_t hi = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(octets, 8)));
+
+	write_block(out, max, min, lo | (hi << 24));
+}
+
+uint32_t bc4_encoded_bytes(uint32_t width, uint32_t height) noexcept
+{
+	return ((width + BC4_BLOCK_DIM - 1) / BC4_BLOCK_DIM) * ((height + BC4_BLOCK_DIM - 1) / BC4_BLOCK_DIM) * BC4_BLOCK_BYTES;
+}
+
+void bc4_encode(const uint8_t* image, uint32_t width, uint32_t height, uint8_t* out_blocks, sdf_kernel_isa max_isa) noexcept
+{
+	const bool use_sse2 = sdf_supported_kernel_isa(max_isa) != sdf_kernel_isa::scalar;
+
+	uint8_t block[16];
+
+	for (uint32_t y = 0; y < height; y += BC4_BLOCK_DIM)
+		for (uint32_t x = 0; x < width; x += BC4_BLOCK_DIM)
+		{
+			gather_block(image, width, height, x, y, block);
+
+			if (use_sse2)
+				encode_block_sse2(block, out_blocks);
+			else
+				encode_block_scalar(block, out_blocks);
+
+			out_blocks += BC4_BLOCK_BYTES;
+		}
+}
+
+void bc4_decode(const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* out_image) noexcept
+{
+	for (uint32_t y_beg = 0; y_beg < height; y_beg += BC4_BLOCK_DIM)
+		for (uint32_t x_beg = 0; x_beg < width; x_beg += BC4_BLOCK_DIM)
+		{
+			const uint32_t e0 = blocks[0];
+
+			const uint32_t e1 = blocks[1];
+
+			uint32_t palette[8]{ e0, e1 };
+
+			if (e0 > e1)
+			{
+				for (uint32_t k = 2; k != 8; ++k)
+					palette[k] = ((8 - k) * e0 + (k - 1) * e1 + 3) / 7;
+			}
+			else
+			{
+				for (uint32_t k = 2; k != 6; ++k)
+					palette[k] = ((6 - k) * e0 + (k - 1) * e1 + 2) / 5;
+
+				palette[6] = 0;
+
+				palette[7] = 255;
+			}
+
+			uint64_t index_bits = 0;
+
+			for (uint32_t i = 0; i != 6; ++i)
+				index_bits |= static_cast<uint64_t>(blocks[2 + i]) << (i * 8);
+
+			for (uint32_t y = 0; y != BC4_BLOCK_DIM; ++y)
+				for (uint32_t x = 0; x != BC4_BLOCK_DIM; ++x)
+					if (x_beg + x < width && y_beg + y < height)
+						out_image[(y_beg + y) * width + x_beg + x] = static_cast<uint8_t>(palette[(index_bits >> ((y * BC4_BLOCK_DIM + x) * 3)) & 7]);
+
+			blocks += BC4_BLOCK_BYTES;
+		}
+}
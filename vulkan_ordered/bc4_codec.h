@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+#include "sdf_kernels.h"
+
+// BC4 (VK_FORMAT_BC4_UNORM_BLOCK) encoding of single-channel 8-bit images.
+//
+// Each 4x4 pixel block is stored in 8 bytes: Two endpoints followed by sixteen 3-bit palette indices.
+// The encoder always uses the block's maximum and minimum as endpoints, in that order, so the palette consists of the endpoints and six values
+// evenly spaced between them. Every pixel is then mapped to the nearest palette value, which keeps the error of each pixel at or below
+// (max - min) / 14. SDF atlases vary smoothly almost everywhere, so most blocks span only a small range.
+//
+// Blocks are stored row by row. Blocks extending past the right or bottom edge of the image repeat the image's last column or row.
+
+// Number of bytes needed to encode a width x height image
+uint32_t bc4_encoded_bytes(uint32_t width, uint32_t height) noexcept;
+
+// Encodes the width x height image into out_blocks, which must have room for bc4_encoded_bytes(width, height) bytes.
+// max_isa limits the instruction set used. Both variants produce identical output.
+void bc4_encode(const uint8_t* image, uint32_t width, uint32_t height, uint8_t* out_blocks, sdf_kernel_isa max_isa = sdf_kernel_isa::avx) noexcept;
+
+// Reference decoder, producing the values Vulkan implementations are required to return to within their rounding.
+// out_image must have room for width x height pixels.
+void bc4_decode(const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* out_image) noexcept;
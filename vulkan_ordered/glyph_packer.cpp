@@ -0,0 +1,521 @@
+#include "glyph_packer.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "heap_buffer.h"
+#include "simple_vec.h"
+
+// The skyline and max_rects packers place each glyph together with the padding to its right and below it,
+// inside an area that is already shrunk by the padding along the right edge.
+// The padding to the left and above the first glyphs is provided by offsetting everything by padding when drawing.
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*/////////////////////////////////////////////////// Shelf //////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+static bool pack_shelf(glyph_pack_rect* rects, uint32_t rect_cnt, uint32_t map_width, uint32_t padding, uint32_t& out_height) noexcept
+{
+	uint32_t curr_x = 0;
+
+	uint32_t curr_y = rects[0].h + 2 * padding;
+
+	for (uint32_t i = 0; i != rect_cnt; ++i)
+	{
+		glyph_pack_rect& r = rects[i];
+
+		const uint32_t padded_w = r.w + padding;
+
+		const uint32_t padded_h = r.h + padding;
+
+		if (padded_w > map_width - padding)
+			return false;
+
+		if (curr_x + padded_w > map_width - padding)
+		{
+			curr_y += padded_h;
+
+			curr_x = padded_w;
+		}
+		else
+			curr_x += padded_w;
+
+		r.x = curr_x - padded_w;
+
+		r.y = curr_y - padded_h;
+	}
+
+	out_height = curr_y + padding;
+
+	return true;
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////// Skyline /////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+// Returns the lowest y at which a rectangle of width w can rest on the skyline with its left edge at nodes[idx].x, or ~0u if it would cross the right edge.
+static uint32_t skyline_fit(const glyph_skyline_node* nodes, uint32_t idx, uint32_t w, uint32_t area_width) noexcept
+{
+	if (nodes[idx].x + w > area_width)
+		return ~0u;
+
+	uint32_t y = 0;
+
+	uint32_t remaining_w = w;
+
+	for (uint32_t i = idx; ; ++i)
+	{
+		if (nodes[i].y > y)
+			y = nodes[i].y;
+
+		if (nodes[i].w >= remaining_w)
+			return y;
+
+		remaining_w -= nodes[i].w;
+	}
+}
+
+// Finds the position with the lowest top edge for a padded_w x padded_h rectangle, preferring the leftmost one among equals.
+// Returns false if the rectangle does not fit anywhere within area_width x area_height.
+static bool skyline_find(const glyph_skyline_node* nodes, uint32_t node_cnt, uint32_t padded_w, uint32_t padded_h, uint32_t area_width, uint32_t area_height, uint32_t& out_idx, uint32_t& out_y) noexcept
+{
+	if (padded_w > area_width || padded_h > area_height)
+		return false;
+
+	uint32_t best_idx = ~0u;
+
+	uint32_t best_y = ~0u;
+
+	for (uint32_t i = 0; i != node_cnt; ++i)
+	{
+		const uint32_t y = skyline_fit(nodes, i, padded_w, area_width);
+
+		if (y < best_y && y <= area_height - padded_h)
+		{
+			best_y = y;
+
+			best_idx = i;
+		}
+	}
+
+	if (best_idx == ~0u)
+		return false;
+
+	out_idx = best_idx;
+
+	out_y = best_y;
+
+	return true;
+}
+
+// Inserts the top edge of a padded_w x padded_h rectangle placed at (nodes[idx].x, y) into the skyline, and cuts it out of the nodes it now covers.
+// nodes must have room for one more node.
+static void skyline_insert(glyph_skyline_node* nodes, uint32_t& node_cnt, uint32_t idx, uint32_t y, uint32_t padded_w, uint32_t padded_h) noexcept
+{
+	const uint32_t x = nodes[idx].x;
+
+	memmove(nodes + idx + 1, nodes + idx, (node_cnt - idx) * sizeof(glyph_skyline_node));
+
+	nodes[idx] = { x, y + padded_h, padded_w };
+
+	++node_cnt;
+
+	const uint32_t covered_end = x + padded_w;
+
+	const uint32_t next_idx = idx + 1;
+
+	uint32_t removed_cnt = 0;
+
+	while (next_idx + removed_cnt != node_cnt)
+	{
+		glyph_skyline_node& n = nodes[next_idx + removed_cnt];
+
+		if (n.x >= covered_end)
+			break;
+
+		if (n.x + n.w <= covered_end)
+		{
+			++removed_cnt;
+
+			continue;
+		}
+
+		n.w -= covered_end - n.x;
+
+		n.x = covered_end;
+
+		break;
+	}
+
+	memmove(nodes + next_idx, nodes + next_idx + removed_cnt, (node_cnt - next_idx - removed_cnt) * sizeof(glyph_skyline_node));
+
+	node_cnt -= removed_cnt;
+
+	// Merge neighbouring nodes of equal height
+
+	uint32_t merged_cnt = 1;
+
+	for (uint32_t i = 1; i != node_cnt; ++i)
+	{
+		if (nodes[i].y == nodes[merged_cnt - 1].y)
+			nodes[merged_cnt - 1].w += nodes[i].w;
+		else
+			nodes[merged_cnt++] = nodes[i];
+	}
+
+	node_cnt = merged_cnt;
+}
+
+static bool pack_skyline(glyph_pack_rect* rects, uint32_t rect_cnt, uint32_t map_width, uint32_t padding, uint32_t& out_height) noexcept
+{
+	const uint32_t area_width = map_width - padding;
+
+	// Each placed rectangle adds at most one node to the skyline
+	heap_buffer<glyph_skyline_node> nodes(rect_cnt + 1);
+
+	nodes[0] = { 0, 0, area_width };
+
+	uint32_t node_cnt = 1;
+
+	uint32_t max_y = 0;
+
+	for (uint32_t i = 0; i != rect_cnt; ++i)
+	{
+		glyph_pack_rect& r = rects[i];
+
+		const uint32_t padded_w = r.w + padding;
+
+		const uint32_t padded_h = r.h + padding;
+
+		uint32_t idx, y;
+
+		if (!skyline_find(nodes.data(), node_cnt, padded_w, padded_h, area_width, ~0u, idx, y))
+			return false;
+
+		r.x = nodes[idx].x;
+
+		r.y = y;
+
+		if (y + padded_h > max_y)
+			max_y = y + padded_h;
+
+		skyline_insert(nodes.data(), node_cnt, idx, y, padded_w, padded_h);
+	}
+
+	out_height = max_y + padding;
+
+	return true;
+}
+
+void incremental_glyph_packer::create(uint32_t map_width, uint32_t map_height, uint32_t padding) noexcept
+{
+	m_area_width = map_width > padding ? map_width - padding : 0;
+
+	m_area_height = map_height > padding ? map_height - padding : 0;
+
+	m_padding = padding;
+
+	// Every node is at least one pixel wide, and inserting adds at most one node
+	m_nodes.allocate(m_area_width + 1);
+
+	m_nodes[0] = { 0, 0, m_area_width };
+
+	m_node_cnt = m_area_width ? 1 : 0;
+}
+
+bool incremental_glyph_packer::insert(glyph_pack_rect& rect) noexcept
+{
+	const uint32_t padded_w = rect.w + m_padding;
+
+	const uint32_t padded_h = rect.h + m_padding;
+
+	uint32_t idx, y;
+
+	if (!skyline_find(m_nodes.data(), m_node_cnt, padded_w, padded_h, m_area_width, m_area_height, idx, y))
+		return false;
+
+	rect.x = m_nodes[idx].x;
+
+	rect.y = y;
+
+	skyline_insert(m_nodes.data(), m_node_cnt, idx, y, padded_w, padded_h);
+
+	return true;
+}
+
+void incremental_glyph_packer::destroy() noexcept
+{
+	m_nodes.deallocate();
+
+	m_node_cnt = 0;
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*///////////////////////////////////////////////// MaxRects /////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+struct free_rect
+{
+	uint32_t x;
+
+	uint32_t y;
+
+	uint32_t w;
+
+	uint32_t h;
+};
+
+static bool contains(const free_rect& outer, const free_rect& inner) noexcept
+{
+	return inner.x >= outer.x && inner.y >= outer.y && inner.x + inner.w <= outer.x + outer.w && inner.y + inner.h <= outer.y + outer.h;
+}
+
+static bool pack_max_rects(glyph_pack_rect* rects, uint32_t rect_cnt, uint32_t map_width, uint32_t padding, uint32_t& out_height) noexcept
+{
+	const uint32_t area_width = map_width - padding;
+
+	// Stacking all glyphs on top of each other always fits, so this height never runs out.
+	uint32_t area_height = 0;
+
+	for (uint32_t i = 0; i != rect_cnt; ++i)
+		area_height += rects[i].h + padding;
+
+	// Free rectangles not touched by the last placement are kept in the first list. Those split off by it are collected in the second one.
+
+	simple_vec<free_rect> free_rects(64);
+
+	simple_vec<free_rect> split_rects(64);
+
+	free_rects.add({ 0, 0, area_width, area_height });
+
+	uint32_t max_y = 0;
+
+	for (uint32_t i = 0; i != rect_cnt; ++i)
+	{
+		glyph_pack_rect& r = rects[i];
+
+		const uint32_t padded_w = r.w + padding;
+
+		const uint32_t padded_h = r.h + padding;
+
+		if (padded_w > area_width)
+			return false;
+
+		// Find the free rectangle giving the lowest top edge, preferring the leftmost one among equals
+
+		uint32_t best_idx = ~0u;
+
+		uint32_t best_top = ~0u;
+
+		uint32_t best_x = ~0u;
+
+		for (uint32_t j = 0; j != free_rects.size(); ++j)
+		{
+			const free_rect& f = free_rects[j];
+
+			if (f.w < padded_w || f.h < padded_h)
+				continue;
+
+			if (f.y + padded_h < best_top || (f.y + padded_h == best_top && f.x < best_x))
+			{
+				best_top = f.y + padded_h;
+
+				best_x = f.x;
+
+				best_idx = j;
+			}
+		}
+
+		const free_rect placed{ free_rects[best_idx].x, free_rects[best_idx].y, padded_w, padded_h };
+
+		r.x = placed.x;
+
+		r.y = placed.y;
+
+		if (best_top > max_y)
+			max_y = best_top;
+
+		// Split every free rectangle overlapping the placed one into the up to four maximal rectangles around it
+
+		split_rects.reset();
+
+		uint32_t kept_cnt = 0;
+
+		for (uint32_t j = 0; j != free_rects.size(); ++j)
+		{
+			const free_rect f = free_rects[j];
+
+			if (f.x >= placed.x + placed.w || f.x + f.w <= placed.x || f.y >= placed.y + placed.h || f.y + f.h <= placed.y)
+			{
+				free_rects[kept_cnt++] = f;
+
+				continue;
+			}
+
+			if (placed.x > f.x)
+				split_rects.add({ f.x, f.y, placed.x - f.x, f.h });
+
+			if (placed.x + placed.w < f.x + f.w)
+				split_rects.add({ placed.x + placed.w, f.y, f.x + f.w - placed.x - placed.w, f.h });
+
+			if (placed.y > f.y)
+				split_rects.add({ f.x, f.y, f.w, placed.y - f.y });
+
+			if (placed.y + placed.h < f.y + f.h)
+				split_rects.add({ f.x, placed.y + placed.h, f.w, f.y + f.h - placed.y - placed.h });
+		}
+
+		// An untouched rectangle cannot lie within a split one, since that lies within a removed rectangle and free rectangles never contain each other.
+		// So only the split rectangles need to be checked for redundancy.
+
+		const uint32_t untouched_cnt = kept_cnt;
+
+		for (uint32_t j = 0; j != split_rects.size(); ++j)
+		{
+			const free_rect& s = split_rects[j];
+
+			bool is_redundant = false;
+
+			for (uint32_t k = 0; k != untouched_cnt && !is_redundant; ++k)
+				is_redundant = contains(free_rects[k], s);
+
+			// Of two identical split rectangles, only the later one is kept
+			for (uint32_t k = 0; k != split_rects.size() && !is_redundant; ++k)
+				is_redundant = k != j && contains(split_rects[k], s) && (k > j || !contains(s, split_rects[k]));
+
+			if (!is_redundant)
+			{
+				if (kept_cnt == free_rects.size())
+					free_rects.add(s);
+				else
+					free_rects[kept_cnt] = s;
+
+				++kept_cnt;
+			}
+		}
+
+		while (free_rects.size() != kept_cnt)
+			free_rects.remove(free_rects.size() - 1);
+	}
+
+	out_height = max_y + padding;
+
+	return true;
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*///////////////////////////////////////////////// Dispatch /////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+bool pack_glyph_rects(glyph_packer packer, glyph_pack_rect* rects, uint32_t rect_cnt, uint32_t map_width, uint32_t padding, uint32_t& out_height) noexcept
+{
+	if (rect_cnt == 0)
+	{
+		out_height = 2 * padding;
+
+		return true;
+	}
+
+	if (map_width <= padding)
+		return false;
+
+	switch (packer)
+	{
+	case glyph_packer::shelf:
+		return pack_shelf(rects, rect_cnt, map_width, padding, out_height);
+
+	case glyph_packer::skyline:
+		return pack_skyline(rects, rect_cnt, map_width, padding, out_height);
+
+	case glyph_packer::max_rects:
+		return pack_max_rects(rects, rect_cnt, map_width, padding, out_height);
+
+	default:
+		return false;
+	}
+}
+
+bool pack_glyph_rects_paged(glyph_packer packer, glyph_pack_rect* rects, uint32_t* out_pages, uint32_t rect_cnt, uint32_t map_width, uint32_t page_height, uint32_t padding, uint32_t& out_page_cnt) noexcept
+{
+	// Each page is filled by packing the remaining rects into an unbounded map and keeping those that ended up within the page.
+	// The others are carried over to the next page. They stay sorted, since all of them come before the rects that were not considered yet.
+
+	heap_buffer<uint32_t> remaining(rect_cnt);
+
+	heap_buffer<glyph_pack_rect> candidates(rect_cnt);
+
+	for (uint32_t i = 0; i != rect_cnt; ++i)
+		remaining[i] = i;
+
+	uint32_t remaining_cnt = rect_cnt;
+
+	uint32_t page_cnt = 0;
+
+	const uint64_t page_area = static_cast<uint64_t>(map_width) * page_height;
+
+	while (remaining_cnt != 0)
+	{
+		// Only consider rects covering up to twice the page's area, so that each page costs about the same regardless of how many rects are left
+
+		uint32_t candidate_cnt = 0;
+
+		uint64_t candidate_area = 0;
+
+		while (candidate_cnt != remaining_cnt && (candidate_cnt == 0 || candidate_area < 2 * page_area))
+		{
+			const glyph_pack_rect& r = rects[remaining[candidate_cnt]];
+
+			candidates[candidate_cnt++] = { r.w, r.h, 0, 0 };
+
+			candidate_area += static_cast<uint64_t>(r.w + padding) * (r.h + padding);
+		}
+
+		uint32_t unused_height;
+
+		if (!pack_glyph_rects(packer, candidates.data(), candidate_cnt, map_width, padding, unused_height))
+			return false;
+
+		uint32_t carried_cnt = 0;
+
+		for (uint32_t i = 0; i != candidate_cnt; ++i)
+		{
+			const glyph_pack_rect& c = candidates[i];
+
+			if (c.y + c.h + 2 * padding <= page_height)
+			{
+				rects[remaining[i]].x = c.x;
+
+				rects[remaining[i]].y = c.y;
+
+				out_pages[remaining[i]] = page_cnt;
+			}
+			else
+			{
+				remaining[carried_cnt++] = remaining[i];
+			}
+		}
+
+		// Nothing fit, so the tallest remaining rect is taller than a page
+		if (carried_cnt == candidate_cnt)
+			return false;
+
+		memmove(remaining.data() + carried_cnt, remaining.data() + candidate_cnt, (remaining_cnt - candidate_cnt) * sizeof(uint32_t));
+
+		remaining_cnt -= candidate_cnt - carried_cnt;
+
+		++page_cnt;
+	}
+
+	out_page_cnt = page_cnt == 0 ? 1 : page_cnt;
+
+	return true;
+}
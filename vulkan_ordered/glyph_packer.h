@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+#include "heap_buffer.h"
+
+enum class glyph_packer : uint8_t
+{
+	// Rows of glyphs whose height is set by their first (tallest) glyph. Fast, but wastes the space above shorter glyphs.
+	shelf,
+
+	// Bottom-left placement onto the skyline formed by the top edges of all glyphs placed so far.
+	skyline,
+
+	// Bottom-left placement into a list of maximal free rectangles. Packs tightest, but is the slowest.
+	max_rects,
+};
+
+struct glyph_pack_rect
+{
+	uint32_t w;
+
+	uint32_t h;
+
+	uint32_t x;
+
+	uint32_t y;
+};
+
+// Assigns x and y to each of the rect_cnt rects so that the rectangles (x + padding, y + padding, w, h) are at least padding pixels apart from each other and from the edges of a map_width x out_height area.
+// rects should be sorted by descending height, and then by descending width. All packers rely on this order for good results.
+// Returns false if a rect is too wide to fit into map_width.
+bool pack_glyph_rects(glyph_packer packer, glyph_pack_rect* rects, uint32_t rect_cnt, uint32_t map_width, uint32_t padding, uint32_t& out_height) noexcept;
+
+// Like pack_glyph_rects, but spreads the rects over as many map_width x page_height pages as needed instead of growing a single map.
+// The page each rect ends up on is written to out_pages. rects must be sorted as for pack_glyph_rects.
+// Returns false if a rect does not fit onto a single page.
+bool pack_glyph_rects_paged(glyph_packer packer, glyph_pack_rect* rects, uint32_t* out_pages, uint32_t rect_cnt, uint32_t map_width, uint32_t page_height, uint32_t padding, uint32_t& out_page_cnt) noexcept;
+
+struct glyph_skyline_node
+{
+	uint32_t x;
+
+	uint32_t y;
+
+	uint32_t w;
+};
+
+// Places rects one at a time into a map_width x map_height area, for atlases that only learn which glyphs they hold as those are requested.
+// Uses the same placement as glyph_packer::skyline, but since the rects cannot be sorted beforehand, it packs less tightly.
+struct incremental_glyph_packer
+{
+private:
+
+	heap_buffer<glyph_skyline_node> m_nodes;
+
+	uint32_t m_node_cnt = 0;
+
+	uint32_t m_area_width = 0;
+
+	uint32_t m_area_height = 0;
+
+	uint32_t m_padding = 0;
+
+public:
+
+	void create(uint32_t map_width, uint32_t map_height, uint32_t padding) noexcept;
+
+	// Assigns x and y to rect with the same meaning as in pack_glyph_rects.
+	// Returns false, leaving rect unchanged, if there is no room left for it.
+	bool insert(glyph_pack_rect& rect) noexcept;
+
+	void destroy() noexcept;
+};
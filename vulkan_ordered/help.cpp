@@ -33,7 +33,9 @@ och::status run_help() noexcept
 	och::print("\tcompute_buffer_copy\n");
 	och::print("\tcompute_colour_to_swapchain\n");
 	och::print("\tcompute_simplex_to_swapchain\n");
-	och::print("\tsdf_font [ttf file] [cache file] [output image]\n");
+	och::print("\tsdf_font [ttf file] [cache file] [output image] [msdf | sdf]\n");
+	och::print("\tsdf_benchmark [ttf file] [gpu]\n");
+	och::print("\tatlas_benchmark [output csv] [ttf files...]\n");
 	och::print("\tvoxel_volume [brick size] [layer size] [layer count]\n\n");
 
 	return {};
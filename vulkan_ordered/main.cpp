@@ -8,6 +8,8 @@
 #include "compute_buffer_copy.h"
 #include "compute_to_swapchain.h"
 #include "sdf_font.h"
+#include "sdf_benchmark.h"
+#include "atlas_benchmark.h"
 #include "voxel_volume.h"
 #include "gpu_info.h"
 
@@ -24,6 +26,8 @@ enum class sample_type
 	sdf_font,
 	voxel_volume,
 	gpu_info,
+	sdf_benchmark,
+	atlas_benchmark,
 };
 
 const char* sample_names[]
@@ -36,6 +40,8 @@ const char* sample_names[]
 	"sdf_font",
 	"voxel_volume",
 	"gpu_info",
+	"sdf_benchmark",
+	"atlas_benchmark",
 };
 
 int main(int argc, const char** argv)
@@ -96,6 +102,14 @@ int main(int argc, const char** argv)
 	case sample_type::gpu_info:
 		err = run_gpu_info(argc, argv);
 		break;
+
+	case sample_type::sdf_benchmark:
+		err = run_sdf_benchmark(argc, argv);
+		break;
+
+	case sample_type::atlas_benchmark:
+		err = run_atlas_benchmark(argc, argv);
+		break;
 	}
 
 	if (err)
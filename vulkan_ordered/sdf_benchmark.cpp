@@ -0,0 +1,293 @@
+#include "sdf_benchmark.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "och_fmt.h"
+#include "och_timer.h"
+
+#include "sdf_glyph_atlas.h"
+#include "bc4_codec.h"
+#include "heap_buffer.h"
+#include "vulkan_base.h"
+#include "sdf_gpu.h"
+
+struct sdf_benchmark_config
+{
+	const char* name;
+
+	sdf_kernel_isa isa;
+
+	sdf_solver solver;
+};
+
+static constexpr sdf_benchmark_config BENCHMARK_CONFIGS[]
+{
+	{ "scalar / analytic",  sdf_kernel_isa::scalar, sdf_solver::analytic  },
+	{ "scalar / iterative", sdf_kernel_isa::scalar, sdf_solver::iterative },
+	{ "sse2 / analytic",    sdf_kernel_isa::sse2,   sdf_solver::analytic  },
+	{ "sse2 / iterative",   sdf_kernel_isa::sse2,   sdf_solver::iterative },
+	{ "avx / analytic",     sdf_kernel_isa::avx,    sdf_solver::analytic  },
+	{ "avx / iterative",    sdf_kernel_isa::avx,    sdf_solver::iterative },
+};
+
+static constexpr uint32_t BENCHMARK_CONFIG_CNT = sizeof(BENCHMARK_CONFIGS) / sizeof(*BENCHMARK_CONFIGS);
+
+struct sdf_benchmark_packer
+{
+	const char* name;
+
+	glyph_packer packer;
+};
+
+static constexpr sdf_benchmark_packer BENCHMARK_PACKERS[]
+{
+	{ "shelf",     glyph_packer::shelf     },
+	{ "skyline",   glyph_packer::skyline   },
+	{ "max_rects", glyph_packer::max_rects },
+};
+
+// Each configuration is built this many times, keeping the fastest run
+static constexpr uint32_t BENCHMARK_RUNS = 5;
+
+// Builds the atlas with sdf_gpu_renderer and compares it against reference, which must have been built on the CPU with the analytic solver.
+// Uses whichever device vulkan_context picks. For checking the shader on a machine without a GPU, make lavapipe the only installed driver.
+static och::status run_gpu_comparison(const char* ttf_filename, const och::range<glyph_atlas::codept_range> ranges, float clamp, const glyph_atlas& reference) noexcept
+{
+	vulkan_context context;
+
+	vulkan_context_create_info context_ci{};
+	context_ci.app_name = "SDF Benchmark";
+
+	check(context.create(&context_ci));
+
+	sdf_gpu_renderer renderer;
+
+	och::status err = renderer.create(context);
+
+	glyph_atlas atlas;
+
+	int64_t min_us = INT64_MAX;
+
+	for (uint32_t run = 0; run != BENCHMARK_RUNS && !err; ++run)
+	{
+		atlas.destroy();
+
+		glyph_atlas_build_options options{};
+		options.gpu_renderer = &renderer;
+
+		och::timer timer;
+
+		err = atlas.create(ttf_filename, 64, 2, clamp, 1024, ranges, options);
+
+		const int64_t us = timer.read().microseconds();
+
+		if (us < min_us)
+			min_us = us;
+	}
+
+	renderer.destroy();
+
+	context.destroy();
+
+	check(err);
+
+	if (renderer.render_cnt() != BENCHMARK_RUNS)
+	{
+		och::print("{:20} failed, atlas was rendered on the CPU instead\n", "gpu");
+
+		return {};
+	}
+
+	if (atlas.width() != reference.width() || atlas.height() != reference.height())
+	{
+		och::print("{:20} {:8} us  (atlas size differs from reference)\n", "gpu", min_us);
+
+		return {};
+	}
+
+	uint32_t diff_cnt = 0;
+
+	uint32_t max_diff = 0;
+
+	// Texels on opposite sides of the outline, which would show up as misplaced edges rather than as slightly shifted distances
+	uint32_t sign_diff_cnt = 0;
+
+	for (uint32_t j = 0; j != reference.width() * reference.height(); ++j)
+	{
+		const uint8_t a = atlas.raw_data()[j], b = reference.raw_data()[j];
+
+		const uint32_t diff = a > b ? a - b : b - a;
+
+		if (diff != 0)
+			++diff_cnt;
+
+		if (diff > max_diff)
+			max_diff = diff;
+
+		if ((a < 128) != (b < 128))
+			++sign_diff_cnt;
+	}
+
+	och::print("{:20} {:8} us  ({} texels differ from {}, by at most {}, {} of them in sign)\n", "gpu", min_us, diff_cnt, BENCHMARK_CONFIGS[0].name, max_diff, sign_diff_cnt);
+
+	return {};
+}
+
+och::status run_sdf_benchmark(int argc, const char** argv)
+{
+	const char* ttf_filename = argc >= 3 ? argv[2] : "C:/Windows/Fonts/calibri.ttf";
+
+	glyph_atlas::codept_range ranges[1]{ {32, 128} };
+
+	constexpr float clamp = 0.015625F * 2.0F;
+
+	och::print("Benchmarking SDF generation for {} on a single thread\n\n", ttf_filename);
+
+	// The first configuration serves as the reference all others are compared against
+	glyph_atlas atlases[BENCHMARK_CONFIG_CNT];
+
+	for (uint32_t i = 0; i != BENCHMARK_CONFIG_CNT; ++i)
+	{
+		const sdf_benchmark_config& config = BENCHMARK_CONFIGS[i];
+
+		if (sdf_supported_kernel_isa(config.isa) != config.isa)
+		{
+			och::print("{:20} not supported by this CPU\n", config.name);
+
+			continue;
+		}
+
+		glyph_atlas_build_options options{};
+		options.worker_thread_cnt = 1;
+		options.max_kernel_isa = config.isa;
+		options.solver = config.solver;
+
+		int64_t min_us = INT64_MAX;
+
+		for (uint32_t run = 0; run != BENCHMARK_RUNS; ++run)
+		{
+			atlases[i].destroy();
+
+			och::timer timer;
+
+			check(atlases[i].create(ttf_filename, 64, 2, clamp, 1024, och::range(ranges), options));
+
+			const int64_t us = timer.read().microseconds();
+
+			if (us < min_us)
+				min_us = us;
+		}
+
+		uint32_t diff_cnt = 0;
+
+		uint32_t max_diff = 0;
+
+		const glyph_atlas& reference = atlases[0];
+
+		if (atlases[i].width() != reference.width() || atlases[i].height() != reference.height())
+		{
+			och::print("{:20} {:8} us  (atlas size differs from reference)\n", config.name, min_us);
+
+			continue;
+		}
+
+		for (uint32_t j = 0; j != reference.width() * reference.height(); ++j)
+		{
+			const uint8_t a = atlases[i].raw_data()[j], b = reference.raw_data()[j];
+
+			const uint32_t diff = a > b ? a - b : b - a;
+
+			if (diff != 0)
+				++diff_cnt;
+
+			if (diff > max_diff)
+				max_diff = diff;
+		}
+
+		och::print("{:20} {:8} us  ({} texels differ from {}, by at most {})\n", config.name, min_us, diff_cnt, BENCHMARK_CONFIGS[0].name, max_diff);
+	}
+
+	// The GPU comparison needs a Vulkan device, so it is only run on request
+	if (argc >= 4 && strcmp(argv[3], "gpu") == 0)
+		check(run_gpu_comparison(ttf_filename, och::range(ranges), clamp, atlases[0]));
+
+	och::print("\nPacking\n\n");
+
+	for (const sdf_benchmark_packer& packer : BENCHMARK_PACKERS)
+	{
+		glyph_atlas_build_options options{};
+		options.worker_thread_cnt = 0;
+		options.packer = packer.packer;
+
+		glyph_atlas atlas;
+
+		check(atlas.create(ttf_filename, 64, 2, clamp, 1024, och::range(ranges), options));
+
+		och::print("{:20} {} x {}  ({:.1}% of the atlas covered by glyphs)\n", packer.name, atlas.width(), atlas.height(), atlas.packing_efficiency() * 100.0F);
+	}
+
+	och::print("\nBC4 encoding\n\n");
+
+	{
+		const glyph_atlas& reference = atlases[0];
+
+		const uint32_t width = reference.width(), height = reference.height() * reference.page_cnt();
+
+		heap_buffer<uint8_t> encodings[2]{ heap_buffer<uint8_t>(bc4_encoded_bytes(width, height)), heap_buffer<uint8_t>(bc4_encoded_bytes(width, height)) };
+
+		const sdf_kernel_isa encoder_isas[2]{ sdf_kernel_isa::scalar, sdf_kernel_isa::sse2 };
+
+		for (uint32_t i = 0; i != 2; ++i)
+		{
+			int64_t min_us = INT64_MAX;
+
+			for (uint32_t run = 0; run != BENCHMARK_RUNS; ++run)
+			{
+				och::timer timer;
+
+				bc4_encode(reference.raw_data(), width, height, encodings[i].data(), encoder_isas[i]);
+
+				const int64_t us = timer.read().microseconds();
+
+				if (us < min_us)
+					min_us = us;
+			}
+
+			const bool matches_scalar = memcmp(encodings[i].data(), encodings[0].data(), bc4_encoded_bytes(width, height)) == 0;
+
+			och::print("{:20} {:8} us  ({})\n", i == 0 ? "scalar" : "sse2", min_us, matches_scalar ? "identical to scalar" : "differs from scalar");
+		}
+
+		// Compare the decoded image against the uncompressed atlas
+
+		heap_buffer<uint8_t> decoded(width * height);
+
+		bc4_decode(encodings[0].data(), width, height, decoded.data());
+
+		uint32_t diff_cnt = 0;
+
+		uint32_t max_diff = 0;
+
+		uint64_t diff_sum = 0;
+
+		for (uint32_t j = 0; j != width * height; ++j)
+		{
+			const uint8_t a = decoded[j], b = reference.raw_data()[j];
+
+			const uint32_t diff = a > b ? a - b : b - a;
+
+			if (diff != 0)
+				++diff_cnt;
+
+			if (diff > max_diff)
+				max_diff = diff;
+
+			diff_sum += diff;
+		}
+
+		och::print("{:20} {} texels differ after decoding, by at most {} and {:.3} on average\n", "error", diff_cnt, max_diff, static_cast<float>(diff_sum) / static_cast<float>(width * height));
+	}
+
+	return {};
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "och_err.h"
+
+och::status run_sdf_benchmark(int argc, const char** argv);
@@ -3,6 +3,7 @@
 #include "directory_constants.h"
 
 #include <cmath>
+#include <cstring>
 
 #include "vulkan_base.h"
 #include "heap_buffer.h"
@@ -13,12 +14,24 @@
 
 #include "och_fmt.h"
 
+// A single-channel static atlas is uploaded BC4-compressed, which needs sampling support for BC formats.
+// Only installed when such an atlas is requested, since multi-channel and dynamic atlases are uploaded uncompressed.
+bool sdf_font_physical_device_suitable_callback(VkPhysicalDevice device) noexcept
+{
+	VkPhysicalDeviceFeatures features;
+
+	vkGetPhysicalDeviceFeatures(device, &features);
+
+	return features.textureCompressionBC;
+}
+
 struct sdf_font
 {
 	struct font_vertex
 	{
 		och::vec2 atlas_pos;
 		och::vec2 screen_pos;
+		uint32_t atlas_page;
 	};
 
 	static constexpr uint32_t MAX_FRAMES_INFLIGHT = 2;
@@ -26,6 +39,8 @@ struct sdf_font
 	static constexpr uint32_t MAX_DISPLAY_CHARS = 1024;
 	static_assert(MAX_DISPLAY_CHARS < UINT16_MAX / 6);
 
+	static constexpr uint32_t MAX_DIRTY_RECTS_PER_FRAME = 64;
+
 	static constexpr float DISPLAY_SCALE = 0.25F;
 
 	static constexpr float DISPLAY_MIN_X = -1.0F;
@@ -83,6 +98,24 @@ struct sdf_font
 
 	glyph_atlas atlas;
 
+	// Used instead of atlas when no cache file is given. Glyphs are then rendered as they are typed.
+	dynamic_glyph_atlas dynamic_atlas;
+
+	bool is_dynamic_atlas{};
+
+	float atlas_line_height{};
+
+	// Persistently mapped copy of the dynamic atlas' image. Each glyph's rectangle is written once, so it is never overwritten while a frame in flight reads it.
+	VkBuffer atlas_staging_buffer{};
+
+	VkDeviceMemory atlas_staging_buffer_memory{};
+
+	uint8_t* atlas_staging_buffer_ptr{};
+
+	uint32_t dirty_rect_cnt{};
+
+	dynamic_glyph_atlas::dirty_rect dirty_rects[MAX_DIRTY_RECTS_PER_FRAME];
+
 
 
 	VkBuffer vertex_buffer{};
@@ -113,15 +146,30 @@ struct sdf_font
 
 	och::vec2 pos_history[MAX_DISPLAY_CHARS]{};
 
+	// Multi-channel atlases keep corners sharp, so they get by with half the glyph size
+	bool use_msdf_atlas = true;
+
 
 
 	och::status create(int argc, const char** argv)
 	{
+		// The static atlas is multi-channel unless "sdf" is passed after the output image
+		use_msdf_atlas = !(argc >= 6 && strcmp(argv[5], "sdf") == 0);
+
+		// Only the static atlas, which needs a cache file, is ever BC4-compressed
+		const bool uses_bc4_atlas = !use_msdf_atlas && argc >= 4;
+
 		vulkan_context_create_info context_ci{};
 		context_ci.app_name = "Compute Font";
 		context_ci.window_width = 1440;
 		context_ci.window_height = 810;
+		context_ci.physical_device_suitable_callback = uses_bc4_atlas ? sdf_font_physical_device_suitable_callback : nullptr;
 
+		VkPhysicalDeviceFeatures2 enabled_features{};
+		enabled_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		enabled_features.pNext = nullptr;
+		enabled_features.features.textureCompressionBC = uses_bc4_atlas ? VK_TRUE : VK_FALSE;
+		context_ci.enabled_device_features2 = &enabled_features;
 
 		check(context.create(&context_ci));
 
@@ -317,7 +365,8 @@ struct sdf_font
 			if (argc >= 4)
 				cache_filename = argv[3];
 
-			if (argc == 5)
+			// May be left empty to only pass the atlas mode
+			if (argc >= 5 && argv[4][0] != '\0')
 				bmp_filename = argv[4];
 
 
@@ -325,18 +374,78 @@ struct sdf_font
 
 			constexpr float clamp = 0.015625F * 2.0F;
 
-			if (!cache_filename || atlas.load_glfatl(cache_filename))
+			const uint32_t static_glyph_size = use_msdf_atlas ? 32 : 64;
+
+			const float static_clamp = use_msdf_atlas ? clamp * 2.0F : clamp;
+
+			// Every mip level halves the padding between glyphs, so this allows for three levels
+			constexpr uint32_t static_glyph_padding = 4;
+
+			glyph_atlas_build_options atlas_options{};
+			atlas_options.worker_thread_cnt = 0;
+			atlas_options.page_height = 1024;
+			atlas_options.bc4_compress = !use_msdf_atlas;
+			atlas_options.sdf_mode = use_msdf_atlas ? glyph_sdf_mode::multi_channel : glyph_sdf_mode::single_channel;
+			atlas_options.mip_level_cnt = 0;
+
+			is_dynamic_atlas = !cache_filename;
+
+			if (is_dynamic_atlas)
+			{
+				check(dynamic_atlas.create(ttf_filename, 64, 2, clamp, 2048, 2048, atlas_options));
+
+				// Request the printable ASCII characters up front, so they are usually ready by the first keystroke
+				for (uint32_t cp = ranges[0].beg; cp != ranges[0].end; ++cp)
+					dynamic_atlas(cp);
+
+				atlas_line_height = dynamic_atlas.line_height();
+			}
+			else
 			{
-				check(atlas.create(ttf_filename, 64, 2, clamp, 1024, och::range(ranges)));
+				// Rebuilds the cache if it is missing or was built from a different font file or with different parameters
+				check(atlas.create_cached(cache_filename, ttf_filename, static_glyph_size, static_glyph_padding, static_clamp, 1024, och::range(ranges), atlas_options));
+
+				if (bmp_filename)
+					check(atlas.save_bmp(bmp_filename, true));
 
-				if(cache_filename)
-					check(atlas.save_glfatl(cache_filename, true));
+				atlas_line_height = atlas.line_height();
 			}
+		}
+
+		const uint32_t atlas_width = is_dynamic_atlas ? dynamic_atlas.width() : atlas.width();
+
+		const uint32_t atlas_height = is_dynamic_atlas ? dynamic_atlas.height() : atlas.height();
 
-			if (bmp_filename)
-				check(atlas.save_bmp(bmp_filename, true));
+		const uint32_t atlas_page_cnt = is_dynamic_atlas ? 1 : atlas.page_cnt();
+
+		// Glyphs of the dynamic atlas are uploaded one rectangle at a time, so it has no mip levels that would need updating along with them
+		const uint32_t atlas_mip_level_cnt = is_dynamic_atlas ? 1 : atlas.mip_level_cnt();
+
+		// The dynamic atlas receives single glyphs, which are not aligned to BC4 blocks, so it stays uncompressed
+		const bool is_bc4_atlas = !is_dynamic_atlas && atlas.bc4_data() != nullptr;
+
+		// Three-channel formats are rarely sampleable, so multi-channel atlases get an opaque alpha channel on upload
+		const bool is_msdf_atlas = !is_dynamic_atlas && atlas.channel_cnt() == 3;
+
+		const VkFormat atlas_format = is_bc4_atlas ? VK_FORMAT_BC4_UNORM_BLOCK : is_msdf_atlas ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8_UNORM;
+
+		// Offset of each mip level in the staging buffer
+		uint32_t atlas_upload_offsets[glyph_atlas::MAX_MIP_LEVEL_CNT + 1];
+
+		for (uint32_t level = 0; level != atlas_mip_level_cnt + 1; ++level)
+		{
+			if (is_dynamic_atlas)
+				atlas_upload_offsets[level] = level * atlas_width * atlas_height;
+			else if (is_bc4_atlas)
+				atlas_upload_offsets[level] = atlas.bc4_mip_offset(level);
+			else if (is_msdf_atlas)
+				atlas_upload_offsets[level] = atlas.mip_offset(level) / 3 * 4;
+			else
+				atlas_upload_offsets[level] = atlas.mip_offset(level);
 		}
 
+		const uint32_t atlas_upload_bytes = atlas_upload_offsets[atlas_mip_level_cnt];
+
 		// Allocate Device Image and Imageview to hold SDF Glyph Atlas
 		{
 			VkImageCreateInfo image_ci{};
@@ -344,12 +453,12 @@ struct sdf_font
 			image_ci.pNext = nullptr;
 			image_ci.flags = 0;
 			image_ci.imageType = VK_IMAGE_TYPE_2D;
-			image_ci.format = VK_FORMAT_R8_UNORM;
-			image_ci.extent.width = atlas.width();
-			image_ci.extent.height = atlas.height();
+			image_ci.format = atlas_format;
+			image_ci.extent.width = atlas_width;
+			image_ci.extent.height = atlas_height;
 			image_ci.extent.depth = 1;
-			image_ci.mipLevels = 1;
-			image_ci.arrayLayers = 1;
+			image_ci.mipLevels = atlas_mip_level_cnt;
+			image_ci.arrayLayers = atlas_page_cnt;
 			image_ci.samples = VK_SAMPLE_COUNT_1_BIT;
 			image_ci.tiling = VK_IMAGE_TILING_OPTIMAL;
 			image_ci.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
@@ -388,7 +497,7 @@ struct sdf_font
 			buffer_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 			buffer_ci.pNext = nullptr;
 			buffer_ci.flags = 0;
-			buffer_ci.size = atlas.width() * atlas.height();
+			buffer_ci.size = atlas_upload_bytes;
 			buffer_ci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 			buffer_ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 			buffer_ci.queueFamilyIndexCount = 1;
@@ -417,9 +526,33 @@ struct sdf_font
 			void* buffer_ptr;
 			check(vkMapMemory(context.m_device, img_staging_buffer_memory, 0, VK_WHOLE_SIZE, 0, &buffer_ptr));
 
-			memcpy(buffer_ptr, atlas.data(), atlas.width() * atlas.height());
+			// Glyphs of the dynamic atlas may still be rendering, so it starts out empty and receives them as dirty rectangles
+			if (is_dynamic_atlas)
+			{
+				memset(buffer_ptr, 0x00, atlas_width * atlas_height);
+			}
+			else if (is_msdf_atlas)
+			{
+				const uint8_t* src = atlas.raw_data();
+
+				uint8_t* dst = static_cast<uint8_t*>(buffer_ptr);
+
+				for (uint32_t i = 0; i != atlas.mip_offset(atlas_mip_level_cnt) / 3; ++i)
+				{
+					dst[i * 4] = src[i * 3];
+					dst[i * 4 + 1] = src[i * 3 + 1];
+					dst[i * 4 + 2] = src[i * 3 + 2];
+					dst[i * 4 + 3] = 0xFF;
+				}
 
-			vkUnmapMemory(context.m_device, img_staging_buffer_memory);
+				vkUnmapMemory(context.m_device, img_staging_buffer_memory);
+			}
+			else
+			{
+				memcpy(buffer_ptr, is_bc4_atlas ? atlas.bc4_data() : atlas.raw_data(), atlas_upload_bytes);
+
+				vkUnmapMemory(context.m_device, img_staging_buffer_memory);
+			}
 
 			// Copy data from staging buffer to image
 
@@ -439,26 +572,32 @@ struct sdf_font
 			transfer_dst_transition_barrier.image = font_image;
 			transfer_dst_transition_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			transfer_dst_transition_barrier.subresourceRange.baseMipLevel = 0;
-			transfer_dst_transition_barrier.subresourceRange.levelCount = 1;
+			transfer_dst_transition_barrier.subresourceRange.levelCount = atlas_mip_level_cnt;
 			transfer_dst_transition_barrier.subresourceRange.baseArrayLayer = 0;
-			transfer_dst_transition_barrier.subresourceRange.layerCount = 1;
+			transfer_dst_transition_barrier.subresourceRange.layerCount = atlas_page_cnt;
 			vkCmdPipelineBarrier(staging_command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &transfer_dst_transition_barrier);
 
-			VkBufferImageCopy buf_img_copy{};
-			buf_img_copy.bufferOffset = 0;
-			buf_img_copy.bufferRowLength = atlas.width();
-			buf_img_copy.bufferImageHeight = atlas.height();
-			buf_img_copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			buf_img_copy.imageSubresource.mipLevel = 0;
-			buf_img_copy.imageSubresource.baseArrayLayer = 0;
-			buf_img_copy.imageSubresource.layerCount = 1;
-			buf_img_copy.imageOffset.x = 0;
-			buf_img_copy.imageOffset.y = 0;
-			buf_img_copy.imageOffset.z = 0;
-			buf_img_copy.imageExtent.width = atlas.width();
-			buf_img_copy.imageExtent.height = atlas.height();
-			buf_img_copy.imageExtent.depth = 1;
-			vkCmdCopyBufferToImage(staging_command_buffer, img_staging_buffer, font_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &buf_img_copy);
+			VkBufferImageCopy buf_img_copies[glyph_atlas::MAX_MIP_LEVEL_CNT];
+
+			for (uint32_t level = 0; level != atlas_mip_level_cnt; ++level)
+			{
+				VkBufferImageCopy& buf_img_copy = buf_img_copies[level];
+				buf_img_copy.bufferOffset = atlas_upload_offsets[level];
+				// 0 means tightly packed. For BC4 that rounds the width and height up to whole blocks, as the encoder does.
+				buf_img_copy.bufferRowLength = 0;
+				buf_img_copy.bufferImageHeight = 0;
+				buf_img_copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				buf_img_copy.imageSubresource.mipLevel = level;
+				buf_img_copy.imageSubresource.baseArrayLayer = 0;
+				buf_img_copy.imageSubresource.layerCount = atlas_page_cnt;
+				buf_img_copy.imageOffset.x = 0;
+				buf_img_copy.imageOffset.y = 0;
+				buf_img_copy.imageOffset.z = 0;
+				buf_img_copy.imageExtent.width = is_dynamic_atlas ? atlas_width : atlas.mip_width(level);
+				buf_img_copy.imageExtent.height = is_dynamic_atlas ? atlas_height : atlas.mip_height(level);
+				buf_img_copy.imageExtent.depth = 1;
+			}
+			vkCmdCopyBufferToImage(staging_command_buffer, img_staging_buffer, font_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, atlas_mip_level_cnt, buf_img_copies);
 
 			VkImageMemoryBarrier shader_read_transition_barrier{};
 			shader_read_transition_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -472,16 +611,28 @@ struct sdf_font
 			shader_read_transition_barrier.image = font_image;
 			shader_read_transition_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			shader_read_transition_barrier.subresourceRange.baseMipLevel = 0;
-			shader_read_transition_barrier.subresourceRange.levelCount = 1;
+			shader_read_transition_barrier.subresourceRange.levelCount = atlas_mip_level_cnt;
 			shader_read_transition_barrier.subresourceRange.baseArrayLayer = 0;
-			shader_read_transition_barrier.subresourceRange.layerCount = 1;
+			shader_read_transition_barrier.subresourceRange.layerCount = atlas_page_cnt;
 			vkCmdPipelineBarrier(staging_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &shader_read_transition_barrier);
 
 			context.submit_onetime_command(staging_command_buffer, staging_command_pool, context.m_general_queues[0], true);
 
-			vkDestroyBuffer(context.m_device, img_staging_buffer, nullptr);
+			// The dynamic atlas keeps the staging buffer around to upload glyphs from as they finish rendering
+			if (is_dynamic_atlas)
+			{
+				atlas_staging_buffer = img_staging_buffer;
+
+				atlas_staging_buffer_memory = img_staging_buffer_memory;
 
-			vkFreeMemory(context.m_device, img_staging_buffer_memory, nullptr);
+				atlas_staging_buffer_ptr = static_cast<uint8_t*>(buffer_ptr);
+			}
+			else
+			{
+				vkDestroyBuffer(context.m_device, img_staging_buffer, nullptr);
+
+				vkFreeMemory(context.m_device, img_staging_buffer_memory, nullptr);
+			}
 		}
 
 		// Create Image View from atlas Image
@@ -491,17 +642,18 @@ struct sdf_font
 			image_view_ci.pNext = nullptr;
 			image_view_ci.flags = 0;
 			image_view_ci.image = font_image;
-			image_view_ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			image_view_ci.format = VK_FORMAT_R8_UNORM;
+			image_view_ci.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+			image_view_ci.format = atlas_format;
+			// The fragment shader takes the median of r, g and b. Replicating a single channel makes that median the channel itself.
 			image_view_ci.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-			image_view_ci.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-			image_view_ci.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+			image_view_ci.components.g = is_msdf_atlas ? VK_COMPONENT_SWIZZLE_IDENTITY : VK_COMPONENT_SWIZZLE_R;
+			image_view_ci.components.b = is_msdf_atlas ? VK_COMPONENT_SWIZZLE_IDENTITY : VK_COMPONENT_SWIZZLE_R;
 			image_view_ci.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
 			image_view_ci.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			image_view_ci.subresourceRange.baseMipLevel = 0;
-			image_view_ci.subresourceRange.levelCount = 1;
+			image_view_ci.subresourceRange.levelCount = atlas_mip_level_cnt;
 			image_view_ci.subresourceRange.baseArrayLayer = 0;
-			image_view_ci.subresourceRange.layerCount = 1;
+			image_view_ci.subresourceRange.layerCount = atlas_page_cnt;
 
 			check(vkCreateImageView(context.m_device, &image_view_ci, nullptr, &font_image_view));
 		}
@@ -710,7 +862,7 @@ struct sdf_font
 				{
 					pos_history[pos_history_idx++] = input_pos;
 
-					input_pos = { DISPLAY_MIN_X, input_pos.y + atlas.line_height() * DISPLAY_SCALE };
+					input_pos = { DISPLAY_MIN_X, input_pos.y + atlas_line_height * DISPLAY_SCALE };
 				}
 				else if (c == L'\b')
 				{
@@ -726,13 +878,13 @@ struct sdf_font
 				{
 					input_buffer[input_cnt] = c;
 
-					glyph_atlas::glyph_index glf = atlas(c);
+					glyph_atlas::glyph_index glf = is_dynamic_atlas ? dynamic_atlas(c) : atlas(c);
 
 					if (input_pos.x + DISPLAY_SCALE * (glf.real_extent.x + glf.real_bearing.x) > DISPLAY_MAX_X)
 					{
 						pos_history[pos_history_idx++] = input_pos;
 
-						input_pos = { DISPLAY_MIN_X, input_pos.y + atlas.line_height() * DISPLAY_SCALE };
+						input_pos = { DISPLAY_MIN_X, input_pos.y + atlas_line_height * DISPLAY_SCALE };
 					}
 
 					VkCommandBuffer staging_command_buffer;
@@ -760,6 +912,9 @@ struct sdf_font
 					sb.verts[2].screen_pos = input_pos + DISPLAY_SCALE * (glf.real_bearing + och::vec2(0, glf.real_extent.y));
 					sb.verts[3].screen_pos = input_pos + DISPLAY_SCALE * (glf.real_bearing + glf.real_extent);
 
+					for (font_vertex& v : sb.verts)
+						v.atlas_page = glf.atlas_page;
+
 					const uint16_t start_idx = static_cast<uint16_t>(input_cnt * 4);
 
 					sb.inds[0] = start_idx + 0;
@@ -886,6 +1041,9 @@ struct sdf_font
 
 			image_inflight_fences[swapchain_idx] = frame_inflight_fences[frame_idx];
 
+			if (is_dynamic_atlas)
+				stage_dirty_rects();
+
 			check(record_command_buffer(command_buffers[frame_idx], swapchain_idx));
 
 			VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
@@ -945,6 +1103,12 @@ struct sdf_font
 
 		vkFreeMemory(context.m_device, font_image_memory, nullptr);
 
+		vkDestroyBuffer(context.m_device, atlas_staging_buffer, nullptr);
+
+		vkFreeMemory(context.m_device, atlas_staging_buffer_memory, nullptr);
+
+		dynamic_atlas.destroy();
+
 		vkDestroyBuffer(context.m_device, staging_buffer, nullptr);
 
 		vkFreeMemory(context.m_device, staging_buffer_memory, nullptr);
@@ -990,6 +1154,84 @@ struct sdf_font
 		context.destroy();
 	}
 
+	// Copies the glyphs that finished rendering since the last frame into the staging buffer, at the same position they have in the atlas.
+	void stage_dirty_rects() noexcept
+	{
+		dirty_rect_cnt = dynamic_atlas.collect_dirty_rects(dirty_rects, MAX_DIRTY_RECTS_PER_FRAME);
+
+		const uint32_t atlas_width = dynamic_atlas.width();
+
+		for (uint32_t i = 0; i != dirty_rect_cnt; ++i)
+		{
+			const dynamic_glyph_atlas::dirty_rect& r = dirty_rects[i];
+
+			for (uint32_t y = r.y; y != r.y + r.h; ++y)
+				memcpy(atlas_staging_buffer_ptr + y * atlas_width + r.x, dynamic_atlas.raw_data() + y * atlas_width + r.x, r.w);
+		}
+	}
+
+	void record_dirty_rect_upload(VkCommandBuffer command_buffer) noexcept
+	{
+		VkImageMemoryBarrier transfer_dst_transition_barrier{};
+		transfer_dst_transition_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		transfer_dst_transition_barrier.pNext = nullptr;
+		transfer_dst_transition_barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		transfer_dst_transition_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		transfer_dst_transition_barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		transfer_dst_transition_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		transfer_dst_transition_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		transfer_dst_transition_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		transfer_dst_transition_barrier.image = font_image;
+		transfer_dst_transition_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		transfer_dst_transition_barrier.subresourceRange.baseMipLevel = 0;
+		transfer_dst_transition_barrier.subresourceRange.levelCount = 1;
+		transfer_dst_transition_barrier.subresourceRange.baseArrayLayer = 0;
+		transfer_dst_transition_barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &transfer_dst_transition_barrier);
+
+		VkBufferImageCopy buf_img_copies[MAX_DIRTY_RECTS_PER_FRAME];
+
+		for (uint32_t i = 0; i != dirty_rect_cnt; ++i)
+		{
+			const dynamic_glyph_atlas::dirty_rect& r = dirty_rects[i];
+
+			buf_img_copies[i].bufferOffset = r.y * dynamic_atlas.width() + r.x;
+			buf_img_copies[i].bufferRowLength = dynamic_atlas.width();
+			buf_img_copies[i].bufferImageHeight = dynamic_atlas.height();
+			buf_img_copies[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			buf_img_copies[i].imageSubresource.mipLevel = 0;
+			buf_img_copies[i].imageSubresource.baseArrayLayer = 0;
+			buf_img_copies[i].imageSubresource.layerCount = 1;
+			buf_img_copies[i].imageOffset.x = static_cast<int32_t>(r.x);
+			buf_img_copies[i].imageOffset.y = static_cast<int32_t>(r.y);
+			buf_img_copies[i].imageOffset.z = 0;
+			buf_img_copies[i].imageExtent.width = r.w;
+			buf_img_copies[i].imageExtent.height = r.h;
+			buf_img_copies[i].imageExtent.depth = 1;
+		}
+
+		vkCmdCopyBufferToImage(command_buffer, atlas_staging_buffer, font_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, dirty_rect_cnt, buf_img_copies);
+
+		VkImageMemoryBarrier shader_read_transition_barrier{};
+		shader_read_transition_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		shader_read_transition_barrier.pNext = nullptr;
+		shader_read_transition_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		shader_read_transition_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		shader_read_transition_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		shader_read_transition_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		shader_read_transition_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		shader_read_transition_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		shader_read_transition_barrier.image = font_image;
+		shader_read_transition_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		shader_read_transition_barrier.subresourceRange.baseMipLevel = 0;
+		shader_read_transition_barrier.subresourceRange.levelCount = 1;
+		shader_read_transition_barrier.subresourceRange.baseArrayLayer = 0;
+		shader_read_transition_barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &shader_read_transition_barrier);
+
+		dirty_rect_cnt = 0;
+	}
+
 	och::status record_command_buffer(VkCommandBuffer command_buffer, uint32_t swapchain_idx) noexcept
 	{
 		VkCommandBufferBeginInfo command_buffer_bi{};
@@ -999,6 +1241,9 @@ struct sdf_font
 		command_buffer_bi.pInheritanceInfo = nullptr;
 		check(vkBeginCommandBuffer(command_buffer, &command_buffer_bi));
 
+		if (dirty_rect_cnt)
+			record_dirty_rect_upload(command_buffer);
+
 		VkClearValue clear_value = { 0.8F, 0.8F, 0.8F, 1.0F };
 
 		VkRenderPassBeginInfo render_pass_bi{};
@@ -1109,7 +1354,7 @@ struct sdf_font
 		vertex_binding_description.stride = sizeof(font_vertex);
 		vertex_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-		VkVertexInputAttributeDescription vertex_attribute_descs[2]{};
+		VkVertexInputAttributeDescription vertex_attribute_descs[3]{};
 		// atlas_pos
 		vertex_attribute_descs[0].location = 0;
 		vertex_attribute_descs[0].binding = 0;
@@ -1120,6 +1365,11 @@ struct sdf_font
 		vertex_attribute_descs[1].binding = 0;
 		vertex_attribute_descs[1].format = VK_FORMAT_R32G32_SFLOAT;
 		vertex_attribute_descs[1].offset = offsetof(font_vertex, screen_pos);
+		// atlas_page
+		vertex_attribute_descs[2].location = 2;
+		vertex_attribute_descs[2].binding = 0;
+		vertex_attribute_descs[2].format = VK_FORMAT_R32_UINT;
+		vertex_attribute_descs[2].offset = offsetof(font_vertex, atlas_page);
 
 		VkPipelineVertexInputStateCreateInfo vertex_input_ci{};
 		vertex_input_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -1127,7 +1377,7 @@ struct sdf_font
 		vertex_input_ci.flags = 0;
 		vertex_input_ci.vertexBindingDescriptionCount = 1;
 		vertex_input_ci.pVertexBindingDescriptions = &vertex_binding_description;
-		vertex_input_ci.vertexAttributeDescriptionCount = 2;
+		vertex_input_ci.vertexAttributeDescriptionCount = 3;
 		vertex_input_ci.pVertexAttributeDescriptions = vertex_attribute_descs;
 
 		VkPipelineInputAssemblyStateCreateInfo input_assembly_ci{};
@@ -3,283 +3,551 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cassert>
+#include <atomic>
+
+#define NOMINMAX
+#include <Windows.h>
 
 #include "och_err.h"
 #include "och_matmath.h"
 #include "truetype.h"
 #include "heap_buffer.h"
 #include "image_view.h"
+#include "texels.h"
 #include "bitmap.h"
+#include "sdf_kernels.h"
+#include "glyph_packer.h"
+#include "bc4_codec.h"
+#include "sdf_gpu.h"
+#include "och_timer.h"
 
 #define TEMP_STATUS_MACRO to_status(och::status(1, och::error_type::och))
 
-static void cubic_poly_roots(float a3, float a2, float a1, float a0, float& r0, float& r1, float& r2) noexcept
+// Rows of the SDF are grouped into bands of this height, each listing the curves that can be within the culling radius of one of its pixels.
+// Bands are further split into square blocks of the same size, which can be skipped entirely once they are known to be saturated.
+static constexpr uint32_t SDF_BLOCK_SIZE = 8;
+
+static_assert(SDF_BLOCK_SIZE % SDF_KERNEL_MAX_LANES == 0);
+
+struct sdf_curve_span
 {
-	constexpr float TOO_SMALL = 1e-7F;
+	uint32_t y_beg;
 
-	constexpr float PI = 3.14159265359F;
+	uint32_t y_end;
 
-	a2 /= a3;
+	uint32_t x_beg;
 
-	a1 /= a3;
+	uint32_t x_cnt;
+};
 
-	a0 /= a3;
+// Rectangle of pixels [x_beg, x_end) x [y_beg, y_end) within a glyph's SDF cell
+struct sdf_pixel_rect
+{
+	uint32_t x_beg;
 
-	const float q = (3.0F * a1 - (a2 * a2)) / 9.0F;
+	uint32_t y_beg;
 
-	const float r = (-27.0F * a0 + a2 * (9.0F * a1 - 2.0F * a2 * a2)) / 54.0F;
+	uint32_t x_end;
 
-	const float disc = q * q * q + r * r;
+	uint32_t y_end;
+};
 
-	const float term_1 = -a2 / 3.0F;
+// Returns the pixels of a pixel_width x pixel_height cell that lie within radius of the outline in curves, or an empty rectangle if there are none.
+// Every pixel outside the rectangle is further than radius from the outline, and thus saturates to the outside value.
+static sdf_pixel_rect sdf_glyph_bounds(const sdf_curve_table& curves, uint32_t pixel_width, uint32_t pixel_height, float radius) noexcept
+{
+	if (curves.curve_cnt == 0)
+		return { 0, 0, 0, 0 };
 
-	if (disc > TOO_SMALL)
-	{
-		const float disc_sqrt = sqrtf(disc);
+	// The extremes of a quadratic bezier in each axis are at its endpoints or where its derivative 2 * (d1 + t * d2) is zero.
 
-		float s = r + disc_sqrt;
+	och::vec2 min{ INFINITY, INFINITY };
 
-		s = s < 0.0F ? -cbrtf(-s) : cbrtf(s);
+	och::vec2 max{ -INFINITY, -INFINITY };
 
-		float t = r - disc_sqrt;
+	for (uint32_t i = 0; i != curves.curve_cnt; ++i)
+	{
+		const float p0[2]{ curves.p0_x[i], curves.p0_y[i] };
+		const float p1[2]{ curves.p1_x[i], curves.p1_y[i] };
+		const float p2[2]{ curves.p2_x[i], curves.p2_y[i] };
+		const float d1[2]{ curves.d1_x[i], curves.d1_y[i] };
+		const float d2[2]{ curves.d2_x[i], curves.d2_y[i] };
 
-		t = t < 0.0F ? -cbrtf(-t) : cbrtf(t);
+		float lo[2], hi[2];
 
-		r0 = term_1 + s + t;
+		for (uint32_t a = 0; a != 2; ++a)
+		{
+			lo[a] = fminf(p0[a], p2[a]);
 
-		r1 = INFINITY;
+			hi[a] = fmaxf(p0[a], p2[a]);
 
-		r2 = INFINITY;
-	}
-	else if (disc < -TOO_SMALL)
-	{
-		const float dummy = acosf(r / sqrtf(-q * q * q));
+			if (d2[a] != 0.0F)
+			{
+				const float t = -d1[a] / d2[a];
 
-		const float r13 = 2.0F * sqrtf(-q);
+				if (t > 0.0F && t < 1.0F)
+				{
+					const float v = p0[a] + t * (2.0F * d1[a] + t * d2[a]);
 
-		r0 = term_1 + r13 * cosf(dummy / 3.0F);
+					lo[a] = fminf(lo[a], v);
 
-		r1 = term_1 + r13 * cosf((dummy + 2.0F * PI) / 3.0F);
+					hi[a] = fmaxf(hi[a], v);
+				}
+			}
+		}
 
-		r2 = term_1 + r13 * cosf((dummy + 4.0F * PI) / 3.0F);
+		min.x = fminf(min.x, lo[0]);
+		min.y = fminf(min.y, lo[1]);
+		max.x = fmaxf(max.x, hi[0]);
+		max.y = fmaxf(max.y, hi[1]);
 	}
-	else
-	{
-		const float r13 = r < 0.0F ? -cbrtf(-r) : cbrtf(r);
 
-		r0 = term_1 + 2.0F * r13;
+	const float img_step = 1.0F / fmaxf(static_cast<float>(pixel_width), static_cast<float>(pixel_height));
+
+	const float x_lo = ceilf(fmaxf((min.x - radius) / img_step, 0.0F));
+	const float x_hi = floorf(fminf((max.x + radius) / img_step, static_cast<float>(pixel_width - 1)));
+	const float y_lo = ceilf(fmaxf((min.y - radius) / img_step, 0.0F));
+	const float y_hi = floorf(fminf((max.y + radius) / img_step, static_cast<float>(pixel_height - 1)));
 
-		r1 = term_1 - r13;
+	if (x_lo > x_hi || y_lo > y_hi)
+		return { 0, 0, 0, 0 };
 
-		r2 = INFINITY;
-	}
+	return { static_cast<uint32_t>(x_lo), static_cast<uint32_t>(y_lo), static_cast<uint32_t>(x_hi) + 1, static_cast<uint32_t>(y_hi) + 1 };
 }
 
-static och::vec2 bezier_interp(och::vec2 p0, och::vec2 p1, och::vec2 p2, float t) noexcept
+// Curves and saturated blocks of a glyph's SDF cell, sorted into bands of SDF_BLOCK_SIZE rows
+struct sdf_cull_grid
+{
+	heap_buffer<sdf_curve_span> spans;
+
+	// Curves that can affect band i are band_curves[band_offsets[i]] to band_curves[band_offsets[i + 1] - 1]
+	heap_buffer<uint32_t> band_offsets;
+
+	heap_buffer<uint32_t> band_curves;
+
+	heap_buffer<uint8_t> is_block_active;
+
+	// Next free slot of each band in band_curves while it is being filled
+	heap_buffer<uint32_t> band_fill;
+
+	uint32_t band_cnt;
+
+	uint32_t block_cnt_x;
+};
+
+// Closest point found so far on the curves assigned to one channel of a pixel in msdf_from_glyph
+struct msdf_channel_candidate
+{
+	uint32_t curve_idx;
+
+	sdf_closest_point closest;
+};
+
+// Working memory of sdf_from_glyph and msdf_from_glyph.
+// Each rendering thread keeps one for all its glyphs, so that the buffers only reach the heap when a glyph needs more than any before it.
+struct sdf_render_scratch
+{
+	sdf_cull_grid grid;
+
+	heap_buffer<float> row_buffer;
+
+	heap_buffer<int32_t> winding;
+
+	heap_buffer<uint8_t> saturated_texels;
+
+	heap_buffer<texel_r8g8b8> saturated_rgb_texels;
+
+	heap_buffer<msdf_channel_candidate> candidates;
+};
+
+// Grows buffer to hold at least cnt elements, keeping it as is if it already does. The contents are not preserved when growing.
+template<typename T>
+static T* reserve_scratch(heap_buffer<T>& buffer, uint32_t cnt) noexcept
 {
-	return (1.0F - t) * (1.0F - t) * p0 + 2.0F * (1.0F - t) * t * p1 + t * t * p2;
+	if (buffer.size() < cnt)
+		buffer.allocate(cnt);
+
+	return buffer.data();
 }
 
-static void check_roots(float r0, float r1, float r2, och::vec2 p0, och::vec2 p1, och::vec2 p2, och::vec2 p, float& min_dst_sq, float& min_t, och::vec2& min_p)
+static void sdf_build_cull_grid(const sdf_curve_table& curves, uint32_t pixel_width, uint32_t pixel_height, sdf_pixel_rect region, float cull_radius, bool skip_saturated_blocks, sdf_cull_grid& out) noexcept
 {
-	min_dst_sq = och::squared_magnitude(p - p0); // dst_b;
+	const float img_step = 1.0F / fmaxf(static_cast<float>(pixel_width), static_cast<float>(pixel_height));
 
-	min_t = 0.0F;
+	const uint32_t curve_cnt = curves.curve_cnt;
 
-	min_p = p0;
+	// Find the pixels of region each curve can affect. A quadratic bezier lies within the bounding box of its control points,
+	// so pixels outside that box grown by cull_radius are further than cull_radius from the curve and saturate regardless.
 
-	const float dst_e = och::squared_magnitude(p - p2);
+	reserve_scratch(out.spans, curve_cnt);
 
-	if (dst_e < min_dst_sq)
-	{
-		min_dst_sq = dst_e;
+	const uint32_t band_cnt = (pixel_height + SDF_BLOCK_SIZE - 1) / SDF_BLOCK_SIZE;
 
-		min_t = 1.0F;
+	out.band_cnt = band_cnt;
 
-		min_p = p2;
-	}
+	reserve_scratch(out.band_offsets, band_cnt + 1);
+
+	for (uint32_t i = 0; i != band_cnt + 1; ++i)
+		out.band_offsets[i] = 0;
 
-	if (r0 > 0.0F && r0 < 1.0F)
+	for (uint32_t i = 0; i != curve_cnt; ++i)
 	{
-		const och::vec2 pb = bezier_interp(p0, p1, p2, r0);
+		const float min_x = fminf(fminf(curves.p0_x[i], curves.p1_x[i]), curves.p2_x[i]) - cull_radius;
+		const float max_x = fmaxf(fmaxf(curves.p0_x[i], curves.p1_x[i]), curves.p2_x[i]) + cull_radius;
+		const float min_y = fminf(fminf(curves.p0_y[i], curves.p1_y[i]), curves.p2_y[i]) - cull_radius;
+		const float max_y = fmaxf(fmaxf(curves.p0_y[i], curves.p1_y[i]), curves.p2_y[i]) + cull_radius;
 
-		const float dst_0 = och::squared_magnitude(p - pb);
+		const float x_lo = ceilf(fmaxf(min_x / img_step, static_cast<float>(region.x_beg)));
+		const float x_hi = floorf(fminf(max_x / img_step, static_cast<float>(region.x_end - 1)));
+		const float y_lo = ceilf(fmaxf(min_y / img_step, static_cast<float>(region.y_beg)));
+		const float y_hi = floorf(fminf(max_y / img_step, static_cast<float>(region.y_end - 1)));
 
-		if (dst_0 < min_dst_sq)
+		if (y_lo > y_hi)
 		{
-			min_dst_sq = dst_0;
+			out.spans[i] = { 0, 0, 0, 0 };
 
-			min_t = r0;
+			continue;
+		}
+
+		// Curves entirely to the side of region are kept in the bands with an empty x-range, since they still contribute to the winding number.
+		if (x_lo > x_hi)
+		{
+			out.spans[i] = { static_cast<uint32_t>(y_lo), static_cast<uint32_t>(y_hi) + 1, 0, 0 };
+		}
+		else
+		{
+			const uint32_t x_beg = static_cast<uint32_t>(x_lo) & ~(SDF_KERNEL_MAX_LANES - 1);
 
-			min_p = pb;
+			out.spans[i] = { static_cast<uint32_t>(y_lo), static_cast<uint32_t>(y_hi) + 1, x_beg, static_cast<uint32_t>(x_hi) + 1 - x_beg };
 		}
+
+		for (uint32_t band = out.spans[i].y_beg / SDF_BLOCK_SIZE; band <= (out.spans[i].y_end - 1) / SDF_BLOCK_SIZE; ++band)
+			++out.band_offsets[band + 1];
 	}
 
-	if (r1 > 0.0F && r1 < 1.0F)
+	for (uint32_t i = 0; i != band_cnt; ++i)
+		out.band_offsets[i + 1] += out.band_offsets[i];
+
+	reserve_scratch(out.band_curves, out.band_offsets[band_cnt]);
+
 	{
-		const och::vec2 pb = bezier_interp(p0, p1, p2, r1);
+		uint32_t* const band_fill = reserve_scratch(out.band_fill, band_cnt);
 
-		const float dst_1 = och::squared_magnitude(p - pb);
+		for (uint32_t i = 0; i != band_cnt; ++i)
+			band_fill[i] = out.band_offsets[i];
 
-		if (dst_1 < min_dst_sq)
+		for (uint32_t i = 0; i != curve_cnt; ++i)
 		{
-			min_dst_sq = dst_1;
-
-			min_t = r1;
+			if (out.spans[i].y_beg == out.spans[i].y_end)
+				continue;
 
-			min_p = pb;
+			for (uint32_t band = out.spans[i].y_beg / SDF_BLOCK_SIZE; band <= (out.spans[i].y_end - 1) / SDF_BLOCK_SIZE; ++band)
+				out.band_curves[band_fill[band]++] = i;
 		}
 	}
 
-	if (r2 > 0.0F && r2 < 1.0F)
+	// A block not overlapped by any curve's span is further than cull_radius from the outline, so all its pixels saturate to the same value.
+	// That only holds for the whole block if the outline cannot slip between its pixel centers, i.e. if cull_radius is at least a pixel.
+
+	const uint32_t block_cnt_x = (pixel_width + SDF_BLOCK_SIZE - 1) / SDF_BLOCK_SIZE;
+
+	out.block_cnt_x = block_cnt_x;
+
+	reserve_scratch(out.is_block_active, block_cnt_x * band_cnt);
+
 	{
-		const och::vec2 pb = bezier_interp(p0, p1, p2, r2);
+		const bool is_skipping = skip_saturated_blocks && cull_radius >= img_step;
 
-		const float dst_2 = och::squared_magnitude(p - pb);
+		for (uint32_t i = 0; i != block_cnt_x * band_cnt; ++i)
+			out.is_block_active[i] = !is_skipping;
 
-		if (dst_2 < min_dst_sq)
-		{
-			min_dst_sq = dst_2;
+		if (is_skipping)
+			for (uint32_t i = 0; i != curve_cnt; ++i)
+			{
+				const sdf_curve_span& span = out.spans[i];
 
-			min_t = r2;
+				if (span.y_beg == span.y_end || span.x_cnt == 0)
+					continue;
 
-			min_p = pb;
-		}
+				for (uint32_t by = span.y_beg / SDF_BLOCK_SIZE; by <= (span.y_end - 1) / SDF_BLOCK_SIZE; ++by)
+					for (uint32_t bx = span.x_beg / SDF_BLOCK_SIZE; bx <= (span.x_beg + span.x_cnt - 1) / SDF_BLOCK_SIZE; ++bx)
+						out.is_block_active[by * block_cnt_x + bx] = true;
+			}
 	}
 }
 
-static bool evaluate_curve_for_pixel(och::vec2 p0, och::vec2 p1, och::vec2 p2, och::vec2 p, float& global_min_dst_sq, float& global_min_dst_sgn, float& global_min_dst_max_orthogonality)
+// Renders the pixels in region of the pixel_width x pixel_height SDF cell of the outline in curves.
+// Pixel (x, y) of the cell is written to img(x - region.x_beg, region.y_end - 1 - y), i.e. rows are stored bottom to top.
+// All working memory comes from scratch_buffers.
+template<typename Mapper>
+static void sdf_from_glyph(image_view<uint8_t> img, const sdf_curve_table& curves, uint32_t pixel_width, uint32_t pixel_height, sdf_pixel_rect region, const Mapper& mapper, float cull_radius, sdf_row_kernel_fn kernel, bool skip_saturated_blocks, sdf_render_scratch& scratch_buffers)
 {
-	const och::vec2 dp = p - p0;
+	const float img_step = 1.0F / fmaxf(static_cast<float>(pixel_width), static_cast<float>(pixel_height));
 
-	const och::vec2 d1 = p1 - p0;
+	const uint32_t padded_width = (pixel_width + SDF_KERNEL_MAX_LANES - 1) & ~(SDF_KERNEL_MAX_LANES - 1);
 
-	const och::vec2 d2 = p2 - 2.0F * p1 + p0;
+	sdf_cull_grid& grid = scratch_buffers.grid;
 
-	const float a3 = och::dot(d2, d2);
+	sdf_build_cull_grid(curves, pixel_width, pixel_height, region, cull_radius, skip_saturated_blocks, grid);
 
-	const float a2 = 3.0F * och::dot(d1, d2);
+	const uint8_t outside_texel = mapper(-INFINITY);
 
-	const float a1 = 2.0F * och::dot(d1, d1) - och::dot(d2, dp);
+	const uint8_t inside_texel = mapper(INFINITY);
 
-	const float a0 = -och::dot(d1, dp);
+	const sdf_row_state row{ reserve_scratch(scratch_buffers.row_buffer, padded_width) };
 
+	// Winding numbers and saturated blocks are only needed up to the right edge of region
 
-	float min_dst_sq;
+	int32_t* const winding = reserve_scratch(scratch_buffers.winding, region.x_end);
 
-	float min_t;
+	const uint32_t block_beg_x = region.x_beg / SDF_BLOCK_SIZE;
 
-	och::vec2 min_p;
+	const uint32_t block_end_x = (region.x_end + SDF_BLOCK_SIZE - 1) / SDF_BLOCK_SIZE;
 
+	uint8_t* const saturated_texels = reserve_scratch(scratch_buffers.saturated_texels, grid.block_cnt_x);
 
-	if (fabs(a3) > 1e-7F)
+	// Start looping over region
+
+	for (uint32_t band = region.y_beg / SDF_BLOCK_SIZE; band <= (region.y_end - 1) / SDF_BLOCK_SIZE; ++band)
 	{
-		float r0, r1, r2;
+		const uint8_t* const band_active = grid.is_block_active.data() + band * grid.block_cnt_x;
 
-		cubic_poly_roots(a3, a2, a1, a0, r0, r1, r2);
+		const uint32_t* const band_curve_indices = grid.band_curves.data() + grid.band_offsets[band];
 
-		check_roots(r0, r1, r2, p0, p1, p2, p, min_dst_sq, min_t, min_p);
-	}
-	else
-	{
-		min_t = och::dot(p - p0, p2 - p0) / och::dot(p2 - p0, p2 - p0);
+		const uint32_t band_curve_cnt = grid.band_offsets[band + 1] - grid.band_offsets[band];
 
-		if (min_t > 1.0F)
-			min_t = 1.0F;
-		else if (min_t < 0.0F)
-			min_t = 0.0F;
+		const uint32_t band_beg = band * SDF_BLOCK_SIZE > region.y_beg ? band * SDF_BLOCK_SIZE : region.y_beg;
 
-		min_p = p0 * (1.0F - min_t) + p2 * min_t;
+		const uint32_t band_end = band * SDF_BLOCK_SIZE + SDF_BLOCK_SIZE < region.y_end ? band * SDF_BLOCK_SIZE + SDF_BLOCK_SIZE : region.y_end;
 
-		min_dst_sq = och::squared_magnitude(p - min_p);
-	}
+		bool is_band_active = false;
 
-	if (min_dst_sq <= global_min_dst_sq + 1e-7F)
-	{
-		const och::vec2 deriv = 2.0F * min_t * (p2 - 2.0F * p1 + p0) + 2.0F * (p1 - p0); // 2.0F * (min_t * (p0 - 2.0F * p1 + p2) + p1 - p0);
+		for (uint32_t bx = block_beg_x; bx != block_end_x; ++bx)
+			if (band_active[bx])
+				is_band_active = true;
+
+		// The outline does not pass through saturated blocks, so one row of winding numbers gives the sign of all of them.
+		// The sign comes from the nonzero winding number rather than from the nearest curve.
+		// This does not depend on which curve is nearest, so it is also correct for pixels whose nearest curve was culled and at corners where several curves are equally near.
+
+		sdf_row_winding(curves, band_curve_indices, band_curve_cnt, img_step * static_cast<float>(band_beg), img_step, region.x_end, winding);
 
-		const float orthogonality = fabs(och::cross(och::normalize(deriv), och::normalize(p - min_p)));
+		for (uint32_t bx = block_beg_x; bx != block_end_x; ++bx)
+			saturated_texels[bx] = winding[bx * SDF_BLOCK_SIZE] != 0 ? inside_texel : outside_texel;
 
-		if (min_dst_sq + 1e-7F < global_min_dst_sq || global_min_dst_max_orthogonality < orthogonality)
+		for (uint32_t y = band_beg; y != band_end; ++y)
 		{
-			global_min_dst_sq = min_dst_sq;
+			const uint32_t out_y = region.y_end - 1 - y;
+
+			if (!is_band_active)
+			{
+				for (uint32_t x = region.x_beg; x != region.x_end; ++x)
+					img(x - region.x_beg, out_y) = saturated_texels[x / SDF_BLOCK_SIZE];
+
+				continue;
+			}
+
+			const float py = img_step * static_cast<float>(y);
+
+			sdf_init_row_state(row, pixel_width);
+
+			for (uint32_t i = 0; i != band_curve_cnt; ++i)
+			{
+				const sdf_curve_span& span = grid.spans[band_curve_indices[i]];
+
+				if (y < span.y_beg || y >= span.y_end)
+					continue;
+
+				// Evaluate the curve over each run of consecutive active blocks within its span
+
+				const uint32_t span_end = span.x_beg + span.x_cnt;
 
-			global_min_dst_sgn = och::cross(deriv, min_p - p) < 0.0F ? -1.0F : 1.0F;
+				uint32_t run_beg = span.x_beg;
+
+				while (run_beg < span_end)
+				{
+					while (run_beg < span_end && !band_active[run_beg / SDF_BLOCK_SIZE])
+						run_beg += SDF_BLOCK_SIZE;
+
+					uint32_t run_end = run_beg;
+
+					while (run_end < span_end && band_active[run_end / SDF_BLOCK_SIZE])
+						run_end += SDF_BLOCK_SIZE;
+
+					if (run_end > span_end)
+						run_end = span_end;
+
+					if (run_beg < run_end)
+						kernel(curves, band_curve_indices[i], py, img_step, run_beg, run_end - run_beg, row);
+
+					run_beg = run_end;
+				}
+			}
 
-			global_min_dst_max_orthogonality = orthogonality;
+			if (y != band_beg)
+				sdf_row_winding(curves, band_curve_indices, band_curve_cnt, py, img_step, region.x_end, winding);
 
-			return true;
+			for (uint32_t x = region.x_beg; x != region.x_end; ++x)
+			{
+				if (band_active[x / SDF_BLOCK_SIZE])
+					img(x - region.x_beg, out_y) = mapper(winding[x] != 0 ? sqrtf(row.min_dst_sq[x]) : -sqrtf(row.min_dst_sq[x]));
+				else
+					img(x - region.x_beg, out_y) = saturated_texels[x / SDF_BLOCK_SIZE];
+			}
 		}
 	}
-
-	return false;
 }
 
-template<typename Texel, typename Mapper>
-static void sdf_from_glyph(image_view<Texel> img, const glyph_data& glyph, uint32_t pixel_width, uint32_t pixel_height, float glyph_scale, const Mapper& mapper)
+// Renders the pixels in region of the multi-channel SDF of the outline in curves, laid out like the output of sdf_from_glyph.
+// Each channel holds the pseudo-distance to the nearest of the curves curve_channels assigns to it (see sdf_color_edges and sdf_curve_pseudo_distance).
+// Where the median of the channels would put a texel on the wrong side of the outline, all channels get the single-channel distance instead.
+// Channels without any curve within cull_radius saturate to the side given by the winding number.
+// The nearest curve of each channel has to be known, which the row kernels do not report, so distances are evaluated one pixel at a time.
+template<typename Mapper>
+static void msdf_from_glyph(image_view<texel_r8g8b8> img, const sdf_curve_table& curves, const uint8_t* curve_channels, uint32_t pixel_width, uint32_t pixel_height, sdf_pixel_rect region, const Mapper& mapper, float cull_radius, bool skip_saturated_blocks, sdf_render_scratch& scratch_buffers)
 {
+	static constexpr uint32_t NO_CURVE = ~0u;
+
+	const float img_step = 1.0F / fmaxf(static_cast<float>(pixel_width), static_cast<float>(pixel_height));
+
+	sdf_cull_grid& grid = scratch_buffers.grid;
+
+	sdf_build_cull_grid(curves, pixel_width, pixel_height, region, cull_radius, skip_saturated_blocks, grid);
+
+	const texel_r8g8b8 outside_texel(mapper(-INFINITY));
+
+	const texel_r8g8b8 inside_texel(mapper(INFINITY));
+
+	int32_t* const winding = reserve_scratch(scratch_buffers.winding, region.x_end);
+
+	// Three per pixel of the row, one for each channel
+	msdf_channel_candidate* const candidates = reserve_scratch(scratch_buffers.candidates, region.x_end * 3);
+
+	const uint32_t block_beg_x = region.x_beg / SDF_BLOCK_SIZE;
+
+	const uint32_t block_end_x = (region.x_end + SDF_BLOCK_SIZE - 1) / SDF_BLOCK_SIZE;
+
+	texel_r8g8b8* const saturated_texels = reserve_scratch(scratch_buffers.saturated_rgb_texels, grid.block_cnt_x);
+
+	for (uint32_t band = region.y_beg / SDF_BLOCK_SIZE; band <= (region.y_end - 1) / SDF_BLOCK_SIZE; ++band)
 	{
-		const Texel min_texel = mapper(-1.0F);
+		const uint8_t* const band_active = grid.is_block_active.data() + band * grid.block_cnt_x;
 
-		for (uint32_t y = 0; y != pixel_height; ++y)
-			for (uint32_t x = 0; x != pixel_width; ++x)
-				img(x, y) = min_texel;
+		const uint32_t* const band_curve_indices = grid.band_curves.data() + grid.band_offsets[band];
 
-		if (glyph.point_cnt() < 6) // Nothing to draw...
-			return;
-	}
+		const uint32_t band_curve_cnt = grid.band_offsets[band + 1] - grid.band_offsets[band];
 
-	const float glf_offset = (1.0F - glyph_scale) * 0.5F;
+		const uint32_t band_beg = band * SDF_BLOCK_SIZE > region.y_beg ? band * SDF_BLOCK_SIZE : region.y_beg;
 
-	const float img_step = 1.0F / fmaxf(static_cast<float>(pixel_width), static_cast<float>(pixel_height));
+		const uint32_t band_end = band * SDF_BLOCK_SIZE + SDF_BLOCK_SIZE < region.y_end ? band * SDF_BLOCK_SIZE + SDF_BLOCK_SIZE : region.y_end;
 
-	const float test = 1.0F * glyph_scale + glf_offset;
+		sdf_row_winding(curves, band_curve_indices, band_curve_cnt, img_step * static_cast<float>(band_beg), img_step, region.x_end, winding);
 
-	// Start looping over image
+		for (uint32_t bx = block_beg_x; bx != block_end_x; ++bx)
+			saturated_texels[bx] = winding[bx * SDF_BLOCK_SIZE] != 0 ? inside_texel : outside_texel;
 
-	for (uint32_t y = 0; y != pixel_height; ++y)
-		for (uint32_t x = 0; x != pixel_width; ++x)
+		for (uint32_t y = band_beg; y != band_end; ++y)
 		{
-			const och::vec2 p(img_step * static_cast<float>(x), img_step * static_cast<float>(y));
+			const uint32_t out_y = region.y_end - 1 - y;
+
+			const float py = img_step * static_cast<float>(y);
+
+			for (uint32_t i = 0; i != region.x_end * 3; ++i)
+				candidates[i].curve_idx = NO_CURVE;
+
+			for (uint32_t i = 0; i != band_curve_cnt; ++i)
+			{
+				const uint32_t curve_idx = band_curve_indices[i];
+
+				const sdf_curve_span& span = grid.spans[curve_idx];
+
+				if (y < span.y_beg || y >= span.y_end)
+					continue;
+
+				const uint8_t channels = curve_channels[curve_idx];
+
+				const uint32_t x_beg = span.x_beg > region.x_beg ? span.x_beg : region.x_beg;
+
+				const uint32_t x_end = span.x_beg + span.x_cnt;
+
+				for (uint32_t x = x_beg; x < x_end; ++x)
+				{
+					if (!band_active[x / SDF_BLOCK_SIZE])
+						continue;
+
+					const och::vec2 p(img_step * static_cast<float>(x), py);
+
+					const sdf_closest_point closest = sdf_curve_closest_point(curves, curve_idx, p);
+
+					for (uint32_t c = 0; c != 3; ++c)
+					{
+						if (!(channels & (1 << c)))
+							continue;
+
+						msdf_channel_candidate& cand = candidates[x * 3 + c];
 
-			float min_dst_sq = INFINITY;
+						bool is_closer = cand.curve_idx == NO_CURVE || closest.dst_sq < cand.closest.dst_sq;
 
-			float min_dst_sgn = -1.0F;
+						// Curves meeting at a corner are equally close to pixels beyond it. Their order must not decide which side the pixel is on.
+						if (!is_closer && closest.dst_sq <= cand.closest.dst_sq * (1.0F + 1e-5F))
+							is_closer = sdf_curve_orthogonality(curves, curve_idx, closest, p) > sdf_curve_orthogonality(curves, cand.curve_idx, cand.closest, p);
 
-			float min_dst_max_orthogonality = -INFINITY;
+						if (is_closer)
+							cand = { curve_idx, closest };
+					}
+				}
+			}
 
-			uint32_t min_curve = 0;
+			if (y != band_beg)
+				sdf_row_winding(curves, band_curve_indices, band_curve_cnt, py, img_step, region.x_end, winding);
 
-			for (uint32_t i = 0; i != glyph.contour_cnt(); ++i)
+			for (uint32_t x = region.x_beg; x != region.x_end; ++x)
 			{
-				const uint32_t beg = glyph.contour_beg_index(i), end = glyph.contour_end_index(i);
+				if (!band_active[x / SDF_BLOCK_SIZE])
+				{
+					img(x - region.x_beg, out_y) = saturated_texels[x / SDF_BLOCK_SIZE];
+
+					continue;
+				}
 
-				for (uint32_t j = beg; j + 2 < end; j += 2)
+				const och::vec2 p(img_step * static_cast<float>(x), py);
+
+				const bool is_inside = winding[x] != 0;
+
+				float dst[3];
+
+				float min_dst_sq = INFINITY;
+
+				for (uint32_t c = 0; c != 3; ++c)
 				{
-					const och::vec2 p0_u = glyph[j];
-					const och::vec2 p0{ p0_u.x * glyph_scale + glf_offset, p0_u.y * glyph_scale + glf_offset };
-					const och::vec2 p1_u = glyph[j + 1];
-					const och::vec2 p1{ p1_u.x * glyph_scale + glf_offset, p1_u.y * glyph_scale + glf_offset };
-					const och::vec2 p2_u = glyph[j + 2];
-					const och::vec2 p2{ p2_u.x * glyph_scale + glf_offset, p2_u.y * glyph_scale + glf_offset };
-
-					if (evaluate_curve_for_pixel(p0, p1, p2, p, min_dst_sq, min_dst_sgn, min_dst_max_orthogonality))
-						min_curve = j;
+					const msdf_channel_candidate& cand = candidates[x * 3 + c];
+
+					if (cand.curve_idx == NO_CURVE)
+					{
+						dst[c] = is_inside ? INFINITY : -INFINITY;
+
+						continue;
+					}
+
+					dst[c] = sdf_curve_pseudo_distance(curves, cand.curve_idx, cand.closest, p);
+
+					if (cand.closest.dst_sq < min_dst_sq)
+						min_dst_sq = cand.closest.dst_sq;
 				}
 
-				const och::vec2 p0_u = glyph[end - 2];
-				const och::vec2 p0{ p0_u.x * glyph_scale + glf_offset, p0_u.y * glyph_scale + glf_offset };
-				const och::vec2 p1_u = glyph[end - 1];
-				const och::vec2 p1{ p1_u.x * glyph_scale + glf_offset, p1_u.y * glyph_scale + glf_offset };
-				const och::vec2 p2_u = glyph[beg];
-				const och::vec2 p2{ p2_u.x * glyph_scale + glf_offset, p2_u.y * glyph_scale + glf_offset };
+				const float median = fmaxf(fminf(dst[0], dst[1]), fminf(fmaxf(dst[0], dst[1]), dst[2]));
 
-				if (evaluate_curve_for_pixel(p0, p1, p2, p, min_dst_sq, min_dst_sgn, min_dst_max_orthogonality))
-					min_curve = end - 2;
-			}
+				if ((median > 0.0F) != is_inside)
+				{
+					const float single_dst = is_inside ? sqrtf(min_dst_sq) : -sqrtf(min_dst_sq);
 
-			img(x, y) = mapper(sqrtf(min_dst_sq) * min_dst_sgn);
+					dst[0] = dst[1] = dst[2] = single_dst;
+				}
+
+				img(x - region.x_beg, out_y) = texel_r8g8b8(mapper(dst[0]), mapper(dst[1]), mapper(dst[2]));
+			}
 		}
+	}
 }
 
 template<ptrdiff_t offset, size_t bytes, bool reverse = false, typename T>
@@ -346,609 +614,1924 @@ struct mapper_range
 	int32_t offset;
 };
 
-struct glfatl_fileheader
+struct sdf_clamp_mapper
 {
-	uint32_t m_width;
-	uint32_t m_height;
-	float m_line_height;
-	uint32_t m_glyph_scale;
-	uint32_t m_map_ranges_size;
-	uint32_t m_map_indices_size;
+	const float clamp;
 
-	uint32_t map_ranges_bytes() const noexcept { return m_map_ranges_size * sizeof(mapper_range); }
+	uint8_t operator()(float dst) const noexcept
+	{
+		const float clamped = dst < -clamp ? -clamp : dst > clamp ? clamp : dst;
 
-	uint32_t map_indices_bytes() const noexcept { return m_map_indices_size * sizeof(glyph_atlas::glyph_index); }
+		return static_cast<uint8_t>((clamped + clamp) * (127.5F / clamp));
+	}
+};
 
-	uint32_t image_bytes() const noexcept { return m_width * m_height; }
+struct glyph_address
+{
+	uint32_t glyph_id;
 
-	mapper_range* map_ranges_data() noexcept
-	{
-		return reinterpret_cast<mapper_range*>(reinterpret_cast<uint8_t*>(this) + sizeof(*this));
-	}
+	// Index of glyph_id in glyph_atlas_source::ids
+	uint32_t source_idx;
 
-	const mapper_range* map_ranges_data() const noexcept
-	{
-		return reinterpret_cast<const mapper_range*>(reinterpret_cast<const uint8_t*>(this) + sizeof(*this));
-	}
+	// Size of the rendered part of the glyph's SDF cell, in pixels. w and h are adjacent so they can be sorted on together.
+	uint32_t w;
+	uint32_t h;
 
-	glyph_atlas::glyph_index* map_indices_data() noexcept
-	{
-		return reinterpret_cast<glyph_atlas::glyph_index*>(reinterpret_cast<uint8_t*>(this) + sizeof(*this) + map_ranges_bytes());
-	}
+	// Position in the atlas, not including padding
+	uint32_t x;
+	uint32_t y;
+	uint32_t page;
 
-	const glyph_atlas::glyph_index* map_indices_data() const noexcept
-	{
-		return reinterpret_cast<const glyph_atlas::glyph_index*>(reinterpret_cast<const uint8_t*>(this) + sizeof(*this) + map_ranges_bytes());
-	}
+	// Position of the rendered part within the glyph's SDF cell
+	uint32_t cell_x;
+	uint32_t cell_y;
 
-	uint8_t* image_data() noexcept
-	{
-		return reinterpret_cast<uint8_t*>(this) + sizeof(*this) + map_ranges_bytes() + map_indices_bytes();
-	}
+	// Glyph id of the glyph whose spot in the atlas this one uses, which is glyph_id itself unless the glyph is a duplicate
+	uint32_t representative_id;
 
-	const uint8_t* image_data() const noexcept
-	{
-		return reinterpret_cast<const uint8_t*>(this) + sizeof(*this) + map_ranges_bytes() + map_indices_bytes();
-	}
+	// Hash of everything the rendered SDF depends on. Glyphs with equal hashes are checked for equal content, and then share one spot in the atlas.
+	uint64_t content_hash;
 };
 
-// TODO: 
-// Calculate advance to save in m_map_indices
-// Implement mapping equivalent glyphs to a single spot in the image.
-och::status glyph_atlas::create(const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges) noexcept
+struct codept_id_pair
 {
-	struct glyph_address
-	{
-		uint32_t glyph_id;
-		uint32_t buffer_begin;
-		uint32_t w;
-		uint32_t h;
-		uint32_t x;
-		uint32_t y;
-	};
-
-	struct codept_id_pair
-	{
-		uint32_t codept;
-		uint32_t glyph_id;
-	};
+	uint32_t codept;
+	uint32_t glyph_id;
+};
 
-	// Open file
+// Position of a glyph's curves in the flattened outlines of glyph_atlas_source
+struct glyph_outline_ref
+{
+	uint32_t point_beg;
 
-	truetype_file file;
+	uint32_t curve_cnt;
 
-	{
-		check(file.create(truetype_filename));
+	uint32_t contour_beg;
 
-		m_line_height = file.line_height();
+	uint32_t contour_cnt;
 
-		m_glyph_scale = glyph_size;
-	}
+	// Unset for glyphs without anything to draw
+	bool has_outline;
+};
 
+// Font and glyphs an atlas is built from. glyph_atlas::create_multi_size shares one between all of its atlases.
+struct glyph_atlas_source
+{
+	truetype_file file;
 
-	// Count Codepoints to be mapped
+	// Requested codepoints in ascending order without duplicates, along with their glyph ids
+	heap_buffer<codept_id_pair> cp_ids;
 
-	uint32_t codept_cnt = 0;
+	// Distinct glyph ids of cp_ids in ascending order, including the missing-character glyph 0
+	heap_buffer<uint32_t> ids;
 
-	for (auto& r : codept_ranges)
-		codept_cnt += r.end - r.beg;
+	// Outline of each glyph in ids, see decode_glyph_outlines. Left empty by glyph_atlas::create, which decodes each glyph from file whenever it is needed instead.
+	heap_buffer<glyph_outline_ref> outlines;
 
-	// Create list of (unique) codepoints with their matching glyph ids.
+	simple_vec<och::vec2> outline_points{ 0 };
 
-	heap_buffer<codept_id_pair> cp_ids(codept_cnt);
+	simple_vec<uint32_t> outline_contour_ends{ 0 };
 
+	~glyph_atlas_source() noexcept
 	{
-		uint32_t curr_cp_id = 0;
-
-		for (const auto& r : codept_ranges)
-			for (uint32_t cp = r.beg; cp != r.end; ++cp)
-				cp_ids[curr_cp_id++].codept = cp;
+		file.close();
+	}
+};
 
-		sort<offsetof(codept_id_pair, codept), 3>(cp_ids);
+struct glyph_render_queue
+{
+	const glyph_atlas_source* source;
 
-		uint32_t prev_cp = ~cp_ids[0].codept;
+	glyph_address* glyphs;
 
-		uint32_t curr_idx = 0;
+	uint32_t glyph_cnt;
 
-		for (uint32_t i = 0; i != cp_ids.size(); ++i)
-			if (cp_ids[i].codept != prev_cp)
-			{
-				cp_ids[curr_idx++].codept = cp_ids[i].codept;
+	uint32_t padded_glyph_size;
 
-				prev_cp = cp_ids[i].codept;
-			}
+	float glyph_scale;
 
-		cp_ids.shrink(curr_idx);
+	sdf_clamp_mapper mapper;
 
-		for (auto& cp_id : cp_ids)
-			cp_id.glyph_id = file.get_glyph_id_from_codept(cp_id.codept);
-	}
+	sdf_row_kernel_fn kernel;
 
-	// Create list of (unique) glyph ids
+	bool skip_saturated_blocks;
 
-	heap_buffer<uint32_t> ids(cp_ids.size() + 1);
+	bool is_multi_channel;
 
-	{
-		for (uint32_t i = 0; i != cp_ids.size(); ++i)
-			ids[i] = cp_ids[i].glyph_id;
+	// Holds texel_r8g8b8 instead of single bytes if is_multi_channel is set
+	uint8_t* image;
 
-		ids[cp_ids.size()] = 0;
+	uint32_t image_width;
 
-		sort<0, 4>(ids);
+	uint32_t image_page_height;
 
-		uint32_t curr_idx = 0;
+	uint32_t glyph_padding_pixels;
 
-		uint32_t prev_id = ~ids[0];
+	std::atomic<uint32_t> next_idx;
+};
 
-		for (auto id : ids)
-		{
-			if (id != prev_id)
-			{
-				ids[curr_idx++] = id;
+// Hashes the outline in curves along with the part of the cell it is rendered into.
+// The SDF is a deterministic function of these, so glyphs with equal hashes are candidates for sharing an SDF, confirmed by sdf_content_equal.
+static uint64_t sdf_content_hash(const sdf_curve_table& curves, sdf_pixel_rect bounds) noexcept
+{
+	uint64_t hash = 14695981039346656037ull;
 
-				prev_id = id;
-			}
-		}
+	const auto mix = [&hash](uint32_t v) noexcept { hash = (hash ^ v) * 1099511628211ull; };
 
-		ids.shrink(curr_idx);
-	}
+	mix(bounds.x_beg);
+	mix(bounds.y_beg);
+	mix(bounds.x_end);
+	mix(bounds.y_end);
+	mix(curves.curve_cnt);
 
-	// Draw glyphs into buffer and record their true sizes
+	// The remaining arrays of the table are derived from the control points
+	const float* const point_arrays[6]{ curves.p0_x, curves.p0_y, curves.p1_x, curves.p1_y, curves.p2_x, curves.p2_y };
 
-	const uint32_t padded_glyph_size = static_cast<uint32_t>(static_cast<float>(glyph_size) * (1.0F + 2.0F * sdf_clamp) + 2.0F);
+	for (const float* arr : point_arrays)
+		for (uint32_t i = 0; i != curves.curve_cnt; ++i)
+		{
+			uint32_t bits;
 
-	const float glyph_scale = static_cast<float>(glyph_size) / static_cast<float>(padded_glyph_size);
+			memcpy(&bits, arr + i, sizeof(bits));
 
+			mix(bits);
+		}
 
-	heap_buffer<uint8_t> sdf_buffer(ids.size() * padded_glyph_size * padded_glyph_size);
+	return hash;
+}
 
-	heap_buffer<glyph_address> addresses(ids.size());
+// Fills curves with the outline of the queued glyph a, scaled into its SDF cell. Returns false if the glyph has nothing to draw.
+// scratch is only used if the outline has to be decoded from the font.
+static bool build_queued_curve_table(const glyph_render_queue& queue, const glyph_address& a, sdf_curve_table& curves, glyph_scratch_arena& scratch) noexcept
+{
+	const glyph_atlas_source& source = *queue.source;
 
+	if (source.outlines.size() != 0)
 	{
-		uint32_t curr_beg = 0;
+		const glyph_outline_ref& ref = source.outlines[a.source_idx];
 
-		uint32_t curr_idx = 0;
+		if (!ref.has_outline)
+			return false;
 
-		for (auto& id : ids)
-		{
-			glyph_data glyph = file.get_glyph_data_from_id(id);
+		const sdf_outline outline{ source.outline_points.data() + ref.point_beg, ref.curve_cnt, source.outline_contour_ends.data() + ref.contour_beg, ref.contour_cnt };
 
-			if (!glyph.metrics().x_size())
-				continue;
+		sdf_build_curve_table(outline, queue.glyph_scale, curves);
 
-			image_view buffer_view(sdf_buffer.data() + curr_beg, padded_glyph_size, 0, 0);
+		return true;
+	}
 
-			struct {
-				const float clamp;
+	glyph_data glyph = source.file.get_glyph_data_from_id(a.glyph_id, scratch);
 
-				uint8_t operator()(float dst) const noexcept
-				{
-					const float clamped = dst < -clamp ? -clamp : dst > clamp ? clamp : dst;
+	if (!glyph.metrics().x_size() || glyph.point_cnt() < 6) // Nothing to draw...
+		return false;
 
-					return static_cast<uint8_t>((clamped + clamp) * (127.5F / clamp));
-				}
-			} mapper{ sdf_clamp };
+	sdf_build_curve_table(glyph, queue.glyph_scale, curves);
 
-			sdf_from_glyph(buffer_view, glyph, padded_glyph_size, padded_glyph_size, glyph_scale, mapper);
+	return true;
+}
 
-			uint32_t min_x = ~0u, max_x = 0, min_y = ~0u, max_y = 0;
+// Whether the queued glyphs a and b render to the same SDF, comparing everything sdf_content_hash covers.
+// Used on glyphs with equal hashes, so a 64-bit collision cannot map a codepoint to another glyph's SDF.
+static bool sdf_content_equal(const glyph_render_queue& queue, const glyph_address& a, const glyph_address& b, sdf_curve_table& curves_a, sdf_curve_table& curves_b, glyph_scratch_arena& scratch) noexcept
+{
+	if (a.cell_x != b.cell_x || a.cell_y != b.cell_y || a.w != b.w || a.h != b.h)
+		return false;
 
-			for (uint32_t y = 0; y != padded_glyph_size; ++y)
-				for (uint32_t x = 0; x != padded_glyph_size; ++x)
-					if (buffer_view(x, y))
-					{
-						if (x < min_x)
-							min_x = x;
-						if (x > max_x)
-							max_x = x;
-						if (y < min_y)
-							min_y = y;
-						if (y > max_y)
-							max_y = y;
-					}
+	// Only measured glyphs with an outline get here, so both tables are always built
+	build_queued_curve_table(queue, a, curves_a, scratch);
 
-			if (min_x != ~0u)
-			{
-				uint32_t w = max_x - min_x + 1;
+	build_queued_curve_table(queue, b, curves_b, scratch);
 
-				uint32_t h = max_y - min_y + 1;
+	if (curves_a.curve_cnt != curves_b.curve_cnt)
+		return false;
 
-				addresses[curr_idx].glyph_id = id;
-				addresses[curr_idx].buffer_begin = curr_beg + min_x + min_y * padded_glyph_size;
-				addresses[curr_idx].w = w;
-				addresses[curr_idx].h = h;
-				++curr_idx;
+	const float* const arrays_a[6]{ curves_a.p0_x, curves_a.p0_y, curves_a.p1_x, curves_a.p1_y, curves_a.p2_x, curves_a.p2_y };
 
-				curr_beg += padded_glyph_size * padded_glyph_size;
-			}
+	const float* const arrays_b[6]{ curves_b.p0_x, curves_b.p0_y, curves_b.p1_x, curves_b.p1_y, curves_b.p2_x, curves_b.p2_y };
+
+	for (uint32_t i = 0; i != 6; ++i)
+		if (memcmp(arrays_a[i], arrays_b[i], curves_a.curve_cnt * sizeof(float)) != 0)
+			return false;
+
+	return true;
+}
+
+// Finds the part of each queued glyph's SDF cell that is not saturated to the outside value, and stores it in the glyph's cell_x, cell_y, w and h, along with its content_hash.
+// Glyphs without an outline get a width of 0.
+static void measure_queued_glyphs(glyph_render_queue& queue) noexcept
+{
+	// Reused for all glyphs measured by this thread
+	sdf_curve_table curves;
+
+	glyph_scratch_arena scratch;
+
+	for (uint32_t i = queue.next_idx.fetch_add(1, std::memory_order::relaxed); i < queue.glyph_cnt; i = queue.next_idx.fetch_add(1, std::memory_order::relaxed))
+	{
+		glyph_address& a = queue.glyphs[i];
+
+		a.w = 0;
+
+		if (!build_queued_curve_table(queue, a, curves, scratch))
+			continue;
+
+		const sdf_pixel_rect bounds = sdf_glyph_bounds(curves, queue.padded_glyph_size, queue.padded_glyph_size, queue.mapper.clamp);
+
+		a.cell_x = bounds.x_beg;
+		a.cell_y = bounds.y_beg;
+		a.w = bounds.x_end - bounds.x_beg;
+		a.h = bounds.y_end - bounds.y_beg;
+
+		a.content_hash = sdf_content_hash(curves, bounds);
+	}
+}
+
+// Renders the measured part of each queued glyph's SDF directly into its place in the atlas image.
+// Glyphs occupy disjoint rectangles of the image, so they can be rendered by any number of threads at once.
+static void render_queued_glyphs(glyph_render_queue& queue) noexcept
+{
+	// Reused for all glyphs rendered by this thread
+	sdf_curve_table curves;
+
+	glyph_scratch_arena scratch;
+
+	sdf_render_scratch render_scratch;
+
+	heap_buffer<uint8_t> curve_channels;
+
+	for (uint32_t i = queue.next_idx.fetch_add(1, std::memory_order::relaxed); i < queue.glyph_cnt; i = queue.next_idx.fetch_add(1, std::memory_order::relaxed))
+	{
+		const glyph_address& a = queue.glyphs[i];
+
+		build_queued_curve_table(queue, a, curves, scratch);
+
+		// Pages are stored one after the other, so they form a single image of stacked pages
+		const uint32_t target_x = a.x + queue.glyph_padding_pixels;
+
+		const uint32_t target_y = a.page * queue.image_page_height + a.y + queue.glyph_padding_pixels;
+
+		const sdf_pixel_rect region{ a.cell_x, a.cell_y, a.cell_x + a.w, a.cell_y + a.h };
+
+		if (queue.is_multi_channel)
+		{
+			if (curve_channels.size() < curves.curve_cnt)
+				curve_channels.allocate(curves.curve_cnt);
+
+			sdf_color_edges(curves, curve_channels.data());
+
+			image_view target(reinterpret_cast<texel_r8g8b8*>(queue.image), queue.image_width, target_x, target_y);
+
+			msdf_from_glyph(target, curves, curve_channels.data(), queue.padded_glyph_size, queue.padded_glyph_size, region, queue.mapper, queue.mapper.clamp, queue.skip_saturated_blocks, render_scratch);
+		}
+		else
+		{
+			image_view target(queue.image, queue.image_width, target_x, target_y);
+
+			sdf_from_glyph(target, curves, queue.padded_glyph_size, queue.padded_glyph_size, region, queue.mapper, queue.mapper.clamp, queue.kernel, queue.skip_saturated_blocks, render_scratch);
+		}
+	}
+}
+
+// Renders all queued glyphs with renderer instead of render_queued_glyphs. Only supports single-channel atlases.
+// The outlines of all glyphs are flattened into one list of curves, and the measured part of each glyph's SDF cell is split into tiles referring to its curves.
+static och::status render_queued_glyphs_gpu(const glyph_render_queue& queue, sdf_gpu_renderer& renderer, uint32_t image_height) noexcept
+{
+	sdf_curve_table curves;
+
+	glyph_scratch_arena scratch;
+
+	simple_vec<sdf_gpu_curve> gpu_curves{ 0 };
+
+	simple_vec<sdf_gpu_tile> tiles{ 0 };
+
+	for (uint32_t i = 0; i != queue.glyph_cnt; ++i)
+	{
+		const glyph_address& a = queue.glyphs[i];
+
+		build_queued_curve_table(queue, a, curves, scratch);
+
+		const uint32_t curve_beg = gpu_curves.size();
+
+		for (uint32_t j = 0; j != curves.curve_cnt; ++j)
+			gpu_curves.add({ curves.p0_x[j], curves.p0_y[j], curves.p1_x[j], curves.p1_y[j], curves.p2_x[j], curves.p2_y[j] });
+
+		// Same placement as render_queued_glyphs, with rows stored bottom to top
+
+		const int32_t dst_x = static_cast<int32_t>(a.x + queue.glyph_padding_pixels) - static_cast<int32_t>(a.cell_x);
+
+		const int32_t dst_y = static_cast<int32_t>(a.page * queue.image_page_height + a.y + queue.glyph_padding_pixels + a.cell_y + a.h - 1);
+
+		for (uint32_t y = a.cell_y; y < a.cell_y + a.h; y += sdf_gpu_renderer::TILE_SIZE)
+			for (uint32_t x = a.cell_x; x < a.cell_x + a.w; x += sdf_gpu_renderer::TILE_SIZE)
+				tiles.add({ curve_beg, curves.curve_cnt, x, y, a.cell_x + a.w, a.cell_y + a.h, dst_x, dst_y });
+	}
+
+	const float img_step = 1.0F / static_cast<float>(queue.padded_glyph_size);
+
+	check(renderer.render(gpu_curves.begin(), gpu_curves.size(), tiles.begin(), tiles.size(), img_step, queue.mapper.clamp, queue.image, queue.image_width, image_height));
+
+	return {};
+}
+
+template<void (*Fn)(glyph_render_queue&) noexcept>
+static DWORD glyph_queue_thread_fn(void* data)
+{
+	Fn(*static_cast<glyph_render_queue*>(data));
+
+	return 0;
+}
+
+// Works through the whole queue with Fn on thread_cnt threads.
+// The calling thread works through the queue as well, so only thread_cnt - 1 additional threads are needed.
+// If thread creation fails, the remaining threads simply take on more glyphs.
+template<void (*Fn)(glyph_render_queue&) noexcept>
+static void run_glyph_queue(glyph_render_queue& queue, uint32_t thread_cnt) noexcept
+{
+	queue.next_idx.store(0, std::memory_order::relaxed);
+
+	if (thread_cnt > queue.glyph_cnt)
+		thread_cnt = queue.glyph_cnt;
+
+	heap_buffer<HANDLE> threads(thread_cnt > 1 ? thread_cnt - 1 : 0);
+
+	uint32_t created_thread_cnt = 0;
+
+	for (; created_thread_cnt != threads.size(); ++created_thread_cnt)
+	{
+		DWORD thread_id;
+
+		if (!(threads[created_thread_cnt] = CreateThread(nullptr, 4096 * 16, glyph_queue_thread_fn<Fn>, &queue, 0, &thread_id)))
+			break;
+	}
+
+	Fn(queue);
+
+	for (uint32_t i = 0; i != created_thread_cnt; ++i)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+
+		CloseHandle(threads[i]);
+	}
+}
+
+static uint32_t mip_extent(uint32_t extent, uint32_t level) noexcept
+{
+	return extent >> level > 1 ? extent >> level : 1;
+}
+
+// Size of mip levels [0, level_cnt) of all pages together
+static uint32_t mip_chain_bytes(uint32_t width, uint32_t height, uint32_t page_cnt, uint32_t channel_cnt, uint32_t level_cnt) noexcept
+{
+	uint32_t bytes = 0;
+
+	for (uint32_t level = 0; level != level_cnt; ++level)
+		bytes += mip_extent(width, level) * mip_extent(height, level) * page_cnt * channel_cnt;
+
+	return bytes;
+}
+
+static uint32_t bc4_mip_chain_bytes(uint32_t width, uint32_t height, uint32_t page_cnt, uint32_t level_cnt) noexcept
+{
+	uint32_t bytes = 0;
+
+	for (uint32_t level = 0; level != level_cnt; ++level)
+		bytes += bc4_encoded_bytes(mip_extent(width, level), mip_extent(height, level)) * page_cnt;
+
+	return bytes;
+}
+
+// Halves a page of an SDF atlas. Each pixel averages the 2x2 pixels it covers, or 3 pixels along an odd edge, so no source pixel is left out.
+// Distances change linearly away from the outline, so the average stays close to the distance at the pixel's center.
+static void downsample_sdf_page(const uint8_t* src, uint32_t src_width, uint32_t src_height, uint32_t channel_cnt, uint8_t* dst) noexcept
+{
+	const uint32_t dst_width = mip_extent(src_width, 1);
+
+	const uint32_t dst_height = mip_extent(src_height, 1);
+
+	for (uint32_t y = 0; y != dst_height; ++y)
+	{
+		const uint32_t y_beg = y * 2;
+
+		const uint32_t y_end = y == dst_height - 1 ? src_height : y_beg + 2;
+
+		for (uint32_t x = 0; x != dst_width; ++x)
+		{
+			const uint32_t x_beg = x * 2;
+
+			const uint32_t x_end = x == dst_width - 1 ? src_width : x_beg + 2;
+
+			const uint32_t cnt = (x_end - x_beg) * (y_end - y_beg);
+
+			for (uint32_t c = 0; c != channel_cnt; ++c)
+			{
+				uint32_t sum = 0;
+
+				for (uint32_t sy = y_beg; sy != y_end; ++sy)
+					for (uint32_t sx = x_beg; sx != x_end; ++sx)
+						sum += src[(sy * src_width + sx) * channel_cnt + c];
+
+				dst[(y * dst_width + x) * channel_cnt + c] = static_cast<uint8_t>((sum + cnt / 2) / cnt);
+			}
+		}
+	}
+}
+
+// Layout of glfatl files: The header, followed by the mapper ranges, the mapper indices, the image with all its mip levels and optionally its BC4 encoding, each starting at a multiple of
+// ALIGNMENT bytes. This way the sections can be used in place when the file is mapped, and the image can be copied with aligned loads.
+struct glfatl_fileheader
+{
+	static constexpr uint32_t MAGIC = 0x41464C47u; // "GLFA"
+
+	static constexpr uint32_t VERSION = 5;
+
+	static constexpr uint32_t ALIGNMENT = 64;
+
+	uint32_t m_magic;
+	uint32_t m_version;
+	uint64_t m_source_hash;
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_page_cnt;
+	float m_line_height;
+	uint32_t m_glyph_scale;
+	uint32_t m_map_ranges_size;
+	uint32_t m_map_indices_size;
+	uint32_t m_map_ranges_offset;
+	uint32_t m_map_indices_offset;
+	uint32_t m_image_offset;
+	uint32_t m_file_bytes;
+	uint32_t m_bc4_offset; // 0 if the file holds no BC4 encoding
+	uint32_t m_channel_cnt;
+	uint32_t m_mip_level_cnt;
+	uint32_t m_reserved[14];
+
+	uint32_t map_ranges_bytes() const noexcept { return m_map_ranges_size * sizeof(mapper_range); }
+
+	uint32_t map_indices_bytes() const noexcept { return m_map_indices_size * sizeof(glyph_atlas::glyph_index); }
+
+	uint32_t image_bytes() const noexcept { return mip_chain_bytes(m_width, m_height, m_page_cnt, m_channel_cnt, m_mip_level_cnt); }
+
+	uint32_t bc4_bytes() const noexcept { return bc4_mip_chain_bytes(m_width, m_height, m_page_cnt, m_mip_level_cnt); }
+
+	// Fills in the section offsets and total size from the sizes of the sections
+	void compute_layout(bool has_bc4) noexcept
+	{
+		m_map_ranges_offset = align_offset(sizeof(*this));
+
+		m_map_indices_offset = align_offset(m_map_ranges_offset + map_ranges_bytes());
+
+		m_image_offset = align_offset(m_map_indices_offset + map_indices_bytes());
+
+		m_file_bytes = m_image_offset + image_bytes();
+
+		m_bc4_offset = 0;
+
+		if (has_bc4)
+		{
+			m_bc4_offset = align_offset(m_file_bytes);
+
+			m_file_bytes = m_bc4_offset + bc4_bytes();
+		}
+	}
+
+	bool is_valid() const noexcept
+	{
+		if (m_magic != MAGIC || m_version != VERSION)
+			return false;
+
+		if (m_channel_cnt != 1 && (m_channel_cnt != 3 || m_bc4_offset != 0))
+			return false;
+
+		if (m_mip_level_cnt == 0 || m_mip_level_cnt > glyph_atlas::MAX_MIP_LEVEL_CNT)
+			return false;
+
+		glfatl_fileheader expected = *this;
+
+		expected.compute_layout(m_bc4_offset != 0);
+
+		return m_map_ranges_offset == expected.m_map_ranges_offset && m_map_indices_offset == expected.m_map_indices_offset && m_image_offset == expected.m_image_offset && m_bc4_offset == expected.m_bc4_offset && m_file_bytes == expected.m_file_bytes;
+	}
+
+	template<typename T>
+	T* section(uint32_t offset) noexcept
+	{
+		return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(this) + offset);
+	}
+
+	template<typename T>
+	const T* section(uint32_t offset) const noexcept
+	{
+		return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(this) + offset);
+	}
+
+	static uint32_t align_offset(uint32_t offset) noexcept
+	{
+		return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+};
+
+static_assert(sizeof(glfatl_fileheader) % glfatl_fileheader::ALIGNMENT == 0);
+
+// Combines the font file's content hash with every argument of glyph_atlas::create that changes the resulting atlas.
+// Thread count, kernel ISA and skipping of saturated blocks are left out, as they only affect how fast the atlas is built.
+static uint64_t glfatl_source_hash(const truetype_file& file, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<glyph_atlas::codept_range> codept_ranges, const glyph_atlas_build_options& options) noexcept
+{
+	uint64_t hash = file.content_hash();
+
+	const auto mix = [&hash](uint32_t v) noexcept { hash = (hash ^ v) * 1099511628211ull; };
+
+	uint32_t clamp_bits;
+
+	memcpy(&clamp_bits, &sdf_clamp, sizeof(clamp_bits));
+
+	mix(glyph_size);
+	mix(glyph_padding_pixels);
+	mix(clamp_bits);
+	mix(map_width);
+	mix(static_cast<uint32_t>(options.solver));
+	mix(static_cast<uint32_t>(options.packer));
+	mix(options.page_height);
+	mix(options.bc4_compress);
+	mix(static_cast<uint32_t>(options.sdf_mode));
+	mix(options.mip_level_cnt);
+
+	mix(static_cast<uint32_t>(codept_ranges.len()));
+
+	for (const glyph_atlas::codept_range& r : codept_ranges)
+	{
+		mix(r.beg);
+		mix(r.end);
+	}
+
+	return hash;
+}
+
+// Times consecutive stages of building an atlas. Each stage is measured from the end of the previous one, so the stages add up to the total.
+struct build_stage_timer
+{
+	och::timer timer;
+
+	int64_t stage_beg_us = 0;
+
+	void end_stage(int64_t& out_us) noexcept
+	{
+		const int64_t now_us = timer.read().microseconds();
+
+		out_us = now_us - stage_beg_us;
+
+		stage_beg_us = now_us;
+	}
+};
+
+// Adds up the buffers allocated while building an atlas, keeping track of the highest total
+struct build_alloc_tracker
+{
+	glyph_atlas_build_stats& stats;
+
+	uint64_t live_bytes = 0;
+
+	void add_bytes(uint64_t bytes) noexcept
+	{
+		live_bytes += bytes;
+
+		if (live_bytes > stats.peak_alloc_bytes)
+			stats.peak_alloc_bytes = live_bytes;
+	}
+
+	template<typename T>
+	void add(const heap_buffer<T>& buffer) noexcept
+	{
+		add_bytes(static_cast<uint64_t>(buffer.size()) * sizeof(T));
+	}
+
+	template<typename T>
+	void add(const simple_vec<T>& vec) noexcept
+	{
+		add_bytes(static_cast<uint64_t>(vec.capacity()) * sizeof(T));
+	}
+
+	template<typename T>
+	void remove(const heap_buffer<T>& buffer) noexcept
+	{
+		live_bytes -= static_cast<uint64_t>(buffer.size()) * sizeof(T);
+	}
+};
+
+// Opens the font and maps the requested codepoints to the glyphs they need
+static och::status open_glyph_atlas_source(const char* truetype_filename, const och::range<glyph_atlas::codept_range> codept_ranges, glyph_atlas_source& out, build_stage_timer& timer, glyph_atlas_build_stats& stats) noexcept
+{
+	check(out.file.create(truetype_filename));
+
+	timer.end_stage(stats.open_us);
+
+	// Count Codepoints to be mapped
+
+	uint32_t codept_cnt = 0;
+
+	for (auto& r : codept_ranges)
+		codept_cnt += r.end - r.beg;
+
+	// Create list of (unique) codepoints with their matching glyph ids.
+
+	heap_buffer<codept_id_pair>& cp_ids = out.cp_ids;
+
+	cp_ids.allocate(codept_cnt);
+
+	{
+		uint32_t curr_cp_id = 0;
+
+		for (const auto& r : codept_ranges)
+			for (uint32_t cp = r.beg; cp != r.end; ++cp)
+				cp_ids[curr_cp_id++].codept = cp;
+
+		sort<offsetof(codept_id_pair, codept), 3>(cp_ids);
+
+		uint32_t prev_cp = ~cp_ids[0].codept;
+
+		uint32_t curr_idx = 0;
+
+		for (uint32_t i = 0; i != cp_ids.size(); ++i)
+			if (cp_ids[i].codept != prev_cp)
+			{
+				cp_ids[curr_idx++].codept = cp_ids[i].codept;
+
+				prev_cp = cp_ids[i].codept;
+			}
+
+		cp_ids.shrink(curr_idx);
+
+		timer.end_stage(stats.codept_sort_us);
+
+		for (auto& cp_id : cp_ids)
+			cp_id.glyph_id = out.file.get_glyph_id_from_codept(cp_id.codept);
+	}
+
+	timer.end_stage(stats.cmap_us);
+
+	// Create list of (unique) glyph ids
+
+	heap_buffer<uint32_t>& ids = out.ids;
+
+	ids.allocate(cp_ids.size() + 1);
+
+	{
+		for (uint32_t i = 0; i != cp_ids.size(); ++i)
+			ids[i] = cp_ids[i].glyph_id;
+
+		ids[cp_ids.size()] = 0;
+
+		sort<0, 4>(ids);
+
+		uint32_t curr_idx = 0;
+
+		uint32_t prev_id = ~ids[0];
+
+		for (auto id : ids)
+		{
+			if (id != prev_id)
+			{
+				ids[curr_idx++] = id;
+
+				prev_id = id;
+			}
+		}
+
+		ids.shrink(curr_idx);
+	}
+
+	timer.end_stage(stats.glyph_id_sort_us);
+
+	return {};
+}
+
+// Decodes the outline of every glyph in source.ids once and stores its curves in source, so atlases of several sizes can be built without decoding them again
+static void decode_glyph_outlines(glyph_atlas_source& source) noexcept
+{
+	outline_batch batch;
+
+	source.file.decode_glyphs(source.ids.data(), source.ids.size(), batch);
+
+	source.outlines.allocate(batch.glyph_cnt());
+
+	for (uint32_t i = 0; i != batch.glyph_cnt(); ++i)
+	{
+		glyph_outline_ref& ref = source.outlines[i];
+
+		glyph_data glyph = batch.glyph(i);
+
+		// Same condition as in build_queued_curve_table
+		ref.has_outline = glyph.metrics().x_size() && glyph.point_cnt() >= 6;
+
+		ref.point_beg = source.outline_points.size();
+
+		ref.contour_beg = source.outline_contour_ends.size();
+
+		ref.curve_cnt = ref.has_outline ? sdf_flatten_outline(glyph, source.outline_points, source.outline_contour_ends) : 0;
+
+		ref.contour_cnt = source.outline_contour_ends.size() - ref.contour_beg;
+	}
+}
+
+// TODO: 
+// Calculate advance to save in m_map_indices
+och::status glyph_atlas::create(const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges, const glyph_atlas_build_options& options) noexcept
+{
+	// Release a previously created or loaded atlas
+
+	destroy();
+
+	build_stage_timer timer;
+
+	glyph_atlas_build_stats stats{};
+
+	glyph_atlas_source source;
+
+	check(open_glyph_atlas_source(truetype_filename, codept_ranges, source, timer, stats));
+
+	stats.total_us = timer.stage_beg_us;
+
+	check(create_from_source(source, glyph_size, glyph_padding_pixels, sdf_clamp, map_width, codept_ranges, options, stats));
+
+	if (options.stats != nullptr)
+		*options.stats = stats;
+
+	return {};
+}
+
+och::status glyph_atlas::create_multi_size(const char* truetype_filename, const och::range<size_params> sizes, uint32_t map_width, const och::range<codept_range> codept_ranges, glyph_atlas* out_atlases, const glyph_atlas_build_options& options) noexcept
+{
+	for (uint32_t i = 0; i != sizes.len(); ++i)
+		out_atlases[i].destroy();
+
+	build_stage_timer timer;
+
+	glyph_atlas_build_stats shared_stats{};
+
+	glyph_atlas_source source;
+
+	check(open_glyph_atlas_source(truetype_filename, codept_ranges, source, timer, shared_stats));
+
+	decode_glyph_outlines(source);
+
+	timer.end_stage(shared_stats.decode_us);
+
+	shared_stats.total_us = timer.stage_beg_us;
+
+	for (uint32_t i = 0; i != sizes.len(); ++i)
+	{
+		const size_params& size = sizes.beg[i];
+
+		glyph_atlas_build_stats stats = i == 0 ? shared_stats : glyph_atlas_build_stats{};
+
+		och::status err = out_atlases[i].create_from_source(source, size.glyph_size, size.glyph_padding_pixels, size.sdf_clamp, map_width, codept_ranges, options, stats);
+
+		if (err)
+		{
+			for (uint32_t j = 0; j <= i; ++j)
+				out_atlases[j].destroy();
+
+			return err;
+		}
+
+		if (options.stats != nullptr)
+			options.stats[i] = stats;
+	}
+
+	return {};
+}
+
+och::status glyph_atlas::create_from_source(const glyph_atlas_source& source, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges, const glyph_atlas_build_options& options, glyph_atlas_build_stats& stats) noexcept
+{
+	build_stage_timer timer;
+
+	if (options.sdf_mode == glyph_sdf_mode::multi_channel && options.bc4_compress)
+		return TEMP_STATUS_MACRO; // BC4 only holds a single channel
+
+	m_channel_cnt = options.sdf_mode == glyph_sdf_mode::multi_channel ? 3 : 1;
+
+	// Level i keeps glyph_padding_pixels >> i pixels of padding, which must not drop below one
+
+	m_mip_level_cnt = 1;
+
+	while (m_mip_level_cnt != MAX_MIP_LEVEL_CNT && glyph_padding_pixels >> m_mip_level_cnt != 0 && (options.mip_level_cnt == 0 || m_mip_level_cnt < options.mip_level_cnt))
+		++m_mip_level_cnt;
+
+	const truetype_file& file = source.file;
+
+	const heap_buffer<codept_id_pair>& cp_ids = source.cp_ids;
+
+	const heap_buffer<uint32_t>& ids = source.ids;
+
+	m_source_hash = glfatl_source_hash(file, glyph_size, glyph_padding_pixels, sdf_clamp, map_width, codept_ranges, options);
+
+	m_line_height = file.line_height();
+
+	m_glyph_scale = glyph_size;
+
+	// Find the part of each glyph's SDF that is not saturated to the outside value.
+	// This only needs the outline, so the glyphs can be packed before any of them is rendered and then drawn directly into the atlas.
+
+	const uint32_t padded_glyph_size = static_cast<uint32_t>(static_cast<float>(glyph_size) * (1.0F + 2.0F * sdf_clamp) + 2.0F);
+
+	const float glyph_scale = static_cast<float>(glyph_size) / static_cast<float>(padded_glyph_size);
+
+	uint32_t thread_cnt = options.worker_thread_cnt;
+
+	if (!thread_cnt)
+	{
+		SYSTEM_INFO sys_info;
+
+		GetSystemInfo(&sys_info);
+
+		thread_cnt = sys_info.dwNumberOfProcessors;
+	}
+
+	// The source's buffers stay allocated for the whole build
+
+	build_alloc_tracker allocs{ stats };
+
+	allocs.add(cp_ids);
+
+	allocs.add(ids);
+
+	allocs.add(source.outlines);
+
+	allocs.add(source.outline_points);
+
+	allocs.add(source.outline_contour_ends);
+
+	heap_buffer<glyph_address> addresses(ids.size());
+
+	allocs.add(addresses);
+
+	const sdf_row_kernel_fn kernel = sdf_row_kernel(sdf_supported_kernel_isa(options.max_kernel_isa), options.solver);
+
+	glyph_render_queue queue{ &source, addresses.data(), addresses.size(), padded_glyph_size, glyph_scale, { sdf_clamp }, kernel, options.skip_saturated_blocks, m_channel_cnt == 3, nullptr, 0, 0, glyph_padding_pixels, 0 };
+
+	{
+		for (uint32_t i = 0; i != ids.size(); ++i)
+		{
+			addresses[i].glyph_id = ids[i];
+
+			addresses[i].source_idx = i;
+		}
+
+		run_glyph_queue<measure_queued_glyphs>(queue, thread_cnt);
+
+		uint32_t curr_idx = 0;
+
+		for (uint32_t i = 0; i != addresses.size(); ++i)
+			if (addresses[i].w)
+				addresses[curr_idx++] = addresses[i];
+
+		addresses.shrink(curr_idx);
+	}
+
+	timer.end_stage(stats.measure_us);
+
+	// Glyphs with identical SDFs, such as those of different glyph ids sharing one outline, are only packed and rendered once.
+	// The sort is stable, so the glyph with the lowest id of each group is kept.
+
+	heap_buffer<glyph_address> unique_addresses(addresses.size());
+
+	allocs.add(unique_addresses);
+
+	{
+		sort<offsetof(glyph_address, content_hash), 8>(addresses);
+
+		sdf_curve_table curves_a;
+
+		sdf_curve_table curves_b;
+
+		glyph_scratch_arena scratch;
+
+		uint32_t curr_idx = 0;
+
+		// First glyph in unique_addresses with the current hash
+		uint32_t hash_group_beg = 0;
+
+		for (uint32_t i = 0; i != addresses.size(); ++i)
+		{
+			glyph_address& a = addresses[i];
+
+			if (i == 0 || a.content_hash != addresses[i - 1].content_hash)
+				hash_group_beg = curr_idx;
+
+			a.representative_id = a.glyph_id;
+
+			// Glyphs whose hashes collide without their content matching are all kept
+			for (uint32_t j = hash_group_beg; j != curr_idx; ++j)
+				if (sdf_content_equal(queue, unique_addresses[j], a, curves_a, curves_b, scratch))
+				{
+					a.representative_id = unique_addresses[j].glyph_id;
+
+					break;
+				}
+
+			if (a.representative_id == a.glyph_id)
+				unique_addresses[curr_idx++] = a;
+		}
+
+		unique_addresses.shrink(curr_idx);
+
+		// Restore glyph id order, so the packing does not depend on the hashes
+		sort<offsetof(glyph_address, glyph_id), 4>(unique_addresses);
+	}
+
+	timer.end_stage(stats.dedupe_us);
+
+	// Find an arrangement for the glyphs and allocate final image accordingly
+	{
+		sort<offsetof(glyph_address, w), 8, true>(unique_addresses);
+
+		heap_buffer<glyph_pack_rect> rects(unique_addresses.size());
+
+		for (uint32_t i = 0; i != unique_addresses.size(); ++i)
+			rects[i] = { unique_addresses[i].w, unique_addresses[i].h, 0, 0 };
+
+		heap_buffer<uint32_t> pages(unique_addresses.size());
+
+		allocs.add(rects);
+
+		allocs.add(pages);
+
+		uint32_t packed_height;
+
+		if (options.page_height == 0)
+		{
+			if (!pack_glyph_rects(options.packer, rects.data(), rects.size(), map_width, glyph_padding_pixels, packed_height))
+				return TEMP_STATUS_MACRO; // Glyph too large for given map_width parameter
+
+			for (uint32_t& page : pages)
+				page = 0;
+
+			m_page_cnt = 1;
+		}
+		else
+		{
+			if (!pack_glyph_rects_paged(options.packer, rects.data(), pages.data(), rects.size(), map_width, options.page_height, glyph_padding_pixels, m_page_cnt))
+				return TEMP_STATUS_MACRO; // Glyph too large for given map_width and page_height
+
+			packed_height = options.page_height;
+		}
+
+		uint64_t used_area = 0;
+
+		for (uint32_t i = 0; i != unique_addresses.size(); ++i)
+		{
+			unique_addresses[i].x = rects[i].x;
+
+			unique_addresses[i].y = rects[i].y;
+
+			unique_addresses[i].page = pages[i];
+
+			used_area += static_cast<uint64_t>(rects[i].w) * rects[i].h;
+		}
+
+		// Rounding up to whole pixels of the smallest mip level keeps every level an exact fraction of the full-size image
+
+		const uint32_t mip_alignment_mask = (1u << (m_mip_level_cnt - 1)) - 1;
+
+		m_width = (map_width + mip_alignment_mask) & ~mip_alignment_mask;
+
+		m_height = ((packed_height >= 1u ? packed_height : 1u) + mip_alignment_mask) & ~mip_alignment_mask;
+
+		m_packing_efficiency = static_cast<float>(static_cast<double>(used_area) / (static_cast<double>(m_width) * m_height * m_page_cnt));
+
+		const uint32_t image_bytes = mip_chain_bytes(m_width, m_height, m_page_cnt, m_channel_cnt, m_mip_level_cnt);
+
+		m_image.allocate(image_bytes);
+
+		memset(m_image.data(), 0x00, image_bytes);
+
+		allocs.add(m_image);
+
+		allocs.remove(rects);
+
+		allocs.remove(pages);
+	}
+
+	timer.end_stage(stats.pack_us);
+
+	// Render glyphs into their final positions
+	{
+		queue.glyphs = unique_addresses.data();
+
+		queue.glyph_cnt = unique_addresses.size();
+
+		queue.image = m_image.data();
+
+		queue.image_width = m_width;
+
+		queue.image_page_height = m_height;
+
+		const bool is_rendered_on_gpu = options.gpu_renderer != nullptr && m_channel_cnt == 1 && !render_queued_glyphs_gpu(queue, *options.gpu_renderer, m_height * m_page_cnt);
+
+		if (!is_rendered_on_gpu)
+			run_glyph_queue<render_queued_glyphs>(queue, thread_cnt);
+	}
+
+	timer.end_stage(stats.render_us);
+
+	// Point duplicates to the spot of the glyph they share an SDF with
+	{
+		sort<offsetof(glyph_address, glyph_id), 4>(unique_addresses);
+
+		sort<offsetof(glyph_address, representative_id), 4>(addresses);
+
+		uint32_t unique_idx = 0;
+
+		for (auto& a : addresses)
+		{
+			while (unique_addresses[unique_idx].glyph_id != a.representative_id)
+				++unique_idx;
+
+			a.x = unique_addresses[unique_idx].x;
+
+			a.y = unique_addresses[unique_idx].y;
+
+			a.page = unique_addresses[unique_idx].page;
+		}
+	}
+
+	// Generate mapping data
+
+	uint32_t range_cnt = 1;
+
+	// Count continuous codepoint ranges
+	{
+		uint32_t prev_cp = cp_ids[0].codept;
+
+		for (uint32_t i = 1; i != cp_ids.size(); ++i)
+			if (cp_ids[i].codept != prev_cp + 1)
+			{
+				++range_cnt;
+
+				prev_cp = cp_ids[i].codept;
+			}
+			else
+				++prev_cp;
+	}
+
+	// Generate codepoint ranges
+	{
+		m_map_ranges.allocate(range_cnt);
+
+		uint32_t curr_idx = 0;
+
+		uint32_t prev_cp = cp_ids[0].codept;
+
+		m_map_ranges[0].beg = prev_cp;
+
+		// Index 0 holds the missing-character glyph, so cp_ids[i] ends up at index i + 1
+		for (uint32_t i = 1; i != cp_ids.size(); ++i)
+			if (cp_ids[i].codept != prev_cp + 1)
+			{
+				m_map_ranges[curr_idx].end = prev_cp;
+				m_map_ranges[curr_idx].offset = static_cast<int32_t>(i - prev_cp);
+				++curr_idx;
+
+				prev_cp = m_map_ranges[curr_idx].beg = cp_ids[i].codept;
+			}
+			else
+				++prev_cp;
+
+		m_map_ranges[range_cnt - 1].end = cp_ids[cp_ids.size() - 1].codept;
+		m_map_ranges[range_cnt - 1].offset = static_cast<int32_t>(cp_ids.size() - 1 - cp_ids[cp_ids.size() - 1].codept + 1);
+	}
+
+	m_map_indices.allocate(cp_ids.size() + 1);
+
+	allocs.add(m_map_ranges);
+
+	allocs.add(m_map_indices);
+
+	//m_map_indices[0] = { {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, 0.0F };
+
+	// Generate codepoint indices
+	{
+		sort<offsetof(glyph_address, glyph_id), 4>(addresses);
+
+		const float inv_width = 1.0F / m_width;
+
+		const float inv_height = 1.0F / m_height;
+
+		const float inv_scale = 1.0F / m_glyph_scale;
+
+		// Set first map index to missing-character glyph
+		{
+			const glyph_address& a = addresses[0];
+
+			glyph_metrics mtx = file.get_glyph_metrics_from_id(0);
+
+			const float atlas_pos_x = a.x * inv_width;
+
+			const float atlas_pos_y = a.y * inv_height;
+
+			const float atlas_ext_x = a.w * inv_width;
+
+			const float atlas_ext_y = a.h * inv_height;
+
+			const float real_ext_x = a.w * inv_scale;
+
+			const float real_ext_y = a.h * inv_scale;
+
+			const float real_bearing_x = mtx.left_side_bearing();
+
+			const float real_bearing_y = 1.0F - mtx.y_size() - (mtx.y_min() - file.baseline_offset());
+
+			const float real_advance = mtx.advance_width();
+
+			m_map_indices[0].atlas_position = { atlas_pos_x   , atlas_pos_y };
+			m_map_indices[0].atlas_extent = { atlas_ext_x   , atlas_ext_y };
+			m_map_indices[0].real_extent = { real_ext_x    , real_ext_y };
+			m_map_indices[0].real_bearing = { real_bearing_x, real_bearing_y };
+			m_map_indices[0].real_advance = real_advance;
+			m_map_indices[0].atlas_page = a.page;
+		}
+
+		for (uint32_t i = 0; i != cp_ids.size(); ++i)
+		{
+			uint32_t curr_id = cp_ids[i].glyph_id;
+
+			{
+				int64_t lo = 0, hi = addresses.size() - 1;
+
+				while (lo <= hi)
+				{
+					int64_t mid = lo + ((hi - lo) >> 1);
+
+					const uint32_t mid_id = addresses[static_cast<uint32_t>(mid)].glyph_id;
+
+					if (mid_id == curr_id)
+					{
+						const glyph_address& a = addresses[static_cast<uint32_t>(mid)];
+
+						glyph_metrics mtx = file.get_glyph_metrics_from_id(curr_id);
+
+						const float atlas_pos_x = (a.x + glyph_padding_pixels) * inv_width;
+
+						const float atlas_pos_y = (a.y + glyph_padding_pixels) * inv_height;
+
+						const float atlas_ext_x = a.w * inv_width;
+
+						const float atlas_ext_y = a.h * inv_height;
+
+						const float real_ext_x = a.w * inv_scale;
+
+						const float real_ext_y = a.h * inv_scale;
+
+						const float real_bearing_x = mtx.left_side_bearing();
+
+						const float real_bearing_y = 1.0F - mtx.y_size() - (mtx.y_min() - file.baseline_offset());
+
+						const float real_advance = mtx.advance_width();
+
+						m_map_indices[i + 1].atlas_position = { atlas_pos_x   , atlas_pos_y };
+						m_map_indices[i + 1].atlas_extent = { atlas_ext_x   , atlas_ext_y };
+						m_map_indices[i + 1].real_extent = { real_ext_x    , real_ext_y };
+						m_map_indices[i + 1].real_bearing = { real_bearing_x, real_bearing_y };
+						m_map_indices[i + 1].real_advance = real_advance;
+						m_map_indices[i + 1].atlas_page = a.page;
+
+						break;
+					}
+					else if (mid_id > curr_id)
+						hi = mid - 1;
+					else
+						lo = mid + 1;
+				}
+
+				if (lo > hi)
+				{
+					glyph_metrics mtx = file.get_glyph_metrics_from_id(curr_id);
+
+					const float advance = mtx.advance_width();
+
+					m_map_indices[i + 1] = { {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, advance, 0 };
+				}
+			}
+		}
+	}
+
+	timer.end_stage(stats.index_us);
+
+	m_image_data = m_image.data();
+
+	for (uint32_t level = 1; level != m_mip_level_cnt; ++level)
+	{
+		const uint32_t src_page_bytes = mip_width(level - 1) * mip_height(level - 1) * m_channel_cnt;
+
+		const uint32_t dst_page_bytes = mip_width(level) * mip_height(level) * m_channel_cnt;
+
+		for (uint32_t page = 0; page != m_page_cnt; ++page)
+			downsample_sdf_page(m_image.data() + mip_offset(level - 1) + page * src_page_bytes, mip_width(level - 1), mip_height(level - 1), m_channel_cnt, m_image.data() + mip_offset(level) + page * dst_page_bytes);
+	}
+
+	timer.end_stage(stats.mip_us);
+
+	if (options.bc4_compress)
+	{
+		m_bc4_image.allocate(bc4_mip_chain_bytes(m_width, m_height, m_page_cnt, m_mip_level_cnt));
+
+		allocs.add(m_bc4_image);
+
+		// Pages and levels are encoded separately, so no block spans two of them
+		for (uint32_t level = 0; level != m_mip_level_cnt; ++level)
+		{
+			const uint32_t w = mip_width(level);
+
+			const uint32_t h = mip_height(level);
+
+			const uint32_t page_bc4_bytes = bc4_encoded_bytes(w, h);
+
+			for (uint32_t page = 0; page != m_page_cnt; ++page)
+				bc4_encode(m_image.data() + mip_offset(level) + page * w * h, w, h, m_bc4_image.data() + bc4_mip_offset(level) + page * page_bc4_bytes, options.max_kernel_isa);
+		}
+
+		m_bc4_data = m_bc4_image.data();
+	}
+
+	timer.end_stage(stats.bc4_us);
+
+	m_map_ranges_view = { m_map_ranges.data(), m_map_ranges.data() + m_map_ranges.size() };
+
+	m_map_indices_view = { m_map_indices.data(), m_map_indices.data() + m_map_indices.size() };
+
+	build_lookup_table();
+
+	allocs.add(m_lookup_directory);
+
+	allocs.add(m_lookup_pages);
+
+	timer.end_stage(stats.lookup_us);
+
+	stats.total_us += timer.stage_beg_us;
+
+	stats.codept_cnt = cp_ids.size();
+
+	stats.glyph_cnt = addresses.size();
+
+	stats.rendered_glyph_cnt = unique_addresses.size();
+
+	stats.image_bytes = m_image.size() + m_bc4_image.size();
+
+	return {};
+}
+
+void glyph_atlas::destroy() noexcept
+{
+	m_cache_file.close();
+
+	m_image.deallocate();
+
+	m_map_ranges.deallocate();
+
+	m_map_indices.deallocate();
+
+	m_bc4_image.deallocate();
+
+	m_lookup_directory.deallocate();
+
+	m_lookup_pages.deallocate();
+
+	m_image_data = nullptr;
+
+	m_bc4_data = nullptr;
+
+	m_map_ranges_view = { nullptr, nullptr };
+
+	m_map_indices_view = { nullptr, nullptr };
+
+	m_width = m_height = m_page_cnt = m_channel_cnt = m_mip_level_cnt = m_glyph_scale = 0;
+
+	m_line_height = m_packing_efficiency = 0.0F;
+
+	m_source_hash = 0;
+}
+
+och::status glyph_atlas::save_glfatl(const char* filename, bool overwrite_existing_file) const noexcept
+{
+	glfatl_fileheader layout{};
+
+	layout.m_magic = glfatl_fileheader::MAGIC;
+
+	layout.m_version = glfatl_fileheader::VERSION;
+
+	layout.m_source_hash = m_source_hash;
+
+	layout.m_width = m_width;
+
+	layout.m_height = m_height;
+
+	layout.m_page_cnt = m_page_cnt;
+
+	layout.m_channel_cnt = m_channel_cnt;
+
+	layout.m_mip_level_cnt = m_mip_level_cnt;
+
+	layout.m_line_height = m_line_height;
+
+	layout.m_glyph_scale = m_glyph_scale;
+
+	layout.m_map_ranges_size = static_cast<uint32_t>(m_map_ranges_view.len());
+
+	layout.m_map_indices_size = static_cast<uint32_t>(m_map_indices_view.len());
+
+	layout.compute_layout(m_bc4_data != nullptr);
+
+	och::mapped_file<glfatl_fileheader> file;
+
+	check(file.create(filename, och::fio::access::read_write, overwrite_existing_file ? och::fio::open::truncate : och::fio::open::fail, och::fio::open::normal, layout.m_file_bytes));
+
+	glfatl_fileheader& hdr = file[0];
+
+	// Zero the whole file first, so the alignment gaps between sections do not contain stale data
+
+	memset(&hdr, 0x00, layout.m_file_bytes);
+
+	hdr = layout;
+
+	memcpy(hdr.section<mapper_range>(hdr.m_map_ranges_offset), m_map_ranges_view.beg, hdr.map_ranges_bytes());
+
+	memcpy(hdr.section<glyph_index>(hdr.m_map_indices_offset), m_map_indices_view.beg, hdr.map_indices_bytes());
+
+	memcpy(hdr.section<uint8_t>(hdr.m_image_offset), m_image_data, hdr.image_bytes());
+
+	if (m_bc4_data)
+		memcpy(hdr.section<uint8_t>(hdr.m_bc4_offset), m_bc4_data, hdr.bc4_bytes());
+
+	file.close();
+
+	return {};
+}
+
+och::status glyph_atlas::load_glfatl(const char* filename) noexcept
+{
+	destroy();
+
+	check(m_cache_file.create(filename, och::fio::access::read, och::fio::open::normal, och::fio::open::fail));
+
+	if (m_cache_file.bytes() < sizeof(glfatl_fileheader))
+	{
+		m_cache_file.close();
+
+		return TEMP_STATUS_MACRO; // Too short to even hold the header
+	}
+
+	const glfatl_fileheader& hdr = *reinterpret_cast<const glfatl_fileheader*>(m_cache_file.data());
+
+	if (!hdr.is_valid())
+	{
+		m_cache_file.close();
+
+		return TEMP_STATUS_MACRO; // Not a glfatl file, or one written by a different version
+	}
+
+	// The sections are read straight from the mapping, so they must all lie inside it
+	if (m_cache_file.bytes() != hdr.m_file_bytes)
+	{
+		m_cache_file.close();
+
+		return TEMP_STATUS_MACRO; // Truncated or padded file
+	}
+
+	m_width = hdr.m_width;
+
+	m_height = hdr.m_height;
+
+	m_page_cnt = hdr.m_page_cnt;
+
+	m_channel_cnt = hdr.m_channel_cnt;
+
+	m_mip_level_cnt = hdr.m_mip_level_cnt;
+
+	m_line_height = hdr.m_line_height;
+
+	m_glyph_scale = hdr.m_glyph_scale;
+
+	m_source_hash = hdr.m_source_hash;
+
+	m_packing_efficiency = 0.0F;
+
+	// Nothing is copied. The sections are only read from the mapping once they are used.
+
+	const mapper_range* ranges = hdr.section<mapper_range>(hdr.m_map_ranges_offset);
+
+	const glyph_index* indices = hdr.section<glyph_index>(hdr.m_map_indices_offset);
+
+	m_map_ranges_view = { ranges, ranges + hdr.m_map_ranges_size };
+
+	m_map_indices_view = { indices, indices + hdr.m_map_indices_size };
+
+	build_lookup_table();
+
+	m_image_data = hdr.section<uint8_t>(hdr.m_image_offset);
+
+	m_bc4_data = hdr.m_bc4_offset ? hdr.section<uint8_t>(hdr.m_bc4_offset) : nullptr;
+
+	return {};
+}
+
+och::status glyph_atlas::create_cached(const char* cache_filename, const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges, const glyph_atlas_build_options& options) noexcept
+{
+	// Only the font file's table directory is read to hash it, so checking the cache is cheap
+
+	uint64_t expected_hash;
+
+	{
+		truetype_file file;
+
+		check(file.create(truetype_filename));
+
+		expected_hash = glfatl_source_hash(file, glyph_size, glyph_padding_pixels, sdf_clamp, map_width, codept_ranges, options);
+
+		file.close();
+	}
+
+	if (!load_glfatl(cache_filename) && m_source_hash == expected_hash)
+		return {};
+
+	check(create(truetype_filename, glyph_size, glyph_padding_pixels, sdf_clamp, map_width, codept_ranges, options));
+
+	check(save_glfatl(cache_filename, true));
+
+	return {};
+}
+
+och::status glyph_atlas::save_bmp(const char* filename, bool overwrite_existing_file) const noexcept
+{
+	bitmap_file file;
+
+	// Pages are written one below the other
+
+	const uint32_t total_height = m_height * m_page_cnt;
+
+	check(file.create(filename, overwrite_existing_file ? och::fio::open::truncate : och::fio::open::fail, m_width, total_height));
+
+	for (uint32_t y = 0; y != total_height; ++y)
+		for (uint32_t x = 0; x != m_width; ++x)
+		{
+			const uint8_t* texel = m_image_data + (x + (total_height - 1 - y) * m_width) * m_channel_cnt;
+
+			if (m_channel_cnt == 3)
+				file(x, y) = { texel[2], texel[1], texel[0] };
+			else
+				file(x, y) = { texel[0], texel[0], texel[0] };
 		}
 
-		addresses.shrink(curr_idx);
-	}
+	file.destroy();
+
+	return {};
+}
+
+float glyph_atlas::line_height() const noexcept
+{
+	return m_line_height;
+}
+
+uint32_t glyph_atlas::width() const noexcept
+{
+	return m_width;
+}
+
+uint32_t glyph_atlas::height() const noexcept
+{
+	return m_height;
+}
+
+uint32_t glyph_atlas::page_cnt() const noexcept
+{
+	return m_page_cnt;
+}
+
+uint32_t glyph_atlas::channel_cnt() const noexcept
+{
+	return m_channel_cnt;
+}
+
+uint32_t glyph_atlas::mip_level_cnt() const noexcept
+{
+	return m_mip_level_cnt;
+}
 
-	// Find an arrangement for the glyphs and allocate final image accordingly
-	{
-		sort<offsetof(glyph_address, w), 8, true>(addresses);
+uint32_t glyph_atlas::mip_width(uint32_t level) const noexcept
+{
+	return mip_extent(m_width, level);
+}
 
-		uint32_t curr_x = 0;
+uint32_t glyph_atlas::mip_height(uint32_t level) const noexcept
+{
+	return mip_extent(m_height, level);
+}
 
-		uint32_t curr_y = addresses[0].h + 2 * glyph_padding_pixels;
+uint32_t glyph_atlas::glyph_scale() const noexcept
+{
+	return m_glyph_scale;
+}
 
-		for (auto& a : addresses)
-		{
-			uint32_t padded_w = a.w + glyph_padding_pixels;
+float glyph_atlas::packing_efficiency() const noexcept
+{
+	return m_packing_efficiency;
+}
 
-			uint32_t padded_h = a.h + glyph_padding_pixels;
+uint64_t glyph_atlas::source_hash() const noexcept
+{
+	return m_source_hash;
+}
 
-			if (padded_w > map_width - glyph_padding_pixels)
-				return TEMP_STATUS_MACRO; // Glyph too large for given map_width parameter
+const uint8_t* glyph_atlas::raw_data() const noexcept
+{
+	return m_image_data;
+}
 
-			if (curr_x + padded_w > map_width - glyph_padding_pixels)
-			{
-				curr_y += padded_h;
+uint32_t glyph_atlas::mip_offset(uint32_t level) const noexcept
+{
+	return mip_chain_bytes(m_width, m_height, m_page_cnt, m_channel_cnt, level);
+}
 
-				curr_x = padded_w;
-			}
-			else
-				curr_x += padded_w;
+image_view<const uint8_t> glyph_atlas::view() const noexcept { return image_view(m_image_data, m_width, 0, 0); };
 
-			a.x = curr_x - padded_w;
+const uint8_t* glyph_atlas::bc4_data() const noexcept
+{
+	return m_bc4_data;
+}
 
-			a.y = curr_y - padded_h;
-		}
+uint32_t glyph_atlas::bc4_bytes() const noexcept
+{
+	return m_bc4_data ? bc4_mip_chain_bytes(m_width, m_height, m_page_cnt, m_mip_level_cnt) : 0;
+}
 
-		m_width = map_width;
+uint32_t glyph_atlas::bc4_mip_offset(uint32_t level) const noexcept
+{
+	return bc4_mip_chain_bytes(m_width, m_height, m_page_cnt, level);
+}
 
-		m_height = curr_y + glyph_padding_pixels >= 1u ? curr_y + glyph_padding_pixels : 1u;
+glyph_atlas::glyph_index glyph_atlas::operator()(uint32_t codepoint) const noexcept
+{
+	return m_map_indices_view.beg[lookup_index(codepoint)];
+}
 
-		m_image.allocate(m_width * m_height);
+void glyph_atlas::lookup(const char32_t* codepoints, size_t cnt, glyph_index* out) const noexcept
+{
+	const glyph_index* const indices = m_map_indices_view.beg;
 
-		memset(m_image.data(), 0x00, m_width * m_height);
-	}
+	// Lookups are independent of each other, so consecutive iterations overlap their loads
+	for (size_t i = 0; i != cnt; ++i)
+		out[i] = indices[lookup_index(static_cast<uint32_t>(codepoints[i]))];
+}
 
-	// Copy glyphs from buffer to final image
-	{
-		for (auto& a : addresses)
-			for (uint32_t y = 0; y != a.h; ++y)
-				for (uint32_t x = 0; x != a.w; ++x)
-				{
-					const uint8_t v = sdf_buffer[a.buffer_begin + x + y * padded_glyph_size];
+void glyph_atlas::build_lookup_table() noexcept
+{
+	static constexpr uint32_t MAX_CODEPOINT = (LOOKUP_PLANE_CNT << 16) - 1;
 
-					m_image[a.x + x + glyph_padding_pixels + (a.h + a.y + glyph_padding_pixels - y - 1) * m_width] = v;
-				}
-	}
+	// Number the populated planes, leaving block 0 for the unpopulated ones
 
-	// Generate mapping data
+	memset(m_lookup_planes, 0x00, sizeof(m_lookup_planes));
 
-	uint32_t range_cnt = 1;
+	uint32_t block_cnt = 1;
 
-	// Count continuous codepoint ranges
+	for (const mapper_range& r : m_map_ranges_view)
 	{
-		uint32_t prev_cp = cp_ids[0].codept;
+		if (r.beg > MAX_CODEPOINT)
+			continue;
 
-		for (uint32_t i = 1; i != cp_ids.size(); ++i)
-			if (cp_ids[i].codept != prev_cp + 1)
-			{
-				++range_cnt;
+		const uint32_t end = r.end < MAX_CODEPOINT ? r.end : MAX_CODEPOINT;
 
-				prev_cp = cp_ids[i].codept;
-			}
-			else
-				++prev_cp;
+		for (uint32_t plane = r.beg >> 16; plane <= end >> 16; ++plane)
+			if (!m_lookup_planes[plane])
+				m_lookup_planes[plane] = static_cast<uint16_t>(block_cnt++);
 	}
 
-	// Generate codepoint ranges
-	{
-		m_map_ranges.allocate(range_cnt);
+	// Number the populated pages, leaving page 0 for the unpopulated ones
 
-		uint32_t curr_idx = 0;
+	m_lookup_directory.allocate(block_cnt << 8);
 
-		uint32_t prev_cp = cp_ids[0].codept;
+	memset(m_lookup_directory.data(), 0x00, (block_cnt << 8) * sizeof(uint16_t));
 
-		uint32_t last_beg = cp_ids[0].codept;
+	uint32_t page_cnt = 1;
 
-		m_map_ranges[0].beg = prev_cp;
+	for (const mapper_range& r : m_map_ranges_view)
+	{
+		if (r.beg > MAX_CODEPOINT)
+			continue;
 
-		for (uint32_t i = 0; i != cp_ids.size(); ++i)
-			if (cp_ids[i].codept != prev_cp + 1)
-			{
-				m_map_ranges[curr_idx].beg = last_beg;
-				m_map_ranges[curr_idx].end = prev_cp;
-				m_map_ranges[curr_idx].offset = static_cast<int32_t>(i - cp_ids[i].codept + 1);
-				++curr_idx;
+		const uint32_t end = r.end < MAX_CODEPOINT ? r.end : MAX_CODEPOINT;
 
-				prev_cp = last_beg = cp_ids[i].codept;
-			}
-			else
-				++prev_cp;
+		for (uint32_t page = r.beg >> 8; page <= end >> 8; ++page)
+		{
+			uint16_t& entry = m_lookup_directory[(m_lookup_planes[page >> 8] << 8) | (page & 0xFF)];
 
-		m_map_ranges[range_cnt - 1].end = cp_ids[cp_ids.size() - 1].codept;
-		m_map_ranges[range_cnt - 1].offset = static_cast<int32_t>(cp_ids.size() - 1 - cp_ids[cp_ids.size() - 1].codept + 1);
+			if (!entry)
+				entry = static_cast<uint16_t>(page_cnt++);
+		}
 	}
 
-	m_map_indices.allocate(cp_ids.size() + 1);
+	// Fill in the populated pages. Everything else keeps index 0, the missing-character glyph.
 
-	//m_map_indices[0] = { {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, 0.0F };
+	m_lookup_pages.allocate(page_cnt << 8);
 
-	// Generate codepoint indices
+	memset(m_lookup_pages.data(), 0x00, (page_cnt << 8) * sizeof(uint32_t));
+
+	for (const mapper_range& r : m_map_ranges_view)
 	{
-		sort<offsetof(glyph_address, glyph_id), 4>(addresses);
+		if (r.beg > MAX_CODEPOINT)
+			continue;
 
-		const float inv_width = 1.0F / m_width;
+		const uint32_t end = r.end < MAX_CODEPOINT ? r.end : MAX_CODEPOINT;
 
-		const float inv_height = 1.0F / m_height;
+		for (uint32_t codepoint = r.beg; codepoint <= end; ++codepoint)
+		{
+			const uint32_t page = m_lookup_directory[(m_lookup_planes[codepoint >> 16] << 8) | ((codepoint >> 8) & 0xFF)];
 
-		const float inv_scale = 1.0F / m_glyph_scale;
+			m_lookup_pages[(page << 8) | (codepoint & 0xFF)] = static_cast<uint32_t>(static_cast<int32_t>(codepoint) + r.offset);
+		}
+	}
+}
 
-		// Set first map index to missing-character glyph
-		{
-			const glyph_address& a = addresses[0];
+och::range<const uint8_t> glyph_atlas::get_mapper_ranges() const noexcept
+{
+	return och::range<const uint8_t>(reinterpret_cast<const uint8_t*>(m_map_ranges_view.beg), reinterpret_cast<const uint8_t*>(m_map_ranges_view.beg + m_map_ranges_view.len()));
+}
 
-			glyph_metrics mtx = file.get_glyph_metrics_from_id(0);
+och::range<const uint8_t> glyph_atlas::get_mapper_indices() const noexcept
+{
+	return och::range<const uint8_t>(reinterpret_cast<const uint8_t*>(m_map_indices_view.beg), reinterpret_cast<const uint8_t*>(m_map_indices_view.beg + m_map_indices_view.len()));
+}
 
-			const float atlas_pos_x = a.x * inv_width;
+glyph_atlas::~glyph_atlas() noexcept
+{
+	destroy();
+}
 
-			const float atlas_pos_y = a.y * inv_height;
 
-			const float atlas_ext_x = a.w * inv_width;
 
-			const float atlas_ext_y = a.h * inv_height;
+och::status dynamic_glyph_atlas::create(const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t width, uint32_t height, const glyph_atlas_build_options& options) noexcept
+{
+	// Release a previously created atlas and stop its worker thread
 
-			const float real_ext_x = a.w * inv_scale;
+	destroy();
 
-			const float real_ext_y = a.h * inv_scale;
+	check(m_file.create(truetype_filename));
 
-			const float real_bearing_x = mtx.left_side_bearing();
+	// Every glyph request goes through the cmap, so it is flattened once up front
+	m_file.build_cmap_table();
 
-			const float real_bearing_y = 1.0F - mtx.y_size() - (mtx.y_min() - file.baseline_offset());
+	m_width = width;
 
-			const float real_advance = mtx.advance_width();
+	m_height = height;
 
-			m_map_indices[0].atlas_position = { atlas_pos_x   , atlas_pos_y };
-			m_map_indices[0].atlas_extent = { atlas_ext_x   , atlas_ext_y };
-			m_map_indices[0].real_extent = { real_ext_x    , real_ext_y };
-			m_map_indices[0].real_bearing = { real_bearing_x, real_bearing_y };
-			m_map_indices[0].real_advance = real_advance;
-		}
+	m_glyph_scale = glyph_size;
 
-		for (uint32_t i = 0; i != cp_ids.size(); ++i)
-		{
-			uint32_t curr_id = cp_ids[i].glyph_id;
+	m_glyph_padding_pixels = glyph_padding_pixels;
 
-			{
-				int64_t lo = 0, hi = addresses.size() - 1;
+	m_padded_glyph_size = static_cast<uint32_t>(static_cast<float>(glyph_size) * (1.0F + 2.0F * sdf_clamp) + 2.0F);
 
-				while (lo <= hi)
-				{
-					int64_t mid = lo + ((hi - lo) >> 1);
+	m_cell_scale = static_cast<float>(glyph_size) / static_cast<float>(m_padded_glyph_size);
 
-					const uint32_t mid_id = addresses[static_cast<uint32_t>(mid)].glyph_id;
+	m_sdf_clamp = sdf_clamp;
 
-					if (mid_id == curr_id)
-					{
-						const glyph_address& a = addresses[static_cast<uint32_t>(mid)];
+	m_line_height = m_file.line_height();
 
-						glyph_metrics mtx = file.get_glyph_metrics_from_id(curr_id);
+	m_kernel = sdf_row_kernel(sdf_supported_kernel_isa(options.max_kernel_isa), options.solver);
 
-						const float atlas_pos_x = (a.x + glyph_padding_pixels) * inv_width;
+	m_skip_saturated_blocks = options.skip_saturated_blocks;
 
-						const float atlas_pos_y = (a.y + glyph_padding_pixels) * inv_height;
+	m_packer.create(width, height, glyph_padding_pixels);
 
-						const float atlas_ext_x = a.w * inv_width;
+	m_image.allocate(width * height);
 
-						const float atlas_ext_y = a.h * inv_height;
+	memset(m_image.data(), 0x00, width * height);
 
-						const float real_ext_x = a.w * inv_scale;
+	m_glyph_slots.allocate(m_file.glyph_cnt());
 
-						const float real_ext_y = a.h * inv_scale;
+	for (uint32_t& slot : m_glyph_slots)
+		slot = 0;
 
-						const float real_bearing_x = mtx.left_side_bearing();
+	m_indices.reset();
 
-						const float real_bearing_y = 1.0F - mtx.y_size() - (mtx.y_min() - file.baseline_offset());
+	m_pending_cnt = 0;
 
-						const float real_advance = mtx.advance_width();
+	m_finished_tail = 0;
 
-						m_map_indices[i + 1].atlas_position = { atlas_pos_x   , atlas_pos_y };
-						m_map_indices[i + 1].atlas_extent = { atlas_ext_x   , atlas_ext_y };
-						m_map_indices[i + 1].real_extent = { real_ext_x    , real_ext_y };
-						m_map_indices[i + 1].real_bearing = { real_bearing_x, real_bearing_y };
-						m_map_indices[i + 1].real_advance = real_advance;
+	m_overflow_requests.reset();
 
-						break;
-					}
-					else if (mid_id > curr_id)
-						hi = mid - 1;
-					else
-						lo = mid + 1;
-				}
+	m_overflow_tail = 0;
 
-				if (lo > hi)
-				{
-					glyph_metrics mtx = file.get_glyph_metrics_from_id(curr_id);
+	m_request_head.store(0, std::memory_order::relaxed);
 
-					const float advance = mtx.advance_width();
+	m_finished_head.store(0, std::memory_order::relaxed);
 
-					m_map_indices[i + 1] = { {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, advance };
-				}
-			}
-		}
-	}
+	m_is_stopping.store(false, std::memory_order::relaxed);
 
-	file.close();
+	if (HANDLE wake_event = CreateEventW(nullptr, FALSE, FALSE, nullptr); !wake_event)
+		return to_status(HRESULT_FROM_WIN32(GetLastError()));
+	else
+		m_worker_wake_event = wake_event;
+
+	DWORD thread_id;
+
+	if (HANDLE thread = CreateThread(nullptr, 4096 * 16, worker_thread_fn, this, 0, &thread_id); !thread)
+		return to_status(HRESULT_FROM_WIN32(GetLastError()));
+	else
+		m_worker_thread = thread;
 
 	return {};
 }
 
-void glyph_atlas::destroy() noexcept {}
-
-och::status glyph_atlas::save_glfatl(const char* filename, bool overwrite_existing_file) const noexcept
+void dynamic_glyph_atlas::destroy() noexcept
 {
-	const uint32_t image_bytes = m_width * m_height;
+	if (m_worker_thread)
+	{
+		m_is_stopping.store(true, std::memory_order::release);
 
-	const uint32_t map_ranges_bytes = m_map_ranges.size() * sizeof(*m_map_ranges.data());
+		SetEvent(m_worker_wake_event);
 
-	const uint32_t map_indices_bytes = m_map_indices.size() * sizeof(*m_map_indices.data());
+		WaitForSingleObject(m_worker_thread, INFINITE);
 
-	const uint32_t metadata_bytes = sizeof(glfatl_fileheader);
+		CloseHandle(m_worker_thread);
 
-	const uint32_t total_file_bytes = image_bytes + map_ranges_bytes + map_indices_bytes + metadata_bytes;
+		m_worker_thread = nullptr;
+	}
 
-	och::mapped_file<glfatl_fileheader> file;
+	if (m_worker_wake_event)
+	{
+		CloseHandle(m_worker_wake_event);
 
-	check(file.create(filename, och::fio::access::read_write, overwrite_existing_file ? och::fio::open::truncate : och::fio::open::fail, och::fio::open::normal, total_file_bytes));
+		m_worker_wake_event = nullptr;
+	}
 
-	// Layout: m_width, m_height, m_map_ranges.size(), m_map_indices.size(), m_map_ranges, m_map_indices, m_image
+	m_file.close();
+}
 
-	glfatl_fileheader& hdr = file[0];
+unsigned long dynamic_glyph_atlas::worker_thread_fn(void* data) noexcept
+{
+	dynamic_glyph_atlas& atlas = *static_cast<dynamic_glyph_atlas*>(data);
 
-	hdr.m_width = m_width;
+	const sdf_clamp_mapper mapper{ atlas.m_sdf_clamp };
 
-	hdr.m_height = m_height;
+	// Reused for all glyphs rendered by this thread
+	sdf_curve_table curves;
 
-	hdr.m_line_height = m_line_height;
+	glyph_scratch_arena scratch;
 
-	hdr.m_glyph_scale = m_glyph_scale;
+	sdf_render_scratch render_scratch;
 
-	hdr.m_map_ranges_size = m_map_ranges.size();
+	uint32_t request_tail = 0;
 
-	hdr.m_map_indices_size = m_map_indices.size();
+	while (true)
+	{
+		if (request_tail == atlas.m_request_head.load(std::memory_order::acquire))
+		{
+			// Requests queued before stopping are still rendered, so that destroy leaves no glyph half-drawn
+			if (atlas.m_is_stopping.load(std::memory_order::acquire))
+				break;
 
-	memcpy(hdr.map_ranges_data(), m_map_ranges.data(), map_ranges_bytes);
+			WaitForSingleObject(atlas.m_worker_wake_event, INFINITE);
 
-	memcpy(hdr.map_indices_data(), m_map_indices.data(), map_indices_bytes);
+			continue;
+		}
 
-	memcpy(hdr.image_data(), m_image.data(), image_bytes);
+		const render_request& r = atlas.m_requests[request_tail % MAX_PENDING_GLYPHS];
 
-	file.close();
+		glyph_data glyph = atlas.m_file.get_glyph_data_from_id(r.glyph_id, scratch);
 
-	return {};
-}
+		sdf_build_curve_table(glyph, atlas.m_cell_scale, curves);
 
-och::status glyph_atlas::load_glfatl(const char* filename) noexcept
-{
-	och::mapped_file<const glfatl_fileheader> file;
+		image_view target(atlas.m_image.data(), atlas.m_width, r.x, r.y);
 
-	check(file.create(filename, och::fio::access::read, och::fio::open::normal, och::fio::open::fail));
+		sdf_from_glyph(target, curves, atlas.m_padded_glyph_size, atlas.m_padded_glyph_size, { r.cell_x, r.cell_y, r.cell_x + r.w, r.cell_y + r.h }, mapper, mapper.clamp, atlas.m_kernel, atlas.m_skip_saturated_blocks, render_scratch);
 
-	const glfatl_fileheader& hdr = file[0];
+		// The main thread never has more than MAX_PENDING_GLYPHS glyphs uncollected, so this cannot overwrite an unread rectangle
+		const uint32_t finished_head = atlas.m_finished_head.load(std::memory_order::relaxed);
 
-	m_width = hdr.m_width;
+		atlas.m_finished[finished_head % MAX_PENDING_GLYPHS] = { r.x, r.y, r.w, r.h };
 
-	m_height = hdr.m_height;
+		atlas.m_finished_head.store(finished_head + 1, std::memory_order::release);
 
-	m_line_height = hdr.m_line_height;
+		++request_tail;
+	}
 
-	m_glyph_scale = hdr.m_glyph_scale;
+	return 0;
+}
+
+void dynamic_glyph_atlas::submit_request(const render_request& request) noexcept
+{
+	const uint32_t request_head = m_request_head.load(std::memory_order::relaxed);
 
-	m_map_ranges.allocate(hdr.m_map_ranges_size);
+	m_requests[request_head % MAX_PENDING_GLYPHS] = request;
 
-	memcpy(m_map_ranges.data(), hdr.map_ranges_data(), hdr.map_ranges_bytes());
+	m_request_head.store(request_head + 1, std::memory_order::release);
 
-	m_map_indices.allocate(hdr.m_map_indices_size);
+	++m_pending_cnt;
 
-	memcpy(m_map_indices.data(), hdr.map_indices_data(), hdr.map_indices_bytes());
+	SetEvent(m_worker_wake_event);
+}
 
-	m_image.allocate(m_width * m_height);
+glyph_atlas::glyph_index dynamic_glyph_atlas::operator()(uint32_t codepoint) noexcept
+{
+	uint32_t glyph_id = m_file.get_glyph_id_from_codept(codepoint);
 
-	memcpy(m_image.data(), hdr.image_data(), hdr.image_bytes());
+	if (glyph_id >= m_glyph_slots.size())
+		glyph_id = 0;
 
-	file.close();
+	if (const uint32_t slot = m_glyph_slots[glyph_id]; slot)
+		return m_indices[slot - 1];
 
-	return {};
-}
+	const glyph_metrics mtx = m_file.get_glyph_metrics_from_id(glyph_id);
 
-och::status glyph_atlas::save_bmp(const char* filename, bool overwrite_existing_file) const noexcept
-{
-	bitmap_file file;
+	glyph_atlas::glyph_index index{ {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, {0.0F, 0.0F}, mtx.advance_width(), 0 };
 
-	check(file.create(filename, overwrite_existing_file ? och::fio::open::truncate : och::fio::open::fail, m_width, m_height));
+	glyph_data glyph = m_file.get_glyph_data_from_id(glyph_id, m_scratch);
 
-	for (uint32_t y = 0; y != m_height; ++y)
-		for (uint32_t x = 0; x != m_width; ++x)
+	if (glyph.metrics().x_size() && glyph.point_cnt() >= 6)
+	{
+		sdf_build_curve_table(glyph, m_cell_scale, m_curves);
+
+		const sdf_pixel_rect bounds = sdf_glyph_bounds(m_curves, m_padded_glyph_size, m_padded_glyph_size, m_sdf_clamp);
+
+		glyph_pack_rect rect{ bounds.x_end - bounds.x_beg, bounds.y_end - bounds.y_beg, 0, 0 };
+
+		if (rect.w && m_packer.insert(rect))
 		{
-			uint8_t v = m_image[x + (m_height - 1 - y) * m_width];
+			const uint32_t x = rect.x + m_glyph_padding_pixels;
 
-			file(x, y) = { v, v, v };
-		}
+			const uint32_t y = rect.y + m_glyph_padding_pixels;
 
-	file.destroy();
+			const float inv_width = 1.0F / m_width;
 
-	return {};
-}
+			const float inv_height = 1.0F / m_height;
 
-float glyph_atlas::line_height() const noexcept
-{
-	return m_line_height;
-}
+			const float inv_scale = 1.0F / m_glyph_scale;
 
-uint32_t glyph_atlas::width() const noexcept
-{
-	return m_width;
-}
+			index.atlas_position = { x * inv_width, y * inv_height };
+			index.atlas_extent = { rect.w * inv_width, rect.h * inv_height };
+			index.real_extent = { rect.w * inv_scale, rect.h * inv_scale };
+			index.real_bearing = { mtx.left_side_bearing(), 1.0F - mtx.y_size() - (mtx.y_min() - m_file.baseline_offset()) };
 
-uint32_t glyph_atlas::height() const noexcept
-{
-	return m_height;
-}
+			const render_request request{ glyph_id, x, y, bounds.x_beg, bounds.y_beg, rect.w, rect.h };
 
-uint32_t glyph_atlas::glyph_scale() const noexcept
-{
-	return m_glyph_scale;
-}
+			// The glyph keeps its place either way, so the returned index stays valid once it has been rendered
+			if (m_pending_cnt == MAX_PENDING_GLYPHS)
+				m_overflow_requests.add(request);
+			else
+				submit_request(request);
+		}
+	}
 
-uint8_t* glyph_atlas::data() noexcept
-{
-	return m_image.data();
-}
+	m_indices.add(index);
 
-const uint8_t* glyph_atlas::raw_data() const noexcept
-{
-	return m_image.data();
+	m_glyph_slots[glyph_id] = m_indices.size();
+
+	return index;
 }
 
-image_view<uint8_t> glyph_atlas::view() noexcept
+uint32_t dynamic_glyph_atlas::collect_dirty_rects(dirty_rect* out_rects, uint32_t max_rect_cnt) noexcept
 {
-	return image_view(m_image.data(), m_width, 0, 0);
-}
+	const uint32_t finished_head = m_finished_head.load(std::memory_order::acquire);
 
-image_view<const uint8_t> glyph_atlas::view() const noexcept { return image_view(m_image.data(), m_width, 0, 0); };
+	uint32_t rect_cnt = 0;
 
-glyph_atlas::glyph_index glyph_atlas::operator()(uint32_t codepoint) const noexcept
-{
-	int64_t lo = 0, hi = m_map_ranges.size() - 1;
+	while (m_finished_tail != finished_head && rect_cnt != max_rect_cnt)
+		out_rects[rect_cnt++] = m_finished[m_finished_tail++ % MAX_PENDING_GLYPHS];
 
-	while (lo <= hi)
-	{
-		int64_t mid = lo + ((hi - lo) >> 1);
+	m_pending_cnt -= rect_cnt;
 
-		const uint32_t beg_code = m_map_ranges[static_cast<uint32_t>(mid)].beg;
+	// Held back glyphs take over the freed slots in the order they were looked up
 
-		const uint32_t end_code = m_map_ranges[static_cast<uint32_t>(mid)].end;
+	while (m_overflow_tail != m_overflow_requests.size() && m_pending_cnt != MAX_PENDING_GLYPHS)
+		submit_request(m_overflow_requests[m_overflow_tail++]);
 
-		if (beg_code <= codepoint && end_code >= codepoint)
-			return m_map_indices[codepoint + m_map_ranges[static_cast<uint32_t>(mid)].offset];
-		else if (beg_code > codepoint)
-			hi = mid - 1;
-		else if (end_code < codepoint)
-			lo = mid + 1;
-		else
-			break;
+	if (m_overflow_tail == m_overflow_requests.size())
+	{
+		m_overflow_requests.reset();
+
+		m_overflow_tail = 0;
 	}
 
-	return m_map_indices[0];
+	return rect_cnt;
 }
 
-och::range<const uint8_t> glyph_atlas::get_mapper_ranges() const noexcept
+float dynamic_glyph_atlas::line_height() const noexcept
 {
-	return och::range<const uint8_t>(reinterpret_cast<const uint8_t*>(m_map_ranges.data()), reinterpret_cast<const uint8_t*>(m_map_ranges.data() + m_map_ranges.size()));
+	return m_line_height;
 }
 
-och::range<const uint8_t> glyph_atlas::get_mapper_indices() const noexcept
+uint32_t dynamic_glyph_atlas::width() const noexcept
+{
+	return m_width;
+}
+
+uint32_t dynamic_glyph_atlas::height() const noexcept
 {
-	return och::range<const uint8_t>(reinterpret_cast<const uint8_t*>(m_map_indices.data()), reinterpret_cast<const uint8_t*>(m_map_indices.data() + m_map_indices.size()));
+	return m_height;
 }
 
-glyph_atlas::~glyph_atlas() noexcept
+const uint8_t* dynamic_glyph_atlas::raw_data() const noexcept
 {
+	return m_image.data();
+}
 
+dynamic_glyph_atlas::~dynamic_glyph_atlas() noexcept
+{
+	destroy();
 }
@@ -1,15 +1,139 @@
 #pragma once
 
+#include <atomic>
+
 #include "och_err.h"
 #include "och_matmath.h"
 #include "truetype.h"
 #include "image_view.h"
 #include "heap_buffer.h"
+#include "simple_vec.h"
+#include "sdf_kernels.h"
+#include "glyph_packer.h"
+
+enum class glyph_sdf_mode : uint8_t
+{
+	// One channel holding the distance to the outline. Rounds off sharp corners unless glyphs are rendered large.
+	single_channel,
+
+	// Three channels, the median of which gives the distance to the outline. Keeps corners sharp at about half the glyph size.
+	multi_channel,
+};
+
+struct sdf_gpu_renderer;
+
+struct glyph_atlas_source;
+
+// Wall time in microseconds spent in each stage of glyph_atlas::create, along with the amount of work done
+struct glyph_atlas_build_stats
+{
+	// Opening the font file
+	int64_t open_us;
+
+	// Listing, sorting and deduplicating the requested codepoints
+	int64_t codept_sort_us;
+
+	// Mapping the codepoints to glyph ids through the font's cmap table
+	int64_t cmap_us;
+
+	// Sorting and deduplicating the glyph ids
+	int64_t glyph_id_sort_us;
+
+	// Decoding and flattening every outline once, so it can be scaled to each size. Only done by glyph_atlas::create_multi_size.
+	int64_t decode_us;
+
+	// Finding the part of each glyph's SDF cell that is not saturated, after decoding its outline unless that was done up front
+	int64_t measure_us;
+
+	// Finding glyphs with identical SDFs
+	int64_t dedupe_us;
+
+	// Arranging the glyphs in the atlas and allocating its image
+	int64_t pack_us;
+
+	// Decoding each outline again unless that was done up front, and rendering its SDF into the image
+	int64_t render_us;
+
+	// Generating the mapper ranges and indices
+	int64_t index_us;
+
+	// Generating the mip chain
+	int64_t mip_us;
+
+	// BC4-encoding all mip levels
+	int64_t bc4_us;
+
+	// Building the table used by glyph_atlas::operator()
+	int64_t lookup_us;
+
+	// All of glyph_atlas::create, from opening the font to the finished lookup table
+	int64_t total_us;
+
+	// Distinct codepoints requested
+	uint32_t codept_cnt;
+
+	// Distinct glyphs with an outline
+	uint32_t glyph_cnt;
+
+	// Glyphs actually rendered, after merging those with identical SDFs
+	uint32_t rendered_glyph_cnt;
+
+	// Size of the image with all its mip levels, plus its BC4 encoding
+	uint32_t image_bytes;
+
+	// Largest total size of the buffers held by the build at once, from the codepoint list up to the finished lookup table.
+	// Per-thread rendering scratch is not included.
+	uint64_t peak_alloc_bytes;
+};
+
+struct glyph_atlas_build_options
+{
+	// Number of threads rendering glyph SDFs. 0 uses one thread per logical processor, 1 renders everything on the calling thread.
+	uint32_t worker_thread_cnt = 1;
+
+	// Widest SIMD instruction set the SDF kernels may use. The actual choice is further limited by what the executing CPU supports.
+	sdf_kernel_isa max_kernel_isa = sdf_kernel_isa::avx;
+
+	// Method used to find the closest point on each curve. See sdf_kernels.h for the accuracy of each.
+	sdf_solver solver = sdf_solver::analytic;
+
+	// Fills 8x8 pixel blocks that no curve's bounding box comes within sdf_clamp of with a constant, without evaluating per-pixel distances.
+	// Does not change the output.
+	bool skip_saturated_blocks = true;
+
+	// Algorithm arranging the glyphs in the atlas. See glyph_packer.h.
+	glyph_packer packer = glyph_packer::max_rects;
+
+	// Height of each page of the atlas. Glyphs that do not fit onto one page spill over onto further pages of the same size.
+	// 0 puts all glyphs onto a single page that is just tall enough to hold them.
+	uint32_t page_height = 0;
+
+	// Additionally encodes the image as BC4, see bc4_codec.h. The encoding is kept alongside the uncompressed image and stored in glfatl files.
+	// Only available for single-channel atlases.
+	bool bc4_compress = false;
+
+	// multi_channel atlases store three bytes (r, g, b) per pixel. Their channels are evaluated one pixel at a time, ignoring max_kernel_isa and solver.
+	glyph_sdf_mode sdf_mode = glyph_sdf_mode::single_channel;
+
+	// Number of mip levels to generate, including the full-size image. Each level is downsampled from the previous one with a box filter.
+	// Limited to as many levels as keep at least one pixel of glyph_padding_pixels around each glyph, as coarser levels would blend neighbouring glyphs.
+	// 0 generates as many levels as that allows, up to glyph_atlas::MAX_MIP_LEVEL_CNT. Width and height are rounded up to a multiple of 2^(levels - 1), so glyph positions stay exact.
+	uint32_t mip_level_cnt = 1;
+
+	// Renders single-channel atlases with a compute shader instead of on the CPU, see sdf_gpu.h. Ignored for multi-channel atlases.
+	// The shader always uses the analytic solver, regardless of solver and max_kernel_isa. If rendering on the GPU fails, the CPU is used instead.
+	sdf_gpu_renderer* gpu_renderer = nullptr;
+
+	// Receives the time spent in each stage if create succeeds. The stages are timed regardless, as that only costs a few timer reads.
+	glyph_atlas_build_stats* stats = nullptr;
+};
 
 struct glyph_atlas
 {
 public:
 
+	static constexpr uint32_t MAX_MIP_LEVEL_CNT = 16;
+
 	struct codept_range
 	{
 		uint32_t beg;
@@ -17,6 +141,16 @@ public:
 		uint32_t end;
 	};
 
+	// Arguments to create that differ between the atlases built by create_multi_size
+	struct size_params
+	{
+		uint32_t glyph_size;
+
+		uint32_t glyph_padding_pixels;
+
+		float sdf_clamp;
+	};
+
 	struct glyph_index
 	{
 		och::vec2 atlas_position;
@@ -28,6 +162,9 @@ public:
 		och::vec2 real_bearing;
 
 		float real_advance;
+
+		// Page of the atlas holding the glyph. atlas_position is relative to this page.
+		uint32_t atlas_page;
 	};
 
 private:
@@ -43,52 +180,285 @@ private:
 
 	uint32_t m_height = 0;
 
+	uint32_t m_page_cnt = 0;
+
+	uint32_t m_channel_cnt = 0;
+
+	uint32_t m_mip_level_cnt = 0;
+
 	uint32_t m_glyph_scale = 0;
 
 	float m_line_height = 0.0F;
 
+	float m_packing_efficiency = 0.0F;
+
+	uint64_t m_source_hash = 0;
+
+	// Only allocated for atlases built by create. Loaded atlases use m_cache_file instead.
 	heap_buffer<uint8_t> m_image;
 
 	heap_buffer<mapper_range> m_map_ranges;
 
 	heap_buffer<glyph_index> m_map_indices;
 
+	heap_buffer<uint8_t> m_bc4_image;
+
+	// Mapping of the glfatl file a loaded atlas points into. Stays open until destroy.
+	och::mapped_file<const uint8_t> m_cache_file;
+
+	// Point either into the buffers above or into m_cache_file
+	const uint8_t* m_image_data = nullptr;
+
+	const uint8_t* m_bc4_data = nullptr;
+
+	och::range<const mapper_range> m_map_ranges_view{ nullptr, nullptr };
+
+	och::range<const glyph_index> m_map_indices_view{ nullptr, nullptr };
+
+	// Direct-mapped index into m_map_indices_view for every codepoint, built from the mapper ranges after create and load_glfatl.
+	// Codepoints are split into planes of 256 pages of 256 codepoints each. m_lookup_planes holds the block of m_lookup_directory listing
+	// each plane's pages, and m_lookup_directory the page of m_lookup_pages for each page of codepoints.
+	// Only populated planes and pages are stored. Block 0 and page 0 stand in for all others, mapping to the missing-character glyph.
+	static constexpr uint32_t LOOKUP_PLANE_CNT = 17;
+
+	uint16_t m_lookup_planes[LOOKUP_PLANE_CNT]{};
+
+	heap_buffer<uint16_t> m_lookup_directory;
+
+	heap_buffer<uint32_t> m_lookup_pages;
+
+	void build_lookup_table() noexcept;
+
+	// Everything of create past mapping the codepoints to glyphs, which create_multi_size shares between all sizes.
+	// Adds the time taken by each stage to stats.
+	och::status create_from_source(const glyph_atlas_source& source, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges, const glyph_atlas_build_options& options, glyph_atlas_build_stats& stats) noexcept;
+
+	uint32_t lookup_index(uint32_t codepoint) const noexcept
+	{
+		if (codepoint >= LOOKUP_PLANE_CNT << 16)
+			return 0;
+
+		const uint32_t page = m_lookup_directory.data()[(m_lookup_planes[codepoint >> 16] << 8) | ((codepoint >> 8) & 0xFF)];
+
+		return m_lookup_pages.data()[(page << 8) | (codepoint & 0xFF)];
+	}
+
 public:
 
 	// TODO: 
 	// Calculate advance to save in m_map_indices
-	// Implement mapping equivalent glyphs to a single spot in the image.
-	och::status create(const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges) noexcept;
+	och::status create(const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges, const glyph_atlas_build_options& options = {}) noexcept;
+
+	// Creates one atlas per entry of sizes in out_atlases, each identical to the one create would build with that entry's arguments.
+	// The font is only opened, its codepoints mapped and each outline decoded once, instead of once per atlas (twice, counting the render stage).
+	// The sizes are built one after the other, each spreading its glyphs over options.worker_thread_cnt threads as create does.
+	// If options.stats is set, it must have room for one entry per size. Opening, mapping and decoding are only reported in the first one.
+	// If any atlas fails, all of out_atlases are destroyed.
+	static och::status create_multi_size(const char* truetype_filename, const och::range<size_params> sizes, uint32_t map_width, const och::range<codept_range> codept_ranges, glyph_atlas* out_atlases, const glyph_atlas_build_options& options = {}) noexcept;
 
 	void destroy() noexcept;
 
 	och::status save_glfatl(const char* filename, bool overwrite_existing_file = false) const noexcept;
 
+	// Maps filename and points the atlas directly at the mapped image and index data instead of copying them.
+	// Fails for files not written by save_glfatl of this version. Does not check whether the file is still up to date, see create_cached.
 	och::status load_glfatl(const char* filename) noexcept;
 
+	// Loads cache_filename if it was saved from an atlas created from the same font file with the same arguments.
+	// Otherwise, as well as if it does not exist, creates the atlas and overwrites cache_filename with it.
+	och::status create_cached(const char* cache_filename, const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t map_width, const och::range<codept_range> codept_ranges, const glyph_atlas_build_options& options = {}) noexcept;
+
 	och::status save_bmp(const char* filename, bool overwrite_existing_file = false) const noexcept;
 
 	float line_height() const noexcept;
 
 	uint32_t width() const noexcept;
 
+	// Height of a single page
 	uint32_t height() const noexcept;
 
+	uint32_t page_cnt() const noexcept;
+
+	// Bytes per pixel. 1 for single-channel atlases and 3 for multi-channel ones.
+	uint32_t channel_cnt() const noexcept;
+
 	uint32_t glyph_scale() const noexcept;
 
-	uint8_t* data() noexcept;
+	// Fraction of the atlas' area covered by glyphs, as opposed to padding and unused space. 0 for atlases loaded with load_glfatl.
+	float packing_efficiency() const noexcept;
+
+	// Hash of the font file's contents and of those arguments to create that affect the atlas. Stored in glfatl files to detect stale caches.
+	uint64_t source_hash() const noexcept;
+
+	// Number of mip levels, including the full-size image
+	uint32_t mip_level_cnt() const noexcept;
 
+	// max(width() >> level, 1)
+	uint32_t mip_width(uint32_t level) const noexcept;
+
+	// max(height() >> level, 1)
+	uint32_t mip_height(uint32_t level) const noexcept;
+
+	// The pages are stored one after the other, each as width() x height() pixels of channel_cnt() bytes.
+	// Further mip levels follow in the same layout, see mip_offset.
+	// Read-only, as the image of a loaded atlas is mapped directly from its file.
 	const uint8_t* raw_data() const noexcept;
 
-	image_view<uint8_t> view() noexcept;
+	// Offset of the given mip level's first page from raw_data(). mip_offset(mip_level_cnt()) is the size of the whole image.
+	uint32_t mip_offset(uint32_t level) const noexcept;
 
+	// Only meaningful for single-channel atlases
 	image_view<const uint8_t> view() const noexcept;
 
+	// BC4 encoding of the image, with the pages stored one after the other. nullptr unless the atlas was created with bc4_compress set.
+	// Further mip levels follow in the same layout, see bc4_mip_offset.
+	const uint8_t* bc4_data() const noexcept;
+
+	// Size of the data returned by bc4_data, for all pages and mip levels together. 0 if there is none.
+	uint32_t bc4_bytes() const noexcept;
+
+	// Offset of the given mip level's first page from bc4_data()
+	uint32_t bc4_mip_offset(uint32_t level) const noexcept;
+
+	// Codepoints not in the atlas map to the missing-character glyph
 	glyph_index operator()(uint32_t codepoint) const noexcept;
 
+	// Looks up cnt codepoints at once, writing the same indices operator() returns for them to out
+	void lookup(const char32_t* codepoints, size_t cnt, glyph_index* out) const noexcept;
+
 	och::range<const uint8_t> get_mapper_ranges() const noexcept;
 
 	och::range<const uint8_t> get_mapper_indices() const noexcept;
 
 	~glyph_atlas() noexcept;
 };
+
+// Atlas of fixed size that glyphs are added to the first time they are looked up, instead of all being rendered in advance.
+// The glyph is placed immediately, so its index is returned right away. Its SDF is then rendered on a background thread.
+// Finished glyphs are reported by collect_dirty_rects, so only those parts of the image need to be uploaded.
+// Except for the background thread, all member functions must be called from the same thread.
+struct dynamic_glyph_atlas
+{
+public:
+
+	struct dirty_rect
+	{
+		uint32_t x;
+
+		uint32_t y;
+
+		uint32_t w;
+
+		uint32_t h;
+	};
+
+private:
+
+	// Number of glyphs that can be waiting for rendering or for collection at once
+	static constexpr uint32_t MAX_PENDING_GLYPHS = 256;
+
+	struct render_request
+	{
+		uint32_t glyph_id;
+
+		// Position in the atlas, including padding
+		uint32_t x;
+		uint32_t y;
+
+		// Rendered part of the glyph's SDF cell
+		uint32_t cell_x;
+		uint32_t cell_y;
+		uint32_t w;
+		uint32_t h;
+	};
+
+	truetype_file m_file;
+
+	uint32_t m_width = 0;
+
+	uint32_t m_height = 0;
+
+	uint32_t m_glyph_scale = 0;
+
+	uint32_t m_glyph_padding_pixels = 0;
+
+	uint32_t m_padded_glyph_size = 0;
+
+	float m_cell_scale = 0.0F;
+
+	float m_sdf_clamp = 0.0F;
+
+	float m_line_height = 0.0F;
+
+	sdf_row_kernel_fn m_kernel = nullptr;
+
+	bool m_skip_saturated_blocks = true;
+
+	incremental_glyph_packer m_packer;
+
+	heap_buffer<uint8_t> m_image;
+
+	// Per glyph id, 0 if the glyph has not been looked up yet, otherwise one more than its position in m_indices
+	heap_buffer<uint32_t> m_glyph_slots;
+
+	simple_vec<glyph_atlas::glyph_index> m_indices{ 0 };
+
+	// Reused for measuring each newly looked up glyph
+	sdf_curve_table m_curves;
+
+	glyph_scratch_arena m_scratch;
+
+	// Glyphs that have been placed but not yet collected by collect_dirty_rects
+	uint32_t m_pending_cnt = 0;
+
+	uint32_t m_finished_tail = 0;
+
+	std::atomic<uint32_t> m_request_head{ 0 };
+
+	std::atomic<uint32_t> m_finished_head{ 0 };
+
+	std::atomic<bool> m_is_stopping{ false };
+
+	render_request m_requests[MAX_PENDING_GLYPHS];
+
+	dirty_rect m_finished[MAX_PENDING_GLYPHS];
+
+	// Glyphs placed while MAX_PENDING_GLYPHS were pending. collect_dirty_rects submits them as pending glyphs are collected.
+	simple_vec<render_request> m_overflow_requests{ 0 };
+
+	uint32_t m_overflow_tail = 0;
+
+	void* m_worker_thread = nullptr;
+
+	void* m_worker_wake_event = nullptr; // Signaled when a glyph is requested or the worker should exit
+
+	static unsigned long worker_thread_fn(void* data) noexcept;
+
+	void submit_request(const render_request& request) noexcept;
+
+public:
+
+	// The image is width x height pixels and zeroed initially. Glyphs that no longer fit are mapped to an empty quad keeping their advance.
+	// Of options, only max_kernel_isa, solver and skip_saturated_blocks are used, so the atlas is always single-channel. Rendering always happens on a single background thread.
+	och::status create(const char* truetype_filename, uint32_t glyph_size, uint32_t glyph_padding_pixels, float sdf_clamp, uint32_t width, uint32_t height, const glyph_atlas_build_options& options = {}) noexcept;
+
+	void destroy() noexcept;
+
+	// Looks up codepoint, placing its glyph and queueing it for rendering if it has not been looked up before.
+	// If too many glyphs are still pending, the glyph is held back and only queued once collect_dirty_rects has collected some of them.
+	glyph_atlas::glyph_index operator()(uint32_t codepoint) noexcept;
+
+	// Writes the rectangles of up to max_rect_cnt glyphs that finished rendering since the last call to out_rects, and returns their number.
+	// Only pixels inside returned rectangles are safe to read from raw_data, as the background thread may still be writing elsewhere.
+	uint32_t collect_dirty_rects(dirty_rect* out_rects, uint32_t max_rect_cnt) noexcept;
+
+	float line_height() const noexcept;
+
+	uint32_t width() const noexcept;
+
+	uint32_t height() const noexcept;
+
+	const uint8_t* raw_data() const noexcept;
+
+	~dynamic_glyph_atlas() noexcept;
+};
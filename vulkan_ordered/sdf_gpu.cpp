@@ -0,0 +1,348 @@
+#include "sdf_gpu.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "directory_constants.h"
+
+#include "och_err.h"
+
+// Dispatches are split so no single one exceeds the smallest maxComputeWorkGroupCount[0] the spec allows
+static constexpr uint32_t MAX_DISPATCH_TILE_CNT = 65535;
+
+// Host-visible buffers holding the inputs and output of one call to sdf_gpu_renderer::render
+struct sdf_gpu_buffers
+{
+	VkBuffer image_buffer{};
+	VkBuffer curve_buffer{};
+	VkBuffer tile_buffer{};
+
+	VkDeviceMemory image_memory{};
+	VkDeviceMemory curve_memory{};
+	VkDeviceMemory tile_memory{};
+
+	och::status create(const vulkan_context& context, VkDeviceSize image_bytes, const sdf_gpu_curve* curves, uint32_t curve_cnt, const sdf_gpu_tile* tiles, uint32_t tile_cnt) noexcept
+	{
+		constexpr VkMemoryPropertyFlags host_memory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+		check(context.create_buffer(image_buffer, image_memory, image_bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, host_memory));
+
+		check(context.create_buffer(curve_buffer, curve_memory, curve_cnt * sizeof(sdf_gpu_curve), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_memory));
+
+		check(context.create_buffer(tile_buffer, tile_memory, tile_cnt * sizeof(sdf_gpu_tile), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_memory));
+
+		void* curve_data;
+
+		check(vkMapMemory(context.m_device, curve_memory, 0, curve_cnt * sizeof(sdf_gpu_curve), 0, &curve_data));
+
+		memcpy(curve_data, curves, curve_cnt * sizeof(sdf_gpu_curve));
+
+		vkUnmapMemory(context.m_device, curve_memory);
+
+		void* tile_data;
+
+		check(vkMapMemory(context.m_device, tile_memory, 0, tile_cnt * sizeof(sdf_gpu_tile), 0, &tile_data));
+
+		memcpy(tile_data, tiles, tile_cnt * sizeof(sdf_gpu_tile));
+
+		vkUnmapMemory(context.m_device, tile_memory);
+
+		return {};
+	}
+
+	void destroy(const vulkan_context& context) const noexcept
+	{
+		vkDestroyBuffer(context.m_device, image_buffer, nullptr);
+
+		vkDestroyBuffer(context.m_device, curve_buffer, nullptr);
+
+		vkDestroyBuffer(context.m_device, tile_buffer, nullptr);
+
+		vkFreeMemory(context.m_device, image_memory, nullptr);
+
+		vkFreeMemory(context.m_device, curve_memory, nullptr);
+
+		vkFreeMemory(context.m_device, tile_memory, nullptr);
+	}
+};
+
+och::status sdf_gpu_renderer::create(const vulkan_context& context) noexcept
+{
+	m_context = &context;
+
+	// Create Compute Pipeline
+	{
+		VkDescriptorSetLayoutBinding bindings[3]{};
+		// Image
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[0].pImmutableSamplers = nullptr;
+		// Curves
+		bindings[1].binding = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[1].descriptorCount = 1;
+		bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[1].pImmutableSamplers = nullptr;
+		// Tiles
+		bindings[2].binding = 2;
+		bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[2].descriptorCount = 1;
+		bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[2].pImmutableSamplers = nullptr;
+
+		VkDescriptorSetLayoutCreateInfo descriptor_set_layout_ci{};
+		descriptor_set_layout_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptor_set_layout_ci.pNext = nullptr;
+		descriptor_set_layout_ci.flags = 0;
+		descriptor_set_layout_ci.bindingCount = 3;
+		descriptor_set_layout_ci.pBindings = bindings;
+
+		check(vkCreateDescriptorSetLayout(context.m_device, &descriptor_set_layout_ci, nullptr, &m_descriptor_set_layout));
+
+		VkPushConstantRange push_constant_range{};
+		push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		push_constant_range.offset = 0;
+		push_constant_range.size = sizeof(push_data);
+
+		VkPipelineLayoutCreateInfo pipeline_layout_ci{};
+		pipeline_layout_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_ci.pNext = nullptr;
+		pipeline_layout_ci.flags = 0;
+		pipeline_layout_ci.setLayoutCount = 1;
+		pipeline_layout_ci.pSetLayouts = &m_descriptor_set_layout;
+		pipeline_layout_ci.pushConstantRangeCount = 1;
+		pipeline_layout_ci.pPushConstantRanges = &push_constant_range;
+
+		check(vkCreatePipelineLayout(context.m_device, &pipeline_layout_ci, nullptr, &m_pipeline_layout));
+
+		check(context.load_shader_module_file(m_shader_module, OCH_DIR "shaders/sdf_glyph.comp.spv"));
+
+		struct { uint32_t x, y, z; } group_size{ TILE_SIZE, TILE_SIZE, 1 };
+
+		VkSpecializationMapEntry specialization_entries[3]{};
+		specialization_entries[0].constantID = 1;
+		specialization_entries[0].offset = offsetof(decltype(group_size), x);
+		specialization_entries[0].size = sizeof(group_size.x);
+		specialization_entries[1].constantID = 2;
+		specialization_entries[1].offset = offsetof(decltype(group_size), y);
+		specialization_entries[1].size = sizeof(group_size.y);
+		specialization_entries[2].constantID = 3;
+		specialization_entries[2].offset = offsetof(decltype(group_size), z);
+		specialization_entries[2].size = sizeof(group_size.z);
+
+		VkSpecializationInfo specialization_ci{};
+		specialization_ci.mapEntryCount = 3;
+		specialization_ci.pMapEntries = specialization_entries;
+		specialization_ci.dataSize = sizeof(group_size);
+		specialization_ci.pData = &group_size;
+
+		VkComputePipelineCreateInfo pipeline_ci{};
+		pipeline_ci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_ci.pNext = nullptr;
+		pipeline_ci.flags = 0;
+		pipeline_ci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_ci.stage.pNext = nullptr;
+		pipeline_ci.stage.flags = 0;
+		pipeline_ci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_ci.stage.module = m_shader_module;
+		pipeline_ci.stage.pName = "main";
+		pipeline_ci.stage.pSpecializationInfo = &specialization_ci;
+		pipeline_ci.layout = m_pipeline_layout;
+		pipeline_ci.basePipelineHandle = nullptr;
+		pipeline_ci.basePipelineIndex = -1;
+
+		check(vkCreateComputePipelines(context.m_device, nullptr, 1, &pipeline_ci, nullptr, &m_pipeline));
+	}
+
+	// Create Descriptor Set. Its buffers are only bound by render, as they are sized to each call's input.
+	{
+		VkDescriptorPoolSize pool_size{};
+		pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		pool_size.descriptorCount = 3;
+
+		VkDescriptorPoolCreateInfo descriptor_pool_ci{};
+		descriptor_pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		descriptor_pool_ci.pNext = nullptr;
+		descriptor_pool_ci.flags = 0;
+		descriptor_pool_ci.maxSets = 1;
+		descriptor_pool_ci.poolSizeCount = 1;
+		descriptor_pool_ci.pPoolSizes = &pool_size;
+
+		check(vkCreateDescriptorPool(context.m_device, &descriptor_pool_ci, nullptr, &m_descriptor_pool));
+
+		VkDescriptorSetAllocateInfo descriptor_set_ai{};
+		descriptor_set_ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		descriptor_set_ai.pNext = nullptr;
+		descriptor_set_ai.descriptorPool = m_descriptor_pool;
+		descriptor_set_ai.descriptorSetCount = 1;
+		descriptor_set_ai.pSetLayouts = &m_descriptor_set_layout;
+
+		check(vkAllocateDescriptorSets(context.m_device, &descriptor_set_ai, &m_descriptor_set));
+	}
+
+	// Create Command Pool
+	{
+		VkCommandPoolCreateInfo command_pool_ci{};
+		command_pool_ci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		command_pool_ci.pNext = nullptr;
+		command_pool_ci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		command_pool_ci.queueFamilyIndex = context.m_general_queues.family_index;
+
+		check(vkCreateCommandPool(context.m_device, &command_pool_ci, nullptr, &m_command_pool));
+	}
+
+	return {};
+}
+
+void sdf_gpu_renderer::destroy() noexcept
+{
+	if (m_context == nullptr)
+		return;
+
+	const VkDevice device = m_context->m_device;
+
+	vkDestroyCommandPool(device, m_command_pool, nullptr);
+
+	vkDestroyDescriptorPool(device, m_descriptor_pool, nullptr);
+
+	vkDestroyPipeline(device, m_pipeline, nullptr);
+
+	vkDestroyShaderModule(device, m_shader_module, nullptr);
+
+	vkDestroyPipelineLayout(device, m_pipeline_layout, nullptr);
+
+	vkDestroyDescriptorSetLayout(device, m_descriptor_set_layout, nullptr);
+
+	*this = {};
+}
+
+och::status sdf_gpu_renderer::record_and_submit(VkBuffer image_buffer, VkDeviceSize image_buffer_bytes, uint32_t tile_cnt, push_data push) noexcept
+{
+	VkCommandBuffer command_buffer;
+
+	check(m_context->begin_onetime_command(command_buffer, m_command_pool));
+
+	// Glyphs are merged into the image with atomicOr, so it has to start out zeroed
+
+	vkCmdFillBuffer(command_buffer, image_buffer, 0, image_buffer_bytes, 0);
+
+	VkBufferMemoryBarrier fill_barrier{};
+	fill_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	fill_barrier.pNext = nullptr;
+	fill_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	fill_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	fill_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	fill_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	fill_barrier.buffer = image_buffer;
+	fill_barrier.offset = 0;
+	fill_barrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &fill_barrier, 0, nullptr);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &m_descriptor_set, 0, nullptr);
+
+	for (uint32_t tile_offset = 0; tile_offset < tile_cnt; tile_offset += MAX_DISPATCH_TILE_CNT)
+	{
+		push.tile_offset = tile_offset;
+
+		vkCmdPushConstants(command_buffer, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+		vkCmdDispatch(command_buffer, tile_cnt - tile_offset < MAX_DISPATCH_TILE_CNT ? tile_cnt - tile_offset : MAX_DISPATCH_TILE_CNT, 1, 1);
+	}
+
+	VkBufferMemoryBarrier readback_barrier = fill_barrier;
+	readback_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	readback_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &readback_barrier, 0, nullptr);
+
+	check(m_context->submit_onetime_command(command_buffer, m_command_pool, m_context->m_general_queues[0]));
+
+	return {};
+}
+
+och::status sdf_gpu_renderer::render(const sdf_gpu_curve* curves, uint32_t curve_cnt, const sdf_gpu_tile* tiles, uint32_t tile_cnt, float img_step, float sdf_clamp, uint8_t* image, uint32_t image_width, uint32_t image_height) noexcept
+{
+	const uint32_t image_bytes = image_width * image_height;
+
+	if (tile_cnt == 0)
+	{
+		memset(image, 0, image_bytes);
+
+		++m_render_cnt;
+
+		return {};
+	}
+
+	// The shader writes whole 32-bit words
+	const VkDeviceSize image_buffer_bytes = (image_bytes + 3) & ~3u;
+
+	sdf_gpu_buffers buffers;
+
+	och::status err = buffers.create(*m_context, image_buffer_bytes, curves, curve_cnt, tiles, tile_cnt);
+
+	if (!err)
+	{
+		VkDescriptorBufferInfo buffer_infos[3]{};
+		buffer_infos[0].buffer = buffers.image_buffer;
+		buffer_infos[0].offset = 0;
+		buffer_infos[0].range = VK_WHOLE_SIZE;
+		buffer_infos[1].buffer = buffers.curve_buffer;
+		buffer_infos[1].offset = 0;
+		buffer_infos[1].range = VK_WHOLE_SIZE;
+		buffer_infos[2].buffer = buffers.tile_buffer;
+		buffer_infos[2].offset = 0;
+		buffer_infos[2].range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet writes[3]{};
+
+		for (uint32_t i = 0; i != 3; ++i)
+		{
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].pNext = nullptr;
+			writes[i].dstSet = m_descriptor_set;
+			writes[i].dstBinding = i;
+			writes[i].dstArrayElement = 0;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].pImageInfo = nullptr;
+			writes[i].pBufferInfo = buffer_infos + i;
+			writes[i].pTexelBufferView = nullptr;
+		}
+
+		vkUpdateDescriptorSets(m_context->m_device, 3, writes, 0, nullptr);
+
+		err = record_and_submit(buffers.image_buffer, image_buffer_bytes, tile_cnt, { 0, image_width, img_step, sdf_clamp });
+	}
+
+	if (!err)
+	{
+		void* image_data;
+
+		err = to_status(vkMapMemory(m_context->m_device, buffers.image_memory, 0, image_buffer_bytes, 0, &image_data));
+
+		if (!err)
+		{
+			memcpy(image, image_data, image_bytes);
+
+			vkUnmapMemory(m_context->m_device, buffers.image_memory);
+		}
+	}
+
+	buffers.destroy(*m_context);
+
+	check(err);
+
+	++m_render_cnt;
+
+	return {};
+}
+
+uint32_t sdf_gpu_renderer::render_cnt() const noexcept
+{
+	return m_render_cnt;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+
+#include "och_err.h"
+
+#include "vulkan_base.h"
+
+// Control points of one quadratic bezier, in the cell-relative units of sdf_curve_table.
+// Matches struct Curve in shaders/sdf_glyph.comp.
+struct sdf_gpu_curve
+{
+	float p0_x;
+	float p0_y;
+	float p1_x;
+	float p1_y;
+	float p2_x;
+	float p2_y;
+};
+
+// Block of up to sdf_gpu_renderer::TILE_SIZE x TILE_SIZE pixels of a glyph's SDF cell, rendered by one workgroup.
+// Matches struct Tile in shaders/sdf_glyph.comp.
+struct sdf_gpu_tile
+{
+	// The glyph's outline is curves[curve_beg] to curves[curve_beg + curve_cnt - 1]
+	uint32_t curve_beg;
+	uint32_t curve_cnt;
+
+	// First pixel of the tile, in pixels of the glyph's cell
+	uint32_t x_beg;
+	uint32_t y_beg;
+
+	// End of the rendered part of the cell. Pixels of the tile at or past these are skipped.
+	uint32_t x_end;
+	uint32_t y_end;
+
+	// Pixel (x, y) of the cell is written to (dst_x + x, dst_y - y) of the image, so rows are stored bottom to top as by sdf_from_glyph
+	int32_t dst_x;
+	int32_t dst_y;
+};
+
+// Renders single-channel glyph SDFs with the compute shader shaders/sdf_glyph.comp, one workgroup per tile.
+// Each pixel evaluates every curve of its glyph, along with its winding number, using the same analytic solver and sign rule as the CPU path.
+// The output matches glyph_atlas' CPU rendering with the analytic solver, apart from texels on which float rounding differs between CPU and GPU.
+// Not thread-safe, as all renders share one descriptor set.
+struct sdf_gpu_renderer
+{
+	static constexpr uint32_t TILE_SIZE = 8;
+
+private:
+
+	// Matches Push_data in shaders/sdf_glyph.comp
+	struct push_data
+	{
+		uint32_t tile_offset;
+
+		uint32_t image_width;
+
+		float img_step;
+
+		float sdf_clamp;
+	};
+
+	const vulkan_context* m_context = nullptr;
+
+	VkDescriptorSetLayout m_descriptor_set_layout{};
+
+	VkPipelineLayout m_pipeline_layout{};
+
+	VkShaderModule m_shader_module{};
+
+	VkPipeline m_pipeline{};
+
+	VkDescriptorPool m_descriptor_pool{};
+
+	VkDescriptorSet m_descriptor_set{};
+
+	VkCommandPool m_command_pool{};
+
+	uint32_t m_render_cnt = 0;
+
+	och::status record_and_submit(VkBuffer image_buffer, VkDeviceSize image_buffer_bytes, uint32_t tile_cnt, push_data push) noexcept;
+
+public:
+
+	// Context must outlive the renderer. Its general queue is used for all work.
+	och::status create(const vulkan_context& context) noexcept;
+
+	void destroy() noexcept;
+
+	// Renders tiles into image, which holds image_width x image_height bytes. Pixels not covered by any tile are set to 0.
+	// img_step is the distance between neighbouring pixel centers in curve units, and sdf_clamp the distance mapped to 0 and 255, as in glyph_atlas::create.
+	// Blocks until the image has been read back.
+	och::status render(const sdf_gpu_curve* curves, uint32_t curve_cnt, const sdf_gpu_tile* tiles, uint32_t tile_cnt, float img_step, float sdf_clamp, uint8_t* image, uint32_t image_width, uint32_t image_height) noexcept;
+
+	// Number of successful calls to render. Shows whether glyph_atlas::create actually used the GPU or fell back to the CPU.
+	uint32_t render_cnt() const noexcept;
+};
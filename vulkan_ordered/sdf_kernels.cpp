@@ -0,0 +1,1109 @@
+#include "sdf_kernels.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "och_matmath.h"
+#include "heap_buffer.h"
+#include "truetype.h"
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*///////////////////////////////////////////////// Curve table //////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+static constexpr uint32_t CURVE_TABLE_ARRAY_CNT = 13;
+
+static void push_curve(sdf_curve_table& out, uint32_t i, och::vec2 p0, och::vec2 p1, och::vec2 p2) noexcept
+{
+	const och::vec2 d1 = p1 - p0;
+
+	const och::vec2 d2 = p2 - 2.0F * p1 + p0;
+
+	out.p0_x[i] = p0.x;
+	out.p0_y[i] = p0.y;
+	out.p1_x[i] = p1.x;
+	out.p1_y[i] = p1.y;
+	out.p2_x[i] = p2.x;
+	out.p2_y[i] = p2.y;
+	out.d1_x[i] = d1.x;
+	out.d1_y[i] = d1.y;
+	out.d2_x[i] = d2.x;
+	out.d2_y[i] = d2.y;
+	out.a3[i] = och::dot(d2, d2);
+	out.a2[i] = 3.0F * och::dot(d1, d2);
+	out.a1_base[i] = 2.0F * och::dot(d1, d1);
+}
+
+static void reserve_curve_table(sdf_curve_table& out, uint32_t curve_cnt, uint32_t contour_cnt) noexcept
+{
+	if (out.storage.size() < curve_cnt * CURVE_TABLE_ARRAY_CNT)
+	{
+		out.storage.allocate(curve_cnt * CURVE_TABLE_ARRAY_CNT);
+
+		float* const base = out.storage.data();
+
+		const uint32_t capacity = curve_cnt;
+
+		out.p0_x = base;
+		out.p0_y = base + capacity;
+		out.p1_x = base + capacity * 2;
+		out.p1_y = base + capacity * 3;
+		out.p2_x = base + capacity * 4;
+		out.p2_y = base + capacity * 5;
+		out.d1_x = base + capacity * 6;
+		out.d1_y = base + capacity * 7;
+		out.d2_x = base + capacity * 8;
+		out.d2_y = base + capacity * 9;
+		out.a3 = base + capacity * 10;
+		out.a2 = base + capacity * 11;
+		out.a1_base = base + capacity * 12;
+
+		out.crossing_storage.allocate(curve_cnt * 2);
+
+		out.crossings = out.crossing_storage.data();
+	}
+
+	if (out.contour_ends.size() < contour_cnt)
+		out.contour_ends.allocate(contour_cnt);
+}
+
+void sdf_build_curve_table(const glyph_data& glyph, float glyph_scale, sdf_curve_table& out) noexcept
+{
+	const float glf_offset = (1.0F - glyph_scale) * 0.5F;
+
+	uint32_t curve_cnt = 0;
+
+	for (uint32_t i = 0; i != glyph.contour_cnt(); ++i)
+	{
+		const uint32_t contour_point_cnt = glyph.contour_end_index(i) - glyph.contour_beg_index(i);
+
+		if (contour_point_cnt >= 2)
+			curve_cnt += (contour_point_cnt + 1) / 2;
+	}
+
+	reserve_curve_table(out, curve_cnt, glyph.contour_cnt());
+
+	uint32_t curr = 0;
+
+	uint32_t contour_cnt = 0;
+
+	for (uint32_t i = 0; i != glyph.contour_cnt(); ++i)
+	{
+		const uint32_t beg = glyph.contour_beg_index(i), end = glyph.contour_end_index(i);
+
+		if (end - beg < 2)
+			continue;
+
+		for (uint32_t j = beg; j + 2 < end; j += 2)
+		{
+			const och::vec2 p0_u = glyph[j];
+			const och::vec2 p1_u = glyph[j + 1];
+			const och::vec2 p2_u = glyph[j + 2];
+
+			push_curve(out, curr++,
+				{ p0_u.x * glyph_scale + glf_offset, p0_u.y * glyph_scale + glf_offset },
+				{ p1_u.x * glyph_scale + glf_offset, p1_u.y * glyph_scale + glf_offset },
+				{ p2_u.x * glyph_scale + glf_offset, p2_u.y * glyph_scale + glf_offset });
+		}
+
+		const och::vec2 p0_u = glyph[end - 2];
+		const och::vec2 p1_u = glyph[end - 1];
+		const och::vec2 p2_u = glyph[beg];
+
+		push_curve(out, curr++,
+			{ p0_u.x * glyph_scale + glf_offset, p0_u.y * glyph_scale + glf_offset },
+			{ p1_u.x * glyph_scale + glf_offset, p1_u.y * glyph_scale + glf_offset },
+			{ p2_u.x * glyph_scale + glf_offset, p2_u.y * glyph_scale + glf_offset });
+
+		out.contour_ends[contour_cnt++] = curr;
+	}
+
+	out.curve_cnt = curr;
+
+	out.contour_cnt = contour_cnt;
+}
+
+void sdf_build_curve_table(const sdf_outline& outline, float glyph_scale, sdf_curve_table& out) noexcept
+{
+	const float glf_offset = (1.0F - glyph_scale) * 0.5F;
+
+	reserve_curve_table(out, outline.curve_cnt, outline.contour_cnt);
+
+	for (uint32_t i = 0; i != outline.curve_cnt; ++i)
+	{
+		const och::vec2 p0_u = outline.points[i * 3];
+		const och::vec2 p1_u = outline.points[i * 3 + 1];
+		const och::vec2 p2_u = outline.points[i * 3 + 2];
+
+		push_curve(out, i,
+			{ p0_u.x * glyph_scale + glf_offset, p0_u.y * glyph_scale + glf_offset },
+			{ p1_u.x * glyph_scale + glf_offset, p1_u.y * glyph_scale + glf_offset },
+			{ p2_u.x * glyph_scale + glf_offset, p2_u.y * glyph_scale + glf_offset });
+	}
+
+	for (uint32_t i = 0; i != outline.contour_cnt; ++i)
+		out.contour_ends[i] = outline.contour_ends[i];
+
+	out.curve_cnt = outline.curve_cnt;
+
+	out.contour_cnt = outline.contour_cnt;
+}
+
+uint32_t sdf_flatten_outline(const glyph_data& glyph, simple_vec<och::vec2>& out_points, simple_vec<uint32_t>& out_contour_ends) noexcept
+{
+	// Same curves as sdf_build_curve_table, left unscaled
+
+	uint32_t curve_cnt = 0;
+
+	for (uint32_t i = 0; i != glyph.contour_cnt(); ++i)
+	{
+		const uint32_t beg = glyph.contour_beg_index(i), end = glyph.contour_end_index(i);
+
+		if (end - beg < 2)
+			continue;
+
+		for (uint32_t j = beg; j + 2 < end; j += 2)
+		{
+			out_points.add(glyph[j]);
+			out_points.add(glyph[j + 1]);
+			out_points.add(glyph[j + 2]);
+
+			++curve_cnt;
+		}
+
+		out_points.add(glyph[end - 2]);
+		out_points.add(glyph[end - 1]);
+		out_points.add(glyph[beg]);
+
+		++curve_cnt;
+
+		out_contour_ends.add(curve_cnt);
+	}
+
+	return curve_cnt;
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*/////////////////////////////////////////////////// Scalar /////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+static void cubic_poly_roots(float a3, float a2, float a1, float a0, float& r0, float& r1, float& r2) noexcept
+{
+	constexpr float TOO_SMALL = 1e-7F;
+
+	constexpr float PI = 3.14159265359F;
+
+	a2 /= a3;
+
+	a1 /= a3;
+
+	a0 /= a3;
+
+	const float q = (3.0F * a1 - (a2 * a2)) / 9.0F;
+
+	const float r = (-27.0F * a0 + a2 * (9.0F * a1 - 2.0F * a2 * a2)) / 54.0F;
+
+	const float disc = q * q * q + r * r;
+
+	const float term_1 = -a2 / 3.0F;
+
+	if (disc > TOO_SMALL)
+	{
+		const float disc_sqrt = sqrtf(disc);
+
+		float s = r + disc_sqrt;
+
+		s = s < 0.0F ? -cbrtf(-s) : cbrtf(s);
+
+		float t = r - disc_sqrt;
+
+		t = t < 0.0F ? -cbrtf(-t) : cbrtf(t);
+
+		r0 = term_1 + s + t;
+
+		r1 = INFINITY;
+
+		r2 = INFINITY;
+	}
+	else if (disc < -TOO_SMALL)
+	{
+		const float dummy = acosf(r / sqrtf(-q * q * q));
+
+		const float r13 = 2.0F * sqrtf(-q);
+
+		r0 = term_1 + r13 * cosf(dummy / 3.0F);
+
+		r1 = term_1 + r13 * cosf((dummy + 2.0F * PI) / 3.0F);
+
+		r2 = term_1 + r13 * cosf((dummy + 4.0F * PI) / 3.0F);
+	}
+	else
+	{
+		const float r13 = r < 0.0F ? -cbrtf(-r) : cbrtf(r);
+
+		r0 = term_1 + 2.0F * r13;
+
+		r1 = term_1 - r13;
+
+		r2 = INFINITY;
+	}
+}
+
+static och::vec2 bezier_interp(och::vec2 p0, och::vec2 p1, och::vec2 p2, float t) noexcept
+{
+	return (1.0F - t) * (1.0F - t) * p0 + 2.0F * (1.0F - t) * t * p1 + t * t * p2;
+}
+
+static float check_roots(float r0, float r1, float r2, och::vec2 p0, och::vec2 p1, och::vec2 p2, och::vec2 p) noexcept
+{
+	float min_dst_sq = fminf(och::squared_magnitude(p - p0), och::squared_magnitude(p - p2));
+
+	if (r0 > 0.0F && r0 < 1.0F)
+		min_dst_sq = fminf(min_dst_sq, och::squared_magnitude(p - bezier_interp(p0, p1, p2, r0)));
+
+	if (r1 > 0.0F && r1 < 1.0F)
+		min_dst_sq = fminf(min_dst_sq, och::squared_magnitude(p - bezier_interp(p0, p1, p2, r1)));
+
+	if (r2 > 0.0F && r2 < 1.0F)
+		min_dst_sq = fminf(min_dst_sq, och::squared_magnitude(p - bezier_interp(p0, p1, p2, r2)));
+
+	return min_dst_sq;
+}
+
+struct curve_coefficients
+{
+	och::vec2 p0;
+
+	och::vec2 p1;
+
+	och::vec2 p2;
+
+	och::vec2 d1;
+
+	och::vec2 d2;
+
+	float a3;
+
+	float a2;
+
+	float a1_base;
+};
+
+static curve_coefficients load_curve(const sdf_curve_table& curves, uint32_t i) noexcept
+{
+	return {
+		{ curves.p0_x[i], curves.p0_y[i] },
+		{ curves.p1_x[i], curves.p1_y[i] },
+		{ curves.p2_x[i], curves.p2_y[i] },
+		{ curves.d1_x[i], curves.d1_y[i] },
+		{ curves.d2_x[i], curves.d2_y[i] },
+		curves.a3[i],
+		curves.a2[i],
+		curves.a1_base[i],
+	};
+}
+
+static float curve_dst_sq(const curve_coefficients& c, och::vec2 p) noexcept
+{
+	const och::vec2 p0 = c.p0, p1 = c.p1, p2 = c.p2;
+
+	const och::vec2 dp = p - p0;
+
+	if (fabs(c.a3) > 1e-7F)
+	{
+		const float a1 = c.a1_base - och::dot(c.d2, dp);
+
+		const float a0 = -och::dot(c.d1, dp);
+
+		float r0, r1, r2;
+
+		cubic_poly_roots(c.a3, c.a2, a1, a0, r0, r1, r2);
+
+		return check_roots(r0, r1, r2, p0, p1, p2, p);
+	}
+	else
+	{
+		float t = och::dot(dp, p2 - p0) / och::dot(p2 - p0, p2 - p0);
+
+		if (t > 1.0F)
+			t = 1.0F;
+		else if (t < 0.0F)
+			t = 0.0F;
+
+		return och::squared_magnitude(p - (p0 * (1.0F - t) + p2 * t));
+	}
+}
+
+static constexpr uint32_t ITERATIVE_SOLVER_STEPS = 2;
+
+static float halley_step(float t, float a3, float a2, float a1, float a0) noexcept
+{
+	const float g = ((a3 * t + a2) * t + a1) * t + a0;
+
+	const float g_d1 = (3.0F * a3 * t + 2.0F * a2) * t + a1;
+
+	const float g_d2 = 6.0F * a3 * t + 2.0F * a2;
+
+	const float next_t = t - 2.0F * g * g_d1 / (2.0F * g_d1 * g_d1 - g * g_d2);
+
+	// Written so that the NaN of degenerate curves is mapped to 0
+	return next_t > 1.0F ? 1.0F : next_t > 0.0F ? next_t : 0.0F;
+}
+
+static float curve_dst_sq_iterative(const curve_coefficients& c, och::vec2 p) noexcept
+{
+	const och::vec2 dp = p - c.p0;
+
+	const float a1 = c.a1_base - och::dot(c.d2, dp);
+
+	const float a0 = -och::dot(c.d1, dp);
+
+	// Both starting points are iterated together, since each step depends on the previous one.
+
+	float t_from_beg = 0.0F;
+
+	float t_from_end = 1.0F;
+
+	for (uint32_t i = 0; i != ITERATIVE_SOLVER_STEPS; ++i)
+	{
+		t_from_beg = halley_step(t_from_beg, c.a3, c.a2, a1, a0);
+
+		t_from_end = halley_step(t_from_end, c.a3, c.a2, a1, a0);
+	}
+
+	// p - (p0 + 2t * d1 + t^2 * d2)
+	const float dst_from_beg = och::squared_magnitude(dp - t_from_beg * (2.0F * c.d1 + t_from_beg * c.d2));
+
+	const float dst_from_end = och::squared_magnitude(dp - t_from_end * (2.0F * c.d1 + t_from_end * c.d2));
+
+	return fminf(fminf(och::squared_magnitude(dp), och::squared_magnitude(p - c.p2)), fminf(dst_from_beg, dst_from_end));
+}
+
+static void row_kernel_scalar_iterative(const sdf_curve_table& curves, uint32_t curve_idx, float y, float x_step, uint32_t x_beg, uint32_t pixel_cnt, sdf_row_state state) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	for (uint32_t x = x_beg; x != x_beg + pixel_cnt; ++x)
+	{
+		const och::vec2 p(x_step * static_cast<float>(x), y);
+
+		state.min_dst_sq[x] = fminf(state.min_dst_sq[x], curve_dst_sq_iterative(c, p));
+	}
+}
+
+static void row_kernel_scalar(const sdf_curve_table& curves, uint32_t curve_idx, float y, float x_step, uint32_t x_beg, uint32_t pixel_cnt, sdf_row_state state) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	for (uint32_t x = x_beg; x != x_beg + pixel_cnt; ++x)
+	{
+		const och::vec2 p(x_step * static_cast<float>(x), y);
+
+		state.min_dst_sq[x] = fminf(state.min_dst_sq[x], curve_dst_sq(c, p));
+	}
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*//////////////////////////////////////////////// Multi-channel /////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+sdf_closest_point sdf_curve_closest_point(const sdf_curve_table& curves, uint32_t curve_idx, och::vec2 p) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	const och::vec2 dp = p - c.p0;
+
+	sdf_closest_point closest{ 0.0F, och::squared_magnitude(dp) };
+
+	const float end_dst_sq = och::squared_magnitude(p - c.p2);
+
+	if (end_dst_sq < closest.dst_sq)
+		closest = { 1.0F, end_dst_sq };
+
+	float roots[3]{ INFINITY, INFINITY, INFINITY };
+
+	if (fabs(c.a3) > 1e-7F)
+		cubic_poly_roots(c.a3, c.a2, c.a1_base - och::dot(c.d2, dp), -och::dot(c.d1, dp), roots[0], roots[1], roots[2]);
+	else
+		roots[0] = och::dot(dp, c.p2 - c.p0) / och::dot(c.p2 - c.p0, c.p2 - c.p0);
+
+	for (const float t : roots)
+		if (t > 0.0F && t < 1.0F)
+		{
+			const float dst_sq = och::squared_magnitude(p - bezier_interp(c.p0, c.p1, c.p2, t));
+
+			if (dst_sq < closest.dst_sq)
+				closest = { t, dst_sq };
+		}
+
+	return closest;
+}
+
+// Directions of a curve at its start and end. Where a control point coincides with an endpoint, the chord is used instead.
+static och::vec2 curve_start_direction(const sdf_curve_table& curves, uint32_t i) noexcept
+{
+	const och::vec2 d1{ curves.d1_x[i], curves.d1_y[i] };
+
+	const och::vec2 dir = och::squared_magnitude(d1) > 1e-12F ? d1 : och::vec2{ curves.p2_x[i] - curves.p0_x[i], curves.p2_y[i] - curves.p0_y[i] };
+
+	return (1.0F / sqrtf(och::squared_magnitude(dir))) * dir;
+}
+
+static och::vec2 curve_end_direction(const sdf_curve_table& curves, uint32_t i) noexcept
+{
+	const och::vec2 d12{ curves.p2_x[i] - curves.p1_x[i], curves.p2_y[i] - curves.p1_y[i] };
+
+	const och::vec2 dir = och::squared_magnitude(d12) > 1e-12F ? d12 : och::vec2{ curves.p2_x[i] - curves.p0_x[i], curves.p2_y[i] - curves.p0_y[i] };
+
+	return (1.0F / sqrtf(och::squared_magnitude(dir))) * dir;
+}
+
+// Direction of the curve at t, which is (d1 + t * d2) up to a factor of 2. Falls back to the chord for degenerate curves.
+static och::vec2 curve_direction(const sdf_curve_table& curves, uint32_t i, float t) noexcept
+{
+	const och::vec2 dir{ curves.d1_x[i] + t * curves.d2_x[i], curves.d1_y[i] + t * curves.d2_y[i] };
+
+	if (och::squared_magnitude(dir) > 1e-12F)
+		return dir;
+
+	return { curves.p2_x[i] - curves.p0_x[i], curves.p2_y[i] - curves.p0_y[i] };
+}
+
+static float cross_2d(och::vec2 a, och::vec2 b) noexcept
+{
+	return a.x * b.y - a.y * b.x;
+}
+
+float sdf_curve_orthogonality(const sdf_curve_table& curves, uint32_t curve_idx, sdf_closest_point closest, och::vec2 p) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	const och::vec2 dir = curve_direction(curves, curve_idx, closest.t);
+
+	const och::vec2 to_p = p - bezier_interp(c.p0, c.p1, c.p2, closest.t);
+
+	const float len_sq = och::squared_magnitude(dir) * och::squared_magnitude(to_p);
+
+	return len_sq > 0.0F ? fabsf(cross_2d(dir, to_p)) / sqrtf(len_sq) : 1.0F;
+}
+
+float sdf_curve_pseudo_distance(const sdf_curve_table& curves, uint32_t curve_idx, sdf_closest_point closest, och::vec2 p) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	// Outer contours of TrueType glyphs run clockwise, so the inside is to the right of the curve's direction, where the cross product is negative.
+
+	if (closest.t <= 0.0F || closest.t >= 1.0F)
+	{
+		const bool is_beg = closest.t <= 0.0F;
+
+		const och::vec2 dir = is_beg ? curve_start_direction(curves, curve_idx) : curve_end_direction(curves, curve_idx);
+
+		const och::vec2 to_p = p - (is_beg ? c.p0 : c.p2);
+
+		const float along = och::dot(dir, to_p);
+
+		if (is_beg ? along < 0.0F : along > 0.0F)
+			return -cross_2d(dir, to_p);
+	}
+
+	const och::vec2 dir = curve_direction(curves, curve_idx, closest.t);
+
+	const float side = cross_2d(dir, p - bezier_interp(c.p0, c.p1, c.p2, closest.t));
+
+	return side > 0.0F ? -sqrtf(closest.dst_sq) : sqrtf(closest.dst_sq);
+}
+
+void sdf_color_edges(const sdf_curve_table& curves, uint8_t* out_channels) noexcept
+{
+	// Two curves form a corner if their directions where they meet differ by more than about 8 degrees
+	constexpr float CORNER_SIN_THRESHOLD = 0.14F;
+
+	constexpr uint8_t ALL_CHANNELS = SDF_CHANNEL_R | SDF_CHANNEL_G | SDF_CHANNEL_B;
+
+	// Any two of these share exactly one channel
+	constexpr uint8_t CORNER_COLORS[3]{ SDF_CHANNEL_G | SDF_CHANNEL_B, SDF_CHANNEL_R | SDF_CHANNEL_B, SDF_CHANNEL_R | SDF_CHANNEL_G };
+
+	uint32_t beg = 0;
+
+	for (uint32_t contour = 0; contour != curves.contour_cnt; ++contour)
+	{
+		const uint32_t end = curves.contour_ends[contour];
+
+		const uint32_t cnt = end - beg;
+
+		// Whether there is a corner between the start of curve k of the contour and the end of the one before it
+		const auto is_corner = [&](uint32_t k) noexcept
+		{
+			const och::vec2 a = curve_end_direction(curves, beg + (k + cnt - 1) % cnt);
+
+			const och::vec2 b = curve_start_direction(curves, beg + k);
+
+			return och::dot(a, b) <= 0.0F || fabsf(cross_2d(a, b)) > CORNER_SIN_THRESHOLD;
+		};
+
+		uint32_t corner_cnt = 0;
+
+		uint32_t first_corner = 0;
+
+		for (uint32_t k = 0; k != cnt; ++k)
+			if (is_corner(k))
+			{
+				if (corner_cnt == 0)
+					first_corner = k;
+
+				++corner_cnt;
+			}
+
+		if (corner_cnt == 0)
+		{
+			for (uint32_t k = 0; k != cnt; ++k)
+				out_channels[beg + k] = ALL_CHANNELS;
+		}
+		else if (corner_cnt == 1)
+		{
+			// The runs on either side of a lone corner are the contour's first and last third. Giving the middle third all channels
+			// lets the outer thirds use two different colors without another corner between them.
+
+			constexpr uint8_t TEARDROP_COLORS[3]{ CORNER_COLORS[1], ALL_CHANNELS, CORNER_COLORS[2] };
+
+			for (uint32_t j = 0; j != cnt; ++j)
+				out_channels[beg + (first_corner + j) % cnt] = TEARDROP_COLORS[cnt >= 3 ? j * 3 / cnt : j * 2];
+		}
+		else
+		{
+			// Switch to the next color at every corner. If the last run would end up with the same color as the first one it meets, skip ahead once more.
+
+			uint32_t color_idx = 0;
+
+			uint32_t corners_seen = 0;
+
+			for (uint32_t j = 0; j != cnt; ++j)
+			{
+				const uint32_t k = (first_corner + j) % cnt;
+
+				if (j != 0 && is_corner(k))
+				{
+					color_idx = (color_idx + 1) % 3;
+
+					if (++corners_seen == corner_cnt - 1 && color_idx == 0)
+						color_idx = 1;
+				}
+
+				out_channels[beg + k] = CORNER_COLORS[color_idx];
+			}
+		}
+
+		beg = end;
+	}
+}
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*//////////////////////////////////////////////////// SIMD //////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+// Thin wrappers giving __m128 and __m256 a common interface, so that row_kernel_simd only has to be written once.
+// Comparisons return all-ones / all-zeroes lane masks of the same type.
+
+struct f32x4
+{
+	static constexpr uint32_t WIDTH = 4;
+
+	__m128 v;
+
+	static f32x4 set1(float f) noexcept { return { _mm_set1_ps(f) }; }
+
+	static f32x4 lane_indices() noexcept { return { _mm_setr_ps(0.0F, 1.0F, 2.0F, 3.0F) }; }
+
+	static f32x4 load(const float* src) noexcept { return { _mm_loadu_ps(src) }; }
+
+	void store(float* dst) const noexcept { _mm_storeu_ps(dst, v); }
+};
+
+static f32x4 operator+(f32x4 a, f32x4 b) noexcept { return { _mm_add_ps(a.v, b.v) }; }
+static f32x4 operator-(f32x4 a, f32x4 b) noexcept { return { _mm_sub_ps(a.v, b.v) }; }
+static f32x4 operator*(f32x4 a, f32x4 b) noexcept { return { _mm_mul_ps(a.v, b.v) }; }
+static f32x4 operator/(f32x4 a, f32x4 b) noexcept { return { _mm_div_ps(a.v, b.v) }; }
+static f32x4 operator&(f32x4 a, f32x4 b) noexcept { return { _mm_and_ps(a.v, b.v) }; }
+static f32x4 operator<(f32x4 a, f32x4 b) noexcept { return { _mm_cmplt_ps(a.v, b.v) }; }
+static f32x4 operator>(f32x4 a, f32x4 b) noexcept { return { _mm_cmpgt_ps(a.v, b.v) }; }
+static f32x4 sqrt(f32x4 a) noexcept { return { _mm_sqrt_ps(a.v) }; }
+static f32x4 min(f32x4 a, f32x4 b) noexcept { return { _mm_min_ps(a.v, b.v) }; }
+static f32x4 max(f32x4 a, f32x4 b) noexcept { return { _mm_max_ps(a.v, b.v) }; }
+static f32x4 abs(f32x4 a) noexcept { return { _mm_andnot_ps(_mm_set1_ps(-0.0F), a.v) }; }
+static f32x4 select(f32x4 mask, f32x4 if_set, f32x4 if_unset) noexcept { return { _mm_or_ps(_mm_and_ps(mask.v, if_set.v), _mm_andnot_ps(mask.v, if_unset.v)) }; }
+static f32x4 bits_to_float(f32x4 a) noexcept { return { _mm_cvtepi32_ps(_mm_castps_si128(a.v)) }; }
+static f32x4 float_to_bits(f32x4 a) noexcept { return { _mm_castsi128_ps(_mm_cvttps_epi32(a.v)) }; }
+
+struct f32x8
+{
+	static constexpr uint32_t WIDTH = 8;
+
+	__m256 v;
+
+	static f32x8 set1(float f) noexcept { return { _mm256_set1_ps(f) }; }
+
+	static f32x8 lane_indices() noexcept { return { _mm256_setr_ps(0.0F, 1.0F, 2.0F, 3.0F, 4.0F, 5.0F, 6.0F, 7.0F) }; }
+
+	static f32x8 load(const float* src) noexcept { return { _mm256_loadu_ps(src) }; }
+
+	void store(float* dst) const noexcept { _mm256_storeu_ps(dst, v); }
+};
+
+static f32x8 operator+(f32x8 a, f32x8 b) noexcept { return { _mm256_add_ps(a.v, b.v) }; }
+static f32x8 operator-(f32x8 a, f32x8 b) noexcept { return { _mm256_sub_ps(a.v, b.v) }; }
+static f32x8 operator*(f32x8 a, f32x8 b) noexcept { return { _mm256_mul_ps(a.v, b.v) }; }
+static f32x8 operator/(f32x8 a, f32x8 b) noexcept { return { _mm256_div_ps(a.v, b.v) }; }
+static f32x8 operator&(f32x8 a, f32x8 b) noexcept { return { _mm256_and_ps(a.v, b.v) }; }
+static f32x8 operator<(f32x8 a, f32x8 b) noexcept { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+static f32x8 operator>(f32x8 a, f32x8 b) noexcept { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+static f32x8 sqrt(f32x8 a) noexcept { return { _mm256_sqrt_ps(a.v) }; }
+static f32x8 min(f32x8 a, f32x8 b) noexcept { return { _mm256_min_ps(a.v, b.v) }; }
+static f32x8 max(f32x8 a, f32x8 b) noexcept { return { _mm256_max_ps(a.v, b.v) }; }
+static f32x8 abs(f32x8 a) noexcept { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0F), a.v) }; }
+static f32x8 select(f32x8 mask, f32x8 if_set, f32x8 if_unset) noexcept { return { _mm256_blendv_ps(if_unset.v, if_set.v, mask.v) }; }
+static f32x8 bits_to_float(f32x8 a) noexcept { return { _mm256_cvtepi32_ps(_mm256_castps_si256(a.v)) }; }
+static f32x8 float_to_bits(f32x8 a) noexcept { return { _mm256_castsi256_ps(_mm256_cvttps_epi32(a.v)) }; }
+
+template<typename V>
+static V splat(float f) noexcept
+{
+	return V::set1(f);
+}
+
+// Cube root of a non-negative value. The initial guess divides the exponent by three through the float's bit pattern and is then refined with three Newton steps.
+template<typename V>
+static V cbrt_nonnegative(V a) noexcept
+{
+	V y = float_to_bits(bits_to_float(a) * splat<V>(1.0F / 3.0F) + splat<V>(709921077.0F));
+
+	for (uint32_t i = 0; i != 3; ++i)
+		y = splat<V>(2.0F / 3.0F) * y + splat<V>(1.0F / 3.0F) * a / (y * y);
+
+	return select(a > splat<V>(0.0F), y, splat<V>(0.0F));
+}
+
+template<typename V>
+static V signed_cbrt(V a) noexcept
+{
+	const V c = cbrt_nonnegative(abs(a));
+
+	return select(a < splat<V>(0.0F), splat<V>(0.0F) - c, c);
+}
+
+// Abramowitz & Stegun 4.4.46, absolute error below 2e-8.
+template<typename V>
+static V acos_approx(V a) noexcept
+{
+	const V x = min(abs(a), splat<V>(1.0F));
+
+	V poly = splat<V>(-0.0012624911F);
+	poly = poly * x + splat<V>( 0.0066700901F);
+	poly = poly * x + splat<V>(-0.0170881256F);
+	poly = poly * x + splat<V>( 0.0308918810F);
+	poly = poly * x + splat<V>(-0.0501743046F);
+	poly = poly * x + splat<V>( 0.0889789874F);
+	poly = poly * x + splat<V>(-0.2145988016F);
+	poly = poly * x + splat<V>( 1.5707963050F);
+
+	const V rst = sqrt(splat<V>(1.0F) - x) * poly;
+
+	return select(a < splat<V>(0.0F), splat<V>(3.14159265359F) - rst, rst);
+}
+
+// Taylor series for cos and sin, only valid for 0 <= a <= pi / 3, which is all cubic_poly_roots needs.
+template<typename V>
+static void cos_sin_small(V a, V& out_cos, V& out_sin) noexcept
+{
+	const V a2 = a * a;
+
+	V c = splat<V>(1.0F / 3628800.0F);
+	c = splat<V>(1.0F / 40320.0F) - c * a2;
+	c = splat<V>(1.0F / 720.0F) - c * a2;
+	c = splat<V>(1.0F / 24.0F) - c * a2;
+	c = splat<V>(1.0F / 2.0F) - c * a2;
+	c = splat<V>(1.0F) - c * a2;
+
+	V s = splat<V>(1.0F / 39916800.0F);
+	s = splat<V>(1.0F / 362880.0F) - s * a2;
+	s = splat<V>(1.0F / 5040.0F) - s * a2;
+	s = splat<V>(1.0F / 120.0F) - s * a2;
+	s = splat<V>(1.0F / 6.0F) - s * a2;
+	s = (splat<V>(1.0F) - s * a2) * a;
+
+	out_cos = c;
+
+	out_sin = s;
+}
+
+// Same case distinction as the scalar cubic_poly_roots, with all three cases evaluated and blended per lane.
+// Instead of three cosf calls, the trigonometric case uses cos(a + 2pi/3) and cos(a + 4pi/3) expressed through cos(a) and sin(a).
+template<typename V>
+static void cubic_poly_roots(float a3, float a2, V a1, V a0, V& r0, V& r1, V& r2) noexcept
+{
+	constexpr float TOO_SMALL = 1e-7F;
+
+	const V a2n = splat<V>(a2 / a3);
+
+	a1 = a1 / splat<V>(a3);
+
+	a0 = a0 / splat<V>(a3);
+
+	const V q = (splat<V>(3.0F) * a1 - a2n * a2n) / splat<V>(9.0F);
+
+	const V r = (splat<V>(-27.0F) * a0 + a2n * (splat<V>(9.0F) * a1 - splat<V>(2.0F) * a2n * a2n)) / splat<V>(54.0F);
+
+	const V q_cubed = q * q * q;
+
+	const V disc = q_cubed + r * r;
+
+	const V term_1 = splat<V>(-a2 / a3 / 3.0F);
+
+	const V inf = splat<V>(INFINITY);
+
+	// disc > TOO_SMALL
+
+	const V disc_sqrt = sqrt(max(disc, splat<V>(0.0F)));
+
+	const V one_r0 = term_1 + signed_cbrt(r + disc_sqrt) + signed_cbrt(r - disc_sqrt);
+
+	// disc < -TOO_SMALL
+
+	const V angle = acos_approx(r / sqrt(max(splat<V>(0.0F) - q_cubed, splat<V>(TOO_SMALL)))) * splat<V>(1.0F / 3.0F);
+
+	V angle_cos, angle_sin;
+
+	cos_sin_small(angle, angle_cos, angle_sin);
+
+	const V r13 = splat<V>(2.0F) * sqrt(max(splat<V>(0.0F) - q, splat<V>(0.0F)));
+
+	const V half_cos = splat<V>(-0.5F) * angle_cos;
+
+	const V sqrt3_half_sin = splat<V>(0.86602540378F) * angle_sin;
+
+	const V three_r0 = term_1 + r13 * angle_cos;
+
+	const V three_r1 = term_1 + r13 * (half_cos - sqrt3_half_sin);
+
+	const V three_r2 = term_1 + r13 * (half_cos + sqrt3_half_sin);
+
+	// Otherwise
+
+	const V r_cbrt = signed_cbrt(r);
+
+	const V two_r0 = term_1 + splat<V>(2.0F) * r_cbrt;
+
+	const V two_r1 = term_1 - r_cbrt;
+
+	const V is_one = disc > splat<V>(TOO_SMALL);
+
+	const V is_three = disc < splat<V>(-TOO_SMALL);
+
+	r0 = select(is_one, one_r0, select(is_three, three_r0, two_r0));
+
+	r1 = select(is_one, inf, select(is_three, three_r1, two_r1));
+
+	r2 = select(is_three, three_r2, inf);
+}
+
+template<typename V>
+static V check_root(V r, och::vec2 p0, och::vec2 p1, och::vec2 p2, V px, V py, V min_dst_sq) noexcept
+{
+	const V one_minus_r = splat<V>(1.0F) - r;
+
+	const V w0 = one_minus_r * one_minus_r;
+
+	const V w1 = splat<V>(2.0F) * one_minus_r * r;
+
+	const V w2 = r * r;
+
+	const V dx = px - (w0 * splat<V>(p0.x) + w1 * splat<V>(p1.x) + w2 * splat<V>(p2.x));
+
+	const V dy = py - (w0 * splat<V>(p0.y) + w1 * splat<V>(p1.y) + w2 * splat<V>(p2.y));
+
+	const V is_on_curve = (r > splat<V>(0.0F)) & (r < splat<V>(1.0F));
+
+	return select(is_on_curve, min(dx * dx + dy * dy, min_dst_sq), min_dst_sq);
+}
+
+template<typename V>
+static void row_kernel_simd(const sdf_curve_table& curves, uint32_t curve_idx, float y, float x_step, uint32_t x_beg, uint32_t pixel_cnt, sdf_row_state state) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	const och::vec2 p0 = c.p0, p1 = c.p1, p2 = c.p2, d1 = c.d1, d2 = c.d2;
+
+	const och::vec2 d_end = p2 - p0;
+
+	const bool is_linear = !(fabsf(c.a3) > 1e-7F);
+
+	const V py = splat<V>(y);
+
+	const V dpy = py - splat<V>(p0.y);
+
+	for (uint32_t x = x_beg; x < x_beg + pixel_cnt; x += V::WIDTH)
+	{
+		const V px = (V::lane_indices() + splat<V>(static_cast<float>(x))) * splat<V>(x_step);
+
+		const V dpx = px - splat<V>(p0.x);
+
+		V min_dst_sq;
+
+		if (!is_linear)
+		{
+			const V a1 = splat<V>(c.a1_base) - (splat<V>(d2.x) * dpx + splat<V>(d2.y) * dpy);
+
+			const V a0 = splat<V>(0.0F) - (splat<V>(d1.x) * dpx + splat<V>(d1.y) * dpy);
+
+			V r0, r1, r2;
+
+			cubic_poly_roots(c.a3, c.a2, a1, a0, r0, r1, r2);
+
+			const V ex = px - splat<V>(p2.x);
+
+			const V ey = py - splat<V>(p2.y);
+
+			min_dst_sq = min(dpx * dpx + dpy * dpy, ex * ex + ey * ey);
+
+			min_dst_sq = check_root(r0, p0, p1, p2, px, py, min_dst_sq);
+
+			min_dst_sq = check_root(r1, p0, p1, p2, px, py, min_dst_sq);
+
+			min_dst_sq = check_root(r2, p0, p1, p2, px, py, min_dst_sq);
+		}
+		else
+		{
+			V t = (dpx * splat<V>(d_end.x) + dpy * splat<V>(d_end.y)) / splat<V>(och::dot(d_end, d_end));
+
+			t = min(max(t, splat<V>(0.0F)), splat<V>(1.0F));
+
+			const V dx = px - (splat<V>(p0.x) * (splat<V>(1.0F) - t) + splat<V>(p2.x) * t);
+
+			const V dy = py - (splat<V>(p0.y) * (splat<V>(1.0F) - t) + splat<V>(p2.y) * t);
+
+			min_dst_sq = dx * dx + dy * dy;
+		}
+
+		min(min_dst_sq, V::load(state.min_dst_sq + x)).store(state.min_dst_sq + x);
+	}
+}
+
+
+
+template<typename V>
+static V halley_solve(V t, float a3, float a2, V a1, V a0) noexcept
+{
+	for (uint32_t i = 0; i != ITERATIVE_SOLVER_STEPS; ++i)
+	{
+		const V g = ((splat<V>(a3) * t + splat<V>(a2)) * t + a1) * t + a0;
+
+		const V g_d1 = (splat<V>(3.0F * a3) * t + splat<V>(2.0F * a2)) * t + a1;
+
+		const V g_d2 = splat<V>(6.0F * a3) * t + splat<V>(2.0F * a2);
+
+		// max returns its second operand for NaN lanes, which clamps degenerate curves to 0.
+		t = min(max(t - splat<V>(2.0F) * g * g_d1 / (splat<V>(2.0F) * g_d1 * g_d1 - g * g_d2), splat<V>(0.0F)), splat<V>(1.0F));
+	}
+
+	return t;
+}
+
+template<typename V>
+static V curve_dst_sq_at(V t, och::vec2 d1, och::vec2 d2, V dpx, V dpy) noexcept
+{
+	const V dx = dpx - t * (splat<V>(2.0F * d1.x) + t * splat<V>(d2.x));
+
+	const V dy = dpy - t * (splat<V>(2.0F * d1.y) + t * splat<V>(d2.y));
+
+	return dx * dx + dy * dy;
+}
+
+template<typename V>
+static void row_kernel_simd_iterative(const sdf_curve_table& curves, uint32_t curve_idx, float y, float x_step, uint32_t x_beg, uint32_t pixel_cnt, sdf_row_state state) noexcept
+{
+	const curve_coefficients c = load_curve(curves, curve_idx);
+
+	const V dpy = splat<V>(y - c.p0.y);
+
+	const V epy = splat<V>(y - c.p2.y);
+
+	for (uint32_t x = x_beg; x < x_beg + pixel_cnt; x += V::WIDTH)
+	{
+		const V px = (V::lane_indices() + splat<V>(static_cast<float>(x))) * splat<V>(x_step);
+
+		const V dpx = px - splat<V>(c.p0.x);
+
+		const V epx = px - splat<V>(c.p2.x);
+
+		const V a1 = splat<V>(c.a1_base) - (splat<V>(c.d2.x) * dpx + splat<V>(c.d2.y) * dpy);
+
+		const V a0 = splat<V>(0.0F) - (splat<V>(c.d1.x) * dpx + splat<V>(c.d1.y) * dpy);
+
+		const V t_from_beg = halley_solve(splat<V>(0.0F), c.a3, c.a2, a1, a0);
+
+		const V t_from_end = halley_solve(splat<V>(1.0F), c.a3, c.a2, a1, a0);
+
+		V min_dst_sq = min(dpx * dpx + dpy * dpy, epx * epx + epy * epy);
+
+		min_dst_sq = min(min_dst_sq, curve_dst_sq_at(t_from_beg, c.d1, c.d2, dpx, dpy));
+
+		min_dst_sq = min(min_dst_sq, curve_dst_sq_at(t_from_end, c.d1, c.d2, dpx, dpy));
+
+		min(min_dst_sq, V::load(state.min_dst_sq + x)).store(state.min_dst_sq + x);
+	}
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*/////////////////////////////////////////////////// Winding ////////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+static void add_crossing(sdf_row_crossing* crossings, uint32_t& crossing_cnt, float x, int32_t dir) noexcept
+{
+	uint32_t i = crossing_cnt++;
+
+	for (; i != 0 && crossings[i - 1].x > x; --i)
+		crossings[i] = crossings[i - 1];
+
+	crossings[i] = { x, dir };
+}
+
+void sdf_row_winding(const sdf_curve_table& curves, const uint32_t* curve_indices, uint32_t curve_index_cnt, float y, float x_step, uint32_t pixel_cnt, int32_t* out_winding) noexcept
+{
+	const uint32_t checked_curve_cnt = curve_indices == nullptr ? curves.curve_cnt : curve_index_cnt;
+
+	// Sized for two crossings per curve when the table was built, so this never allocates
+
+	sdf_row_crossing* const crossings = curves.crossings;
+
+	uint32_t crossing_cnt = 0;
+
+	for (uint32_t j = 0; j != checked_curve_cnt; ++j)
+	{
+		const uint32_t i = curve_indices == nullptr ? j : curve_indices[j];
+
+		const och::vec2 p0{ curves.p0_x[i], curves.p0_y[i] }, p1{ curves.p1_x[i], curves.p1_y[i] }, p2{ curves.p2_x[i], curves.p2_y[i] };
+
+		const float y0 = p0.y - y, y1 = p1.y - y, y2 = p2.y - y;
+
+		// Classify which roots of y(t) = 0 are actual crossings from the side of the row each control point lies on.
+		// This treats endpoints lying exactly on the row consistently between adjacent curves (see Lengyel, "GPU-Centered Font Rendering Directly from Glyph Outlines").
+		const uint32_t code = (0x2E74u >> ((y0 > 0.0F ? 2u : 0u) + (y1 > 0.0F ? 4u : 0u) + (y2 > 0.0F ? 8u : 0u))) & 3u;
+
+		if (!code)
+			continue;
+
+		const och::vec2 a = p0 - 2.0F * p1 + p2;
+
+		const och::vec2 b = p0 - p1;
+
+		// The roots are t1 = (b.y - d) / a.y and t2 = (b.y + d) / a.y. Straight segments are stored with a midpoint control point,
+		// leaving a.y as pure rounding noise, so the root that is actually used is computed as y0 / (b.y +- d) to avoid cancellation.
+
+		const float d = sqrtf(fmaxf(b.y * b.y - a.y * y0, 0.0F));
+
+		const float q = b.y < 0.0F ? b.y - d : b.y + d;
+
+		float t1, t2;
+
+		if (q == 0.0F)
+		{
+			t1 = t2 = 0.0F;
+		}
+		else if (b.y < 0.0F)
+		{
+			t1 = q / a.y;
+
+			t2 = y0 / q;
+		}
+		else
+		{
+			t1 = y0 / q;
+
+			t2 = q / a.y;
+		}
+
+		if (code & 1)
+			add_crossing(crossings, crossing_cnt, (a.x * t1 - b.x * 2.0F) * t1 + p0.x, 1);
+
+		if (code & 2)
+			add_crossing(crossings, crossing_cnt, (a.x * t2 - b.x * 2.0F) * t2 + p0.x, -1);
+	}
+
+	// Sweep from the right, accumulating all crossings lying to the right of the current pixel
+
+	int32_t winding = 0;
+
+	uint32_t next_crossing = crossing_cnt;
+
+	for (uint32_t x = pixel_cnt; x != 0; --x)
+	{
+		const float px = x_step * static_cast<float>(x - 1);
+
+		while (next_crossing != 0 && crossings[next_crossing - 1].x > px)
+			winding += crossings[--next_crossing].dir;
+
+		out_winding[x - 1] = winding;
+	}
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*/////////////////////////////////////////////////// Dispatch ///////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+sdf_kernel_isa sdf_supported_kernel_isa(sdf_kernel_isa max_isa) noexcept
+{
+	int regs[4];
+
+	__cpuid(regs, 1);
+
+	const bool has_osxsave = regs[2] & (1 << 27);
+
+	const bool has_avx = regs[2] & (1 << 28);
+
+	// Check that the OS saves the upper halves of the ymm registers as well
+	const bool has_os_avx_support = has_osxsave && has_avx && (_xgetbv(0) & 6) == 6;
+
+	const sdf_kernel_isa supported = has_os_avx_support ? sdf_kernel_isa::avx : sdf_kernel_isa::sse2;
+
+	return static_cast<uint8_t>(supported) < static_cast<uint8_t>(max_isa) ? supported : max_isa;
+}
+
+sdf_row_kernel_fn sdf_row_kernel(sdf_kernel_isa isa, sdf_solver solver) noexcept
+{
+	const bool is_iterative = solver == sdf_solver::iterative;
+
+	switch (isa)
+	{
+	case sdf_kernel_isa::sse2:
+		return is_iterative ? row_kernel_simd_iterative<f32x4> : row_kernel_simd<f32x4>;
+
+	case sdf_kernel_isa::avx:
+		return is_iterative ? row_kernel_simd_iterative<f32x8> : row_kernel_simd<f32x8>;
+
+	default:
+		return is_iterative ? row_kernel_scalar_iterative : row_kernel_scalar;
+	}
+}
+
+void sdf_init_row_state(sdf_row_state state, uint32_t pixel_cnt) noexcept
+{
+	const uint32_t padded_cnt = (pixel_cnt + SDF_KERNEL_MAX_LANES - 1) & ~(SDF_KERNEL_MAX_LANES - 1);
+
+	for (uint32_t i = 0; i != padded_cnt; ++i)
+		state.min_dst_sq[i] = INFINITY;
+}
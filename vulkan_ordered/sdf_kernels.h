@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+
+#include "och_matmath.h"
+#include "heap_buffer.h"
+#include "simple_vec.h"
+#include "truetype.h"
+
+// Kernels evaluating the unsigned distance from a row of pixels to a single quadratic bezier curve.
+// Each kernel updates the running per-pixel minimum squared distance. The sign is determined separately for a whole row by sdf_row_winding.
+//
+// The SIMD kernels replace cbrtf, acosf and cosf with polynomial approximations and iterative refinement.
+// Their distances agree with the scalar kernel to within 1e-5 (in glyph-cell units), which is below one step of the 8-bit atlas output for any sdf_clamp >= 0.0013.
+//
+// The iterative solver runs two Halley steps from each of t = 0 and t = 1, one per local minimum a quadratic bezier's distance function can have.
+// That is enough for the gently curved segments of glyph outlines. Atlases of Lato and Source Code Pro differ from the analytic solver by at most one 8-bit step, in fewer than 0.01% of texels.
+// Strongly curved segments may need more steps. The sdf_benchmark sample reports the difference for any font.
+
+enum class sdf_kernel_isa : uint8_t
+{
+	scalar,
+	sse2,
+	avx,
+};
+
+enum class sdf_solver : uint8_t
+{
+	// Closed-form roots of the closest-point cubic using cbrt, acos and cos.
+	analytic,
+
+	// A few Halley iterations on the closest-point cubic, started from both endpoints of the curve.
+	iterative,
+};
+
+// Pixels per row are processed in blocks of this size. The per-row arrays passed to a kernel must have room for pixel_cnt rounded up to a multiple of it.
+static constexpr uint32_t SDF_KERNEL_MAX_LANES = 8;
+
+struct sdf_row_state
+{
+	float* min_dst_sq;
+};
+
+// Point where a row crosses the outline, with dir being +1 or -1 depending on the direction of the curve
+struct sdf_row_crossing
+{
+	float x;
+
+	int32_t dir;
+};
+
+// Per-curve data of a glyph outline in structure-of-arrays layout, scaled and offset into the glyph's SDF cell.
+// Holds every quadratic bezier of the outline, including the one closing each contour, along with the terms of the distance polynomial that do not depend on the pixel.
+struct sdf_curve_table
+{
+	uint32_t curve_cnt = 0;
+
+	float* p0_x = nullptr;
+	float* p0_y = nullptr;
+	float* p1_x = nullptr;
+	float* p1_y = nullptr;
+	float* p2_x = nullptr;
+	float* p2_y = nullptr;
+
+	// p1 - p0
+	float* d1_x = nullptr;
+	float* d1_y = nullptr;
+
+	// p2 - 2 * p1 + p0
+	float* d2_x = nullptr;
+	float* d2_y = nullptr;
+
+	// dot(d2, d2)
+	float* a3 = nullptr;
+
+	// 3 * dot(d1, d2)
+	float* a2 = nullptr;
+
+	// 2 * dot(d1, d1), to which the pixel-dependent part of the linear coefficient is added
+	float* a1_base = nullptr;
+
+	heap_buffer<float> storage;
+
+	// Scratch for sdf_row_winding, with room for the two crossings each curve can have with a row
+	sdf_row_crossing* crossings = nullptr;
+
+	heap_buffer<sdf_row_crossing> crossing_storage;
+
+	// The curves of each contour are stored consecutively, ending before the corresponding entry of contour_ends
+	uint32_t contour_cnt = 0;
+
+	heap_buffer<uint32_t> contour_ends;
+};
+
+// Channels of a multi-channel SDF a curve contributes to, as a combination of these bits
+static constexpr uint8_t SDF_CHANNEL_R = 1;
+static constexpr uint8_t SDF_CHANNEL_G = 2;
+static constexpr uint8_t SDF_CHANNEL_B = 4;
+
+struct sdf_closest_point
+{
+	// Parameter of the closest point on the curve, in [0, 1]
+	float t;
+
+	float dst_sq;
+};
+
+// Curves of a glyph outline before they are scaled into an SDF cell, as stored by sdf_flatten_outline.
+// Lets an outline decoded once be built into curve tables for any number of glyph sizes.
+struct sdf_outline
+{
+	// Three control points per curve, in the same units as the points of glyph_data
+	const och::vec2* points;
+
+	uint32_t curve_cnt;
+
+	// Curve index at which each contour ends, as in sdf_curve_table
+	const uint32_t* contour_ends;
+
+	uint32_t contour_cnt;
+};
+
+// Fills the table from glyph, reusing its storage if it is already large enough.
+void sdf_build_curve_table(const glyph_data& glyph, float glyph_scale, sdf_curve_table& out) noexcept;
+
+// Same as above, with the curves taken from an outline flattened by sdf_flatten_outline. The result is identical to building the table from the glyph directly.
+void sdf_build_curve_table(const sdf_outline& outline, float glyph_scale, sdf_curve_table& out) noexcept;
+
+// Appends the control points of glyph's curves to out_points and the end of each of its contours to out_contour_ends, counted from the glyph's first curve.
+// Returns the number of curves appended. Contours that would be skipped by sdf_build_curve_table are not appended.
+uint32_t sdf_flatten_outline(const glyph_data& glyph, simple_vec<och::vec2>& out_points, simple_vec<uint32_t>& out_contour_ends) noexcept;
+
+// Evaluates curve curve_idx for the pixels x_beg to x_beg + pixel_cnt of the row, with pixel x located at (x_step * x, y).
+// x_beg must be a multiple of SDF_KERNEL_MAX_LANES.
+using sdf_row_kernel_fn = void (*) (const sdf_curve_table& curves, uint32_t curve_idx, float y, float x_step, uint32_t x_beg, uint32_t pixel_cnt, sdf_row_state state) noexcept;
+
+// Finds the point of curve curve_idx closest to p, using the analytic solver. Unlike the row kernels, this also reports where on the curve it lies.
+sdf_closest_point sdf_curve_closest_point(const sdf_curve_table& curves, uint32_t curve_idx, och::vec2 p) noexcept;
+
+// Absolute sine of the angle between the curve's direction at closest and the direction from there to p.
+// Breaks ties between curves equally close to p, which happens where they meet: The more perpendicular one determines the side p is on.
+float sdf_curve_orthogonality(const sdf_curve_table& curves, uint32_t curve_idx, sdf_closest_point closest, och::vec2 p) noexcept;
+
+// Signed distance from p to the curve, positive inside the outline. Beyond its endpoints, the curve is extended along its tangents there,
+// so the distance is measured to that line instead. Taking these pseudo-distances of differently colored curves meeting at a corner keeps it sharp.
+float sdf_curve_pseudo_distance(const sdf_curve_table& curves, uint32_t curve_idx, sdf_closest_point closest, och::vec2 p) noexcept;
+
+// Assigns each curve the channels of a multi-channel SDF it contributes to, writing one combination of SDF_CHANNEL_* bits per curve to out_channels.
+// Within a contour, the two curves meeting at a corner share exactly one channel, so that taking the median of the channels keeps the corner sharp.
+// Smooth contours without corners are assigned all channels.
+void sdf_color_edges(const sdf_curve_table& curves, uint8_t* out_channels) noexcept;
+
+// Returns the widest kernel supported by both the executing CPU and max_isa.
+sdf_kernel_isa sdf_supported_kernel_isa(sdf_kernel_isa max_isa = sdf_kernel_isa::avx) noexcept;
+
+sdf_row_kernel_fn sdf_row_kernel(sdf_kernel_isa isa, sdf_solver solver = sdf_solver::analytic) noexcept;
+
+void sdf_init_row_state(sdf_row_state state, uint32_t pixel_cnt) noexcept;
+
+// Writes the nonzero winding number of the outline at each pixel of the row to out_winding.
+// Crossings of the row with every curve are computed once and then swept from right to left, instead of casting a ray per pixel.
+// If curve_indices is not null, only the curve_index_cnt curves it lists are considered. These must include every curve whose y-extent contains the row.
+// Crossings are collected in curves.crossings, so a table must not be used by several threads at once.
+void sdf_row_winding(const sdf_curve_table& curves, const uint32_t* curve_indices, uint32_t curve_index_cnt, float y, float x_step, uint32_t pixel_cnt, int32_t* out_winding) noexcept;
@@ -7,6 +7,7 @@ glslc.exe   swapchain.comp                                                -O   -
 glslc.exe   simplex3d_slice.comp                                          -O   -o simplex3d_slice.comp.spv
 glslc.exe   sdf_font.frag                                                 -O   -o sdf_font.frag.spv
 glslc.exe   sdf_font.vert                                                 -O   -o sdf_font.vert.spv
+glslc.exe   sdf_glyph.comp                                                -O   -o sdf_glyph.comp.spv
 glslc.exe   simplex3d.comp                                                -O   -o simplex3d.comp.spv
 glslc.exe   simplex3d_layered.comp                                        -O   -o simplex3d_layered.comp.spv
 glslc.exe   voxel_volume_trace.comp                                       -O   -o voxel_volume_trace.comp.spv
@@ -2,16 +2,23 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(location = 0) in vec2 tex_position;
+layout(location = 1) flat in uint tex_layer;
 
-layout(binding = 0) uniform sampler2D tex_sampler;
+layout(binding = 0) uniform sampler2DArray tex_sampler;
 
 layout(location = 0) out vec4 out_colour;
 
+float median(float a, float b, float c)
+{
+	return max(min(a, b), min(max(a, b), c));
+}
+
 void main()
 {
-	vec4 sampled_colour = texture(tex_sampler, tex_position);
+	vec4 sampled_colour = texture(tex_sampler, vec3(tex_position, float(tex_layer)));
 
-	if(sampled_colour.r >= 0.5)
+	// Single-channel atlases are viewed with r replicated to g and b
+	if(median(sampled_colour.r, sampled_colour.g, sampled_colour.b) >= 0.5)
 		out_colour = vec4(0.0, 0.0, 0.0, 1.0);
 	else
 		discard;
@@ -3,8 +3,10 @@
 
 layout(location = 0) in vec2 atlas_pos;
 layout(location = 1) in vec2 screen_pos;
+layout(location = 2) in uint atlas_page;
 
 layout(location = 0) out vec2 tex_pos;
+layout(location = 1) flat out uint tex_layer;
 
 layout(push_constant) uniform Push_data
 {
@@ -16,4 +18,6 @@ void main()
 	gl_Position = vec4(screen_pos, 0.0, 1.0) * push_data.transform;
 
 	tex_pos = atlas_pos;
+
+	tex_layer = atlas_page;
 }
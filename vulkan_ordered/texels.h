@@ -13,6 +13,19 @@ struct texel_b8g8r8
 	constexpr explicit texel_b8g8r8(uint8_t l) noexcept : b{ l }, g{ l }, r{ l } {}
 };
 
+struct texel_r8g8b8
+{
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+
+	constexpr texel_r8g8b8() noexcept = default;
+
+	constexpr texel_r8g8b8(uint8_t r, uint8_t g, uint8_t b) noexcept : r{ r }, g{ g }, b{ b } {}
+
+	constexpr explicit texel_r8g8b8(uint8_t l) noexcept : r{ l }, g{ l }, b{ l } {}
+};
+
 namespace col
 {
 	namespace b8g8r8
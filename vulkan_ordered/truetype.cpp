@@ -1,6 +1,11 @@
 #include "truetype.h"
 
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include <intrin.h>
+#include <immintrin.h>
 
 #define TEMP_STATUS_MACRO to_status(och::status(1, och::error_type::och))
 
@@ -65,6 +70,8 @@ glyph_data::glyph_data() noexcept :
 	m_point_cnt{ 0 },
 	m_contour_cnt{ 0 },
 	m_points{ nullptr },
+	m_contour_ends{ nullptr },
+	m_owns_points{ true },
 	m_metrics{ 0.0F, 0.0F, 0.0F, 0.0F, 0.0F, 0.0F }
 {}
 
@@ -72,12 +79,26 @@ glyph_data::glyph_data(uint32_t contour_cnt, uint32_t point_cnt, glyph_metrics m
 	m_point_cnt{ point_cnt },
 	m_contour_cnt{ contour_cnt },
 	m_points{ raw_data_ownership_transferred },
+	m_contour_ends{ reinterpret_cast<uint32_t*>(raw_data_ownership_transferred + point_cnt) },
+	m_owns_points{ true },
 	m_metrics{ metrics }
 {}
 
+glyph_data glyph_data::borrow(uint32_t contour_cnt, uint32_t point_cnt, glyph_metrics metrics, och::vec2* points, uint32_t* contour_ends) noexcept
+{
+	glyph_data glyph(contour_cnt, point_cnt, metrics, points);
+
+	glyph.m_contour_ends = contour_ends;
+
+	glyph.m_owns_points = false;
+
+	return glyph;
+}
+
 glyph_data::~glyph_data() noexcept
 {
-	free(m_points);
+	if (m_owns_points)
+		free(m_points);
 }
 
 const och::vec2& glyph_data::operator[](uint32_t point_idx) const noexcept
@@ -92,7 +113,7 @@ och::vec2& glyph_data::operator[](uint32_t point_idx) noexcept
 
 const uint32_t* glyph_data::contour_end_indices() const noexcept
 {
-	return reinterpret_cast<const uint32_t*>(m_points + m_point_cnt);
+	return m_contour_ends;
 }
 
 const glyph_metrics& glyph_data::metrics() const noexcept
@@ -122,6 +143,118 @@ uint32_t glyph_data::contour_end_index(uint32_t contour_idx) const noexcept
 
 
 
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*//////////////////////////////////////////// glyph_scratch_arena ///////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+glyph_scratch_arena::glyph_scratch_arena(void* buffer, uint32_t buffer_bytes) noexcept :
+	m_data{ static_cast<uint8_t*>(buffer) },
+	m_capacity{ buffer_bytes },
+	m_owns_data{ false }
+{}
+
+glyph_scratch_arena::~glyph_scratch_arena() noexcept
+{
+	free_blocks();
+}
+
+void* glyph_scratch_arena::allocate(uint32_t bytes) noexcept
+{
+	bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+	if (m_capacity - m_used >= bytes)
+	{
+		void* ptr = m_data + m_used;
+
+		m_used += bytes;
+
+		return ptr;
+	}
+
+	// Kept until the next reset, which then grows the current block by the overflowing bytes
+
+	overflow_block* block = static_cast<overflow_block*>(malloc(sizeof(overflow_block) + bytes));
+
+	block->prev = m_overflow;
+
+	m_overflow = block;
+
+	m_overflow_bytes += bytes;
+
+	return block + 1;
+}
+
+void glyph_scratch_arena::reset() noexcept
+{
+	if (m_overflow != nullptr)
+	{
+		const uint32_t new_capacity = m_capacity + m_overflow_bytes;
+
+		free_blocks();
+
+		m_data = static_cast<uint8_t*>(malloc(new_capacity));
+
+		m_capacity = new_capacity;
+
+		m_owns_data = true;
+
+		m_overflow_bytes = 0;
+	}
+
+	m_used = 0;
+}
+
+uint32_t glyph_scratch_arena::capacity() const noexcept
+{
+	return m_capacity;
+}
+
+void glyph_scratch_arena::free_blocks() noexcept
+{
+	while (m_overflow != nullptr)
+	{
+		overflow_block* prev = m_overflow->prev;
+
+		free(m_overflow);
+
+		m_overflow = prev;
+	}
+
+	if (m_owns_data)
+		free(m_data);
+}
+
+
+
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+/*//////////////////////////////////////////////// outline_batch /////////////////////////////////////////////////*/
+/*////////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+uint32_t outline_batch::glyph_cnt() const noexcept
+{
+	return glyphs.size();
+}
+
+glyph_data outline_batch::glyph(uint32_t idx) noexcept
+{
+	const glyph_range& r = glyphs[idx];
+
+	return glyph_data::borrow(r.contour_cnt, r.point_cnt, metrics[idx], points.data() + r.point_beg, contour_ends.data() + r.contour_beg);
+}
+
+void outline_batch::reset() noexcept
+{
+	points.reset();
+
+	contour_ends.reset();
+
+	glyphs.reset();
+
+	metrics.reset();
+}
+
+
+
 /*///////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
 /*//////////////////////////////////////////////// truetype_file ////////////////////////////////////////////////*/
 /*///////////////////////////////////////////////////////////////////////////////////////////////////////////////*/
@@ -237,10 +370,245 @@ uint32_t cmap_f12(const void* raw_tbl, uint32_t cpt) noexcept
 
 
 
+// Calls fn(beg, end) for each range of codepoints the format 4 table raw_tbl maps, with end being inclusive
+template<typename Fn>
+static void cmap_f4_for_each_range(const void* raw_tbl, Fn&& fn) noexcept
+{
+	const uint16_t seg_cnt = be_to_le(static_cast<const uint16_t*>(raw_tbl)[3]) >> 1;
+
+	const uint16_t* end_codes = static_cast<const uint16_t*>(raw_tbl) + 7;
+
+	const uint16_t* beg_codes = end_codes + seg_cnt + 1;
+
+	for (uint32_t i = 0; i != seg_cnt; ++i)
+		fn(static_cast<uint32_t>(be_to_le(beg_codes[i])), static_cast<uint32_t>(be_to_le(end_codes[i])));
+}
+
+// Calls fn(beg, end) for each range of codepoints the format 12 table raw_tbl maps, with end being inclusive
+template<typename Fn>
+static void cmap_f12_for_each_range(const void* raw_tbl, Fn&& fn) noexcept
+{
+	const uint32_t* hdr = static_cast<const uint32_t*>(raw_tbl);
+
+	const uint32_t group_cnt = be_to_le(hdr[3]);
+
+	const uint32_t* groups = hdr + 4;
+
+	for (uint32_t i = 0; i != group_cnt; ++i)
+		fn(be_to_le(groups[i * 3]), be_to_le(groups[i * 3 + 1]));
+}
+
+// Number of blocks of 256 codepoints covering all of unicode, each of which has an entry in the directory of truetype_file::m_cmap_table
+static constexpr uint32_t CMAP_TABLE_BLOCK_CNT = 0x110000 >> 8;
+
+static uint32_t cmap_table_lookup(const uint16_t* table, uint32_t cpt) noexcept
+{
+	if (cpt >= 0x110000)
+		return 0;
+
+	const uint32_t page = table[cpt >> 8];
+
+	return table[CMAP_TABLE_BLOCK_CNT + (page << 8) + (cpt & 0xFF)];
+}
+
+
+
+/*////////////////////////////////////////// simple glyph coordinates ///////////////////////////////////////////*/
+
+// Gathering coordinate deltas relies on pshufb. Every CPU that runs the AVX atlas kernels has it, and most others do as well.
+static bool has_ssse3() noexcept
+{
+	static const bool has_it = []() noexcept
+	{
+		int regs[4];
+
+		__cpuid(regs, 1);
+
+		return (regs[2] & (1 << 9)) != 0;
+	}();
+
+	return has_it;
+}
+
+// Decodes one coordinate of 8 points from the delta stream src, returning the deltas as 16-bit lanes and advancing src past them.
+// The points' flags are in the low bytes of the lanes of flags. short_bit and same_or_positive_bit are the flag bits of this coordinate.
+// Reads 16 bytes from src, unless that would go past src_end.
+static __m128i gather_coord_deltas_ssse3(__m128i flags, int16_t short_bit, int16_t same_or_positive_bit, const uint8_t*& src, const uint8_t* src_end) noexcept
+{
+	const __m128i is_short = _mm_cmpeq_epi16(_mm_and_si128(flags, _mm_set1_epi16(short_bit)), _mm_set1_epi16(short_bit));
+
+	const __m128i is_same_or_positive = _mm_cmpeq_epi16(_mm_and_si128(flags, _mm_set1_epi16(same_or_positive_bit)), _mm_set1_epi16(same_or_positive_bit));
+
+	const __m128i is_word = _mm_cmpeq_epi16(_mm_or_si128(is_short, is_same_or_positive), _mm_setzero_si128());
+
+	// Deltas take 1 byte if short, 2 if neither short nor the same as the previous coordinate, and 0 otherwise.
+	// The exclusive prefix sum of these widths is where each delta starts.
+
+	const __m128i width = _mm_or_si128(_mm_and_si128(is_short, _mm_set1_epi16(1)), _mm_and_si128(is_word, _mm_set1_epi16(2)));
+
+	__m128i width_sum = _mm_add_epi16(width, _mm_slli_si128(width, 2));
+
+	width_sum = _mm_add_epi16(width_sum, _mm_slli_si128(width_sum, 4));
+
+	width_sum = _mm_add_epi16(width_sum, _mm_slli_si128(width_sum, 8));
+
+	const __m128i offset = _mm_sub_epi16(width_sum, width);
+
+	// Words are big-endian, so their first byte goes into the high half of the lane. Indices with the top bit set make pshufb write zero.
+
+	const __m128i lo_idx = _mm_or_si128(_mm_sub_epi16(offset, is_word), _mm_andnot_si128(_mm_or_si128(is_short, is_word), _mm_set1_epi16(0x80)));
+
+	const __m128i hi_idx = _mm_or_si128(offset, _mm_andnot_si128(is_word, _mm_set1_epi16(0x80)));
+
+	const __m128i shuffle = _mm_or_si128(lo_idx, _mm_slli_epi16(hi_idx, 8));
+
+	__m128i bytes;
+
+	if (src_end - src >= 16)
+	{
+		bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+	}
+	else
+	{
+		alignas(16) uint8_t tail[16]{};
+
+		// Corrupt glyphs may claim more coordinate bytes than the file holds
+		if (src < src_end)
+			memcpy(tail, src, src_end - src);
+
+		bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+	}
+
+	__m128i delta = _mm_shuffle_epi8(bytes, shuffle);
+
+	// Short deltas are unsigned, with their sign in the flags
+	const __m128i negate = _mm_andnot_si128(is_same_or_positive, is_short);
+
+	delta = _mm_sub_epi16(_mm_xor_si128(delta, negate), negate);
+
+	src += _mm_extract_epi16(width_sum, 7);
+
+	return delta;
+}
+
+// Same result as the scalar loops of truetype_file::get_glyph_data_recursive, decoding 8 points at a time.
+// flags holds the expanded flags of point_cnt points, padded to padded_point_cnt, a multiple of 16, with flags taking no coordinate bytes.
+// coords is the start of the x deltas, which are followed by the y deltas. Nothing at or after file_end is read.
+// X coordinates wrap around at 16 bits like the scalar code's, while y coordinates are summed in 32 bits.
+static void decode_simple_glyph_coords_ssse3(const uint8_t* flags, uint32_t padded_point_cnt, uint32_t point_cnt, const uint8_t* coords, const uint8_t* file_end, float normalization_factor, och::vec2* out_points) noexcept
+{
+	constexpr int16_t                    X_SHORT_VECTOR = 0x02;
+	constexpr int16_t                    Y_SHORT_VECTOR = 0x04;
+	constexpr int16_t X_IS_SAME_OR_POSITIVE_X_SHORT_VEC = 0x10;
+	constexpr int16_t Y_IS_SAME_OR_POSITIVE_Y_SHORT_VEC = 0x20;
+
+	// The y deltas start after all x deltas, whose total size follows from the flags alone
+
+	uint32_t x_bytes = 0;
+
+	for (uint32_t i = 0; i != padded_point_cnt; i += 16)
+	{
+		const __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(flags + i));
+
+		const __m128i is_short = _mm_cmpeq_epi8(_mm_and_si128(f, _mm_set1_epi8(X_SHORT_VECTOR)), _mm_set1_epi8(X_SHORT_VECTOR));
+
+		const __m128i is_same_or_positive = _mm_cmpeq_epi8(_mm_and_si128(f, _mm_set1_epi8(X_IS_SAME_OR_POSITIVE_X_SHORT_VEC)), _mm_set1_epi8(X_IS_SAME_OR_POSITIVE_X_SHORT_VEC));
+
+		const __m128i is_word = _mm_cmpeq_epi8(_mm_or_si128(is_short, is_same_or_positive), _mm_setzero_si128());
+
+		const __m128i width = _mm_or_si128(_mm_and_si128(is_short, _mm_set1_epi8(1)), _mm_and_si128(is_word, _mm_set1_epi8(2)));
+
+		const __m128i width_sums = _mm_sad_epu8(width, _mm_setzero_si128());
+
+		x_bytes += _mm_cvtsi128_si32(width_sums) + _mm_extract_epi16(width_sums, 4);
+	}
+
+	const uint8_t* x_src = coords;
+
+	const uint8_t* y_src = coords + x_bytes;
+
+	const __m128 factor = _mm_set1_ps(normalization_factor);
+
+	__m128i prev_x = _mm_setzero_si128();
+
+	__m128i prev_y = _mm_setzero_si128();
+
+	for (uint32_t i = 0; i < point_cnt; i += 8)
+	{
+		const __m128i f = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(flags + i)), _mm_setzero_si128());
+
+		// Prefix sum of the x deltas in 16-bit lanes, continuing from the last x of the previous group
+
+		__m128i x = gather_coord_deltas_ssse3(f, X_SHORT_VECTOR, X_IS_SAME_OR_POSITIVE_X_SHORT_VEC, x_src, file_end);
+
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+
+		x = _mm_add_epi16(x, prev_x);
+
+		prev_x = _mm_shuffle_epi32(_mm_shufflehi_epi16(x, 0xFF), 0xFF);
+
+		// Prefix sum of the y deltas, sign-extended to two vectors of 32-bit lanes
+
+		const __m128i y_delta = gather_coord_deltas_ssse3(f, Y_SHORT_VECTOR, Y_IS_SAME_OR_POSITIVE_Y_SHORT_VEC, y_src, file_end);
+
+		__m128i y_lo = _mm_srai_epi32(_mm_unpacklo_epi16(y_delta, y_delta), 16);
+
+		__m128i y_hi = _mm_srai_epi32(_mm_unpackhi_epi16(y_delta, y_delta), 16);
+
+		y_lo = _mm_add_epi32(y_lo, _mm_slli_si128(y_lo, 4));
+
+		y_lo = _mm_add_epi32(y_lo, _mm_slli_si128(y_lo, 8));
+
+		y_lo = _mm_add_epi32(y_lo, prev_y);
+
+		y_hi = _mm_add_epi32(y_hi, _mm_slli_si128(y_hi, 4));
+
+		y_hi = _mm_add_epi32(y_hi, _mm_slli_si128(y_hi, 8));
+
+		y_hi = _mm_add_epi32(y_hi, _mm_shuffle_epi32(y_lo, 0xFF));
+
+		prev_y = _mm_shuffle_epi32(y_hi, 0xFF);
+
+		// Normalize and interleave into points
+
+		const __m128 x_lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), factor);
+
+		const __m128 x_hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), factor);
+
+		const __m128 yf_lo = _mm_mul_ps(_mm_cvtepi32_ps(y_lo), factor);
+
+		const __m128 yf_hi = _mm_mul_ps(_mm_cvtepi32_ps(y_hi), factor);
+
+		alignas(16) och::vec2 group[8];
+
+		och::vec2* dst = point_cnt - i >= 8 ? out_points + i : group;
+
+		_mm_storeu_ps(reinterpret_cast<float*>(dst), _mm_unpacklo_ps(x_lo, yf_lo));
+
+		_mm_storeu_ps(reinterpret_cast<float*>(dst + 2), _mm_unpackhi_ps(x_lo, yf_lo));
+
+		_mm_storeu_ps(reinterpret_cast<float*>(dst + 4), _mm_unpacklo_ps(x_hi, yf_hi));
+
+		_mm_storeu_ps(reinterpret_cast<float*>(dst + 6), _mm_unpackhi_ps(x_hi, yf_hi));
+
+		if (dst == group)
+			memcpy(out_points + i, group, (point_cnt - i) * sizeof(och::vec2));
+	}
+}
+
+
+
 och::status truetype_file::create(const char* filename) noexcept
 {
 	m_flags.is_valid_file = false;
 
+	// A table left from a previously opened file would map codepoints incorrectly
+	free(const_cast<uint16_t*>(m_cmap_table.exchange(nullptr, std::memory_order::acquire)));
+
 	check(m_file.create(filename, och::fio::access::read, och::fio::open::normal, och::fio::open::fail, 0, 0, och::fio::share::read_write_remove));
 
 	// Load tables
@@ -298,6 +666,8 @@ och::status truetype_file::create(const char* filename) noexcept
 void truetype_file::close() noexcept
 {
 	m_file.close();
+
+	free(const_cast<uint16_t*>(m_cmap_table.exchange(nullptr, std::memory_order::acquire)));
 }
 
 float truetype_file::baseline_offset() const noexcept
@@ -310,6 +680,41 @@ float truetype_file::line_height() const noexcept
 	return m_line_height;
 }
 
+uint32_t truetype_file::glyph_cnt() const noexcept
+{
+	return m_glyph_cnt;
+}
+
+uint64_t truetype_file::content_hash() const noexcept
+{
+	struct table_record
+	{
+		table_tag tag;
+		uint32_t checksum;
+		uint32_t offset;
+		uint32_t lenght;
+	};
+
+	const table_record* records = reinterpret_cast<const table_record*>(m_file.data() + 1);
+
+	uint64_t hash = 14695981039346656037ull;
+
+	const auto mix = [&hash](uint32_t v) noexcept { hash = (hash ^ v) * 1099511628211ull; };
+
+	mix(m_table_cnt);
+
+	for (uint32_t i = 0; i != m_table_cnt; ++i)
+	{
+		const char* tag = records[i].tag.cs;
+
+		mix(static_cast<uint32_t>(static_cast<uint8_t>(tag[0])) | static_cast<uint32_t>(static_cast<uint8_t>(tag[1])) << 8 | static_cast<uint32_t>(static_cast<uint8_t>(tag[2])) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(tag[3])) << 24);
+		mix(records[i].checksum);
+		mix(records[i].lenght);
+	}
+
+	return hash;
+}
+
 glyph_data truetype_file::get_glyph_data_from_codepoint(char32_t codepoint) const noexcept
 {
 	return get_glyph_data_from_id(get_glyph_id_from_codept(codepoint));
@@ -322,16 +727,154 @@ glyph_metrics truetype_file::get_glyph_metrics_from_codept(char32_t codepoint) c
 
 uint32_t truetype_file::get_glyph_id_from_codept(char32_t codepoint) const noexcept
 {
+	if (const uint16_t* table = m_cmap_table.load(std::memory_order::acquire); table != nullptr)
+		return cmap_table_lookup(table, static_cast<uint32_t>(codepoint));
+
 	return m_codepoint_mapper.map_codept_to_glyph_id(codepoint);
 }
 
+void truetype_file::build_cmap_table() const noexcept
+{
+	if (m_cmap_table.load(std::memory_order::acquire) != nullptr)
+		return;
+
+	const auto for_each_range = [this](auto&& fn) noexcept
+	{
+		// Ranges reaching past the last valid codepoint are cut off, and ones with swapped bounds skipped
+		const auto clamped_fn = [&fn](uint32_t beg, uint32_t end) noexcept
+		{
+			if (end > 0x10FFFF)
+				end = 0x10FFFF;
+
+			if (beg <= end)
+				fn(beg, end);
+		};
+
+		if (m_codepoint_mapper.mapper == cmap_f12)
+			cmap_f12_for_each_range(m_codepoint_mapper.data, clamped_fn);
+		else
+			cmap_f4_for_each_range(m_codepoint_mapper.data, clamped_fn);
+	};
+
+	// Find the blocks containing mapped codepoints and give each of them a page, with page 0 left for all others
+
+	// Without a table, lookups simply keep using the cmap subtable
+
+	uint16_t* directory = static_cast<uint16_t*>(calloc(CMAP_TABLE_BLOCK_CNT, sizeof(uint16_t)));
+
+	if (directory == nullptr)
+		return;
+
+	for_each_range([directory](uint32_t beg, uint32_t end) noexcept
+	{
+		for (uint32_t block = beg >> 8; block <= end >> 8; ++block)
+			directory[block] = 1;
+	});
+
+	uint32_t page_cnt = 1;
+
+	for (uint32_t block = 0; block != CMAP_TABLE_BLOCK_CNT; ++block)
+		if (directory[block] != 0)
+			directory[block] = static_cast<uint16_t>(page_cnt++);
+
+	// Fill in the pages through the font's own mapping, so the table cannot disagree with it
+
+	uint16_t* table = static_cast<uint16_t*>(malloc((CMAP_TABLE_BLOCK_CNT + page_cnt * 256) * sizeof(uint16_t)));
+
+	if (table == nullptr)
+	{
+		free(directory);
+
+		return;
+	}
+
+	memcpy(table, directory, CMAP_TABLE_BLOCK_CNT * sizeof(uint16_t));
+
+	memset(table + CMAP_TABLE_BLOCK_CNT, 0, page_cnt * 256 * sizeof(uint16_t));
+
+	free(directory);
+
+	for_each_range([this, table](uint32_t beg, uint32_t end) noexcept
+	{
+		for (uint32_t cpt = beg; cpt <= end; ++cpt)
+			table[CMAP_TABLE_BLOCK_CNT + (table[cpt >> 8] << 8) + (cpt & 0xFF)] = static_cast<uint16_t>(m_codepoint_mapper.map_codept_to_glyph_id(cpt));
+	});
+
+	// Another thread may have finished its table first, in which case that one is kept
+
+	const uint16_t* expected = nullptr;
+
+	if (!m_cmap_table.compare_exchange_strong(expected, table, std::memory_order::acq_rel, std::memory_order::acquire))
+		free(table);
+}
+
+void truetype_file::map_codepoints(och::range<const char32_t> codepoints, och::range<uint32_t> out_glyph_ids) const noexcept
+{
+	build_cmap_table();
+
+	const uint16_t* table = m_cmap_table.load(std::memory_order::acquire);
+
+	if (table == nullptr)
+	{
+		for (size_t i = 0; i != codepoints.len(); ++i)
+			out_glyph_ids.beg[i] = m_codepoint_mapper.map_codept_to_glyph_id(codepoints.beg[i]);
+
+		return;
+	}
+
+	for (size_t i = 0; i != codepoints.len(); ++i)
+		out_glyph_ids.beg[i] = cmap_table_lookup(table, static_cast<uint32_t>(codepoints.beg[i]));
+}
+
 glyph_data truetype_file::get_glyph_data_from_id(uint32_t glyph_id) const noexcept
 {
+	// The intermediate data of most glyphs fits onto the stack, so usually only the returned points are allocated
+
+	alignas(8) uint8_t stack_scratch[2048];
+
+	glyph_scratch_arena scratch(stack_scratch, sizeof(stack_scratch));
+
+	uint32_t metrics_glyph_id = glyph_id; // Only overwritten if there is a USE_MY_METRICS flag in a composite glyph component
+
+	internal_glyph_data glf = get_glyph_data_recursive(glyph_id, metrics_glyph_id, scratch);
+
+	return glf.to_glyph_data(internal_get_glyph_metrics(metrics_glyph_id), m_x_min_global, m_y_min_global, nullptr);
+}
+
+glyph_data truetype_file::get_glyph_data_from_id(uint32_t glyph_id, glyph_scratch_arena& scratch) const noexcept
+{
+	scratch.reset();
+
 	uint32_t metrics_glyph_id = glyph_id; // Only overwritten if there is a USE_MY_METRICS flag in a composite glyph component
 
-	internal_glyph_data glf = get_glyph_data_recursive(glyph_id, metrics_glyph_id);
+	internal_glyph_data glf = get_glyph_data_recursive(glyph_id, metrics_glyph_id, scratch);
 
-	return glf.to_glyph_data(internal_get_glyph_metrics(metrics_glyph_id), m_x_min_global, m_y_min_global);
+	return glf.to_glyph_data(internal_get_glyph_metrics(metrics_glyph_id), m_x_min_global, m_y_min_global, &scratch);
+}
+
+glyph_data truetype_file::get_glyph_data_from_codepoint(char32_t codepoint, glyph_scratch_arena& scratch) const noexcept
+{
+	return get_glyph_data_from_id(get_glyph_id_from_codept(codepoint), scratch);
+}
+
+void truetype_file::decode_glyphs(const uint32_t* ids, size_t n, outline_batch& out) const noexcept
+{
+	for (size_t i = 0; i != n; ++i)
+	{
+		glyph_data glyph = get_glyph_data_from_id(ids[i], out.scratch);
+
+		out.glyphs.add({ out.points.size(), glyph.point_cnt(), out.contour_ends.size(), glyph.contour_cnt() });
+
+		out.metrics.add(glyph.metrics());
+
+		out.points.reserve(out.points.size() + glyph.point_cnt());
+
+		for (uint32_t j = 0; j != glyph.point_cnt(); ++j)
+			out.points.add(glyph[j]);
+
+		for (uint32_t j = 0; j != glyph.contour_cnt(); ++j)
+			out.contour_ends.add(glyph.contour_end_index(j));
+	}
 }
 
 glyph_metrics truetype_file::get_glyph_metrics_from_id(uint32_t glyph_id) const noexcept
@@ -373,7 +916,7 @@ const void* truetype_file::get_table(table_tag tag)
 	return nullptr;
 }
 
-truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint32_t glyph_id, uint32_t& out_glyph_id_for_metrics_to_use) const noexcept
+truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint32_t glyph_id, uint32_t& out_glyph_id_for_metrics_to_use, glyph_scratch_arena& scratch) const noexcept
 {
 	assert(glyph_id < m_glyph_cnt);
 
@@ -407,33 +950,73 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 
 		const uint8_t* raw_data = instructions + instruction_bytes; // Flags, X-Coords, Y-Coords
 
-		ret.create(point_cnt, contour_cnt);
+		ret.create(point_cnt, contour_cnt, scratch);
 
 		for (uint16_t i = 0; i != contour_cnt; ++i)
 			ret.contour_end_indices()[i] = be_to_le(endpt_inds[i]);
 
-		uint8_t* decoded_flags = static_cast<uint8_t*>(malloc(point_cnt));
+		// Flags are padded to a multiple of 16 with ones that take no coordinate bytes, so they can be processed in whole vectors
+		const uint32_t padded_point_cnt = (point_cnt + 15) & ~15u;
+
+		uint8_t* decoded_flags = static_cast<uint8_t*>(scratch.allocate(padded_point_cnt));
+
+		const uint8_t* const file_end = reinterpret_cast<const uint8_t*>(m_file.data()) + m_file.bytes();
 
 		uint32_t byte_idx = 0, write_idx = 0;
 
 		while (write_idx < point_cnt)
 		{
+			// Runs of 16 flags without a repeat are copied at once. Shifting each byte's REPEAT_FLAG into its sign bit lets movemask find repeats.
+			if (point_cnt - write_idx >= 16 && file_end - (raw_data + byte_idx) >= 16)
+			{
+				const __m128i raw_flags = _mm_loadu_si128(reinterpret_cast<const __m128i*>(raw_data + byte_idx));
+
+				if (!_mm_movemask_epi8(_mm_slli_epi16(raw_flags, 4)))
+				{
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(decoded_flags + write_idx), _mm_and_si128(raw_flags, _mm_set1_epi8(DECODED_BITS)));
+
+					byte_idx += 16;
+
+					write_idx += 16;
+
+					continue;
+				}
+			}
+
 			uint8_t f = raw_data[byte_idx++];
 
 			decoded_flags[write_idx++] = f & DECODED_BITS;
 
 			if (f & REPEAT_FLAG)
 			{
-				uint8_t repeat_cnt = raw_data[byte_idx++];
+				uint32_t repeat_cnt = raw_data[byte_idx++];
 
-				for (uint8_t i = 0; i != repeat_cnt; ++i)
-					decoded_flags[write_idx++] = f & DECODED_BITS;
+				// A corrupt font may repeat past the last point, which would overrun decoded_flags
+				if (repeat_cnt > point_cnt - write_idx)
+					repeat_cnt = point_cnt - write_idx;
+
+				memset(decoded_flags + write_idx, f & DECODED_BITS, repeat_cnt);
+
+				write_idx += repeat_cnt;
 			}
 		}
 
 		// If this does not hold, there was an error while expanding the raw flags array
 		assert(write_idx == point_cnt);
 
+		memset(decoded_flags + point_cnt, X_IS_SAME_OR_POSITIVE_X_SHORT_VEC | Y_IS_SAME_OR_POSITIVE_Y_SHORT_VEC, padded_point_cnt - point_cnt);
+
+		// ON_CURVE_POINT is bit 0, so shifting it into each byte's sign bit turns movemask into eight entries of the on-curve bitmask
+		for (uint32_t i = 0; i < point_cnt; i += 8)
+			ret.on_curve_bits()[i >> 3] = static_cast<uint8_t>(_mm_movemask_epi8(_mm_slli_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(decoded_flags + i)), 7)));
+
+		if (has_ssse3())
+		{
+			decode_simple_glyph_coords_ssse3(decoded_flags, padded_point_cnt, point_cnt, raw_data + byte_idx, file_end, m_normalization_factor, ret.points());
+
+			return ret;
+		}
+
 		int16_t prev_x = 0;
 
 		for (uint32_t i = 0; i != point_cnt; ++i)
@@ -457,11 +1040,6 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 
 			ret.points()[i].x = new_x * m_normalization_factor;
 
-			if (decoded_flags[i] & ON_CURVE_POINT)
-				ret.set_on_curve(i);
-			else
-				ret.set_off_curve(i);
-
 			prev_x = new_x;
 		}
 
@@ -491,8 +1069,6 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 			prev_y = new_y;
 		}
 
-		free(decoded_flags);
-
 		return ret;
 	}
 	else // Composite Glyph
@@ -516,7 +1092,7 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 
 		const uint16_t* raw_data = reinterpret_cast<const uint16_t*>(header + 1);
 
-		internal_glyph_data* components = static_cast<internal_glyph_data*>(malloc(m_max_composite_glyph_cnt * sizeof(internal_glyph_data)));
+		internal_glyph_data* components = static_cast<internal_glyph_data*>(scratch.allocate(m_max_composite_glyph_cnt * sizeof(internal_glyph_data)));
 
 		uint32_t component_cnt = 0;
 
@@ -530,7 +1106,7 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 
 			const uint16_t component_glyph_id = be_to_le(raw_data[word_idx++]);
 
-			components[component_cnt++] = get_glyph_data_recursive(component_glyph_id, out_glyph_id_for_metrics_to_use);
+			components[component_cnt++] = get_glyph_data_recursive(component_glyph_id, out_glyph_id_for_metrics_to_use, scratch);
 
 			internal_glyph_data& curr_component = components[component_cnt - 1];
 
@@ -638,7 +1214,7 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 
 		internal_glyph_data ret;
 
-		ret.create(previous_total_point_cnt, previous_total_contour_cnt);
+		ret.create(previous_total_point_cnt, previous_total_contour_cnt, scratch);
 
 		uint16_t point_idx = 0;
 
@@ -660,11 +1236,6 @@ truetype_file::internal_glyph_data truetype_file::get_glyph_data_recursive(uint3
 			point_idx += static_cast<uint16_t>(components[i].point_cnt);
 		}
 
-		for (uint32_t i = 0; i != component_cnt; ++i)
-			components[i].destroy();
-
-		free(components);
-
 		return ret;
 	}
 }
@@ -824,6 +1395,11 @@ uint32_t* truetype_file::internal_glyph_data::contour_end_indices() noexcept
 	return reinterpret_cast<uint32_t*>(m_points + point_cnt);
 }
 
+uint8_t* truetype_file::internal_glyph_data::on_curve_bits() noexcept
+{
+	return reinterpret_cast<uint8_t*>(contour_end_indices() + contour_cnt);
+}
+
 void truetype_file::internal_glyph_data::set_on_curve(uint32_t point_idx) noexcept
 {
 	reinterpret_cast<uint8_t*>(contour_end_indices() + contour_cnt)[point_idx >> 3] |= 1 << (point_idx & 7);
@@ -839,24 +1415,18 @@ bool truetype_file::internal_glyph_data::is_on_line(uint32_t point_idx) noexcept
 	return reinterpret_cast<const uint8_t*>(contour_end_indices() + contour_cnt)[point_idx >> 3] & (1 << (point_idx & 7));
 }
 
-void truetype_file::internal_glyph_data::create(uint32_t point_cnt_, uint32_t contour_cnt_) noexcept
+void truetype_file::internal_glyph_data::create(uint32_t point_cnt_, uint32_t contour_cnt_, glyph_scratch_arena& scratch) noexcept
 {
 	point_cnt = point_cnt_;
 
 	contour_cnt = contour_cnt_;
 
-	const size_t alloc_size = point_cnt_ * sizeof(och::vec2) + contour_cnt_ * sizeof(uint32_t) + (point_cnt_ + 7) / 8;
+	const uint32_t alloc_size = point_cnt_ * sizeof(och::vec2) + contour_cnt_ * sizeof(uint32_t) + (point_cnt_ + 7) / 8;
 
-	m_points = static_cast<och::vec2*>(malloc(alloc_size)); 
+	m_points = static_cast<och::vec2*>(scratch.allocate(alloc_size));
 }
 
-void truetype_file::internal_glyph_data::destroy() noexcept
-{
-	if(m_points)
-		free(m_points);
-}
-
-glyph_data truetype_file::internal_glyph_data::to_glyph_data(glyph_metrics metrics, float global_x_min, float global_y_min) noexcept
+glyph_data truetype_file::internal_glyph_data::to_glyph_data(glyph_metrics metrics, float global_x_min, float global_y_min, glyph_scratch_arena* borrow_from) noexcept
 {
 	// Count necessary points
 
@@ -894,9 +1464,12 @@ glyph_data truetype_file::internal_glyph_data::to_glyph_data(glyph_metrics metri
 
 	// Allocate necessary storage
 
-	const size_t alloc_size = final_point_cnt * sizeof(och::vec2) + final_contour_cnt * sizeof(uint32_t);
+	const uint32_t alloc_size = final_point_cnt * sizeof(och::vec2) + final_contour_cnt * sizeof(uint32_t);
 
-	och::vec2* final_points = alloc_size ? static_cast<och::vec2*>(malloc(alloc_size)) : nullptr;
+	och::vec2* final_points = nullptr;
+
+	if (alloc_size != 0)
+		final_points = static_cast<och::vec2*>(borrow_from != nullptr ? borrow_from->allocate(alloc_size) : malloc(alloc_size));
 
 	uint32_t* final_contour_ends = reinterpret_cast<uint32_t*>(final_points + final_point_cnt);
 
@@ -958,6 +1531,9 @@ glyph_data truetype_file::internal_glyph_data::to_glyph_data(glyph_metrics metri
 		}
 	}
 
+	if (borrow_from != nullptr)
+		return glyph_data::borrow(final_contour_cnt, final_point_cnt, metrics, final_points, final_contour_ends);
+
 	return glyph_data(final_contour_cnt, final_point_cnt, metrics, final_points);
 }
 
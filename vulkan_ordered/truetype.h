@@ -1,13 +1,18 @@
 #pragma once
 
 #include <cstdint>
+#include <atomic>
 
 #include "och_fio.h"
 
 #include "och_matmath.h"
 
+#include "och_range.h"
+
 #include "och_err.h"
 
+#include "simple_vec.h"
+
 
 struct glyph_metrics
 {
@@ -56,12 +61,19 @@ private:
 
 	och::vec2* m_points;
 
+	uint32_t* m_contour_ends;
+
+	bool m_owns_points;
+
 public:
 
 	glyph_data() noexcept;
 
 	glyph_data(uint32_t contour_cnt, uint32_t point_cnt, glyph_metrics metrics, och::vec2* raw_data_ownership_transferred) noexcept;
 
+	// Refers to points and contour_ends without taking ownership, so they must stay valid for as long as the returned glyph_data is used
+	static glyph_data borrow(uint32_t contour_cnt, uint32_t point_cnt, glyph_metrics metrics, och::vec2* points, uint32_t* contour_ends) noexcept;
+
 	~glyph_data() noexcept;
 
 	const och::vec2& operator[](uint32_t point_idx) const noexcept;
@@ -81,9 +93,110 @@ public:
 	uint32_t contour_end_index(uint32_t contour_idx) const noexcept;
 };
 
+// Bump allocator for the temporary data of decoding glyphs, and for the decoded glyphs themselves when they borrow from it.
+// Everything allocated stays valid until the next reset. Allocations that do not fit the current block get blocks of their own,
+// and the next reset replaces all of them with a single block large enough to hold them together.
+// Once it has grown to fit the largest glyph decoded with it, the arena thus never touches the heap again.
+// Not thread-safe, so each decoding thread needs an arena of its own.
+struct glyph_scratch_arena
+{
+private:
+
+	static constexpr uint32_t ALIGNMENT = 8;
+
+	struct overflow_block
+	{
+		overflow_block* prev;
+	};
+
+	// Keeps the memory following each block's header aligned
+	static_assert(sizeof(overflow_block) % ALIGNMENT == 0);
+
+	uint8_t* m_data = nullptr;
+
+	uint32_t m_capacity = 0;
+
+	uint32_t m_used = 0;
 
+	bool m_owns_data = true;
 
+	// Blocks allocated since the last reset because the current one was full, most recent first
+	overflow_block* m_overflow = nullptr;
 
+	uint32_t m_overflow_bytes = 0;
+
+	void free_blocks() noexcept;
+
+public:
+
+	glyph_scratch_arena() noexcept = default;
+
+	// Starts out with buffer as its block, which is never freed by the arena. It is only replaced once a glyph does not fit into it.
+	glyph_scratch_arena(void* buffer, uint32_t buffer_bytes) noexcept;
+
+	glyph_scratch_arena(const glyph_scratch_arena&) = delete;
+
+	glyph_scratch_arena& operator=(const glyph_scratch_arena&) = delete;
+
+	~glyph_scratch_arena() noexcept;
+
+	// Returned memory is aligned to 8 bytes
+	void* allocate(uint32_t bytes) noexcept;
+
+	void reset() noexcept;
+
+	// Size of the current block
+	uint32_t capacity() const noexcept;
+};
+
+// Outlines of many glyphs stored back to back in flat arrays, instead of in an allocation per glyph. Filled by truetype_file::decode_glyphs.
+// The arrays only hold plain data, so they can be copied into GPU storage buffers as they are.
+// Batches do not share any state, so ranges of ids can be decoded on several threads at once, each into a batch of its own.
+struct outline_batch
+{
+	struct glyph_range
+	{
+		uint32_t point_beg;
+
+		uint32_t point_cnt;
+
+		uint32_t contour_beg;
+
+		// Contour ends are counted from the glyph's first point, as in glyph_data
+		uint32_t contour_cnt;
+	};
+
+	simple_vec<och::vec2> points{ 0 };
+
+	simple_vec<uint32_t> contour_ends{ 0 };
+
+	// One entry per decoded id, in the order they were decoded
+	simple_vec<glyph_range> glyphs{ 0 };
+
+	simple_vec<glyph_metrics> metrics{ 0 };
+
+	// Reused for decoding each glyph
+	glyph_scratch_arena scratch;
+
+	uint32_t glyph_cnt() const noexcept;
+
+	// Refers to the points and contour ends of glyph idx, which stay valid until the batch is modified
+	glyph_data glyph(uint32_t idx) noexcept;
+
+	// Removes all glyphs while keeping the memory
+	void reset() noexcept;
+};
+
+
+
+
+// TrueType font mapped into memory, from which glyphs are decoded on demand.
+// Once create has returned, any number of threads may call the const members of one truetype_file at once.
+// These only read the mapped file and the table offsets found by create, and decode into memory owned by their caller,
+// so each thread needs its own glyph_scratch_arena or outline_batch. The one piece of state they share is the cmap table,
+// which build_cmap_table publishes atomically and never modifies afterwards.
+// Worker threads should therefore share one truetype_file instead of each opening the font again.
+// create and close must not overlap with any other call on the same truetype_file.
 struct truetype_file
 {
 private:
@@ -267,17 +380,19 @@ private:
 
 		uint32_t* contour_end_indices() noexcept;
 
+		// One bit per point, set for points on the curve
+		uint8_t* on_curve_bits() noexcept;
+
 		void set_on_curve(uint32_t point_idx) noexcept;
 
 		void set_off_curve(uint32_t point_idx) noexcept;
 
 		bool is_on_line(uint32_t point_idx) noexcept;
 
-		void create(uint32_t point_cnt_, uint32_t contour_cnt_) noexcept;
-
-		void destroy() noexcept;
+		void create(uint32_t point_cnt_, uint32_t contour_cnt_, glyph_scratch_arena& scratch) noexcept;
 
-		glyph_data to_glyph_data(glyph_metrics metrics, float global_x_min, float global_y_min) noexcept;
+		// The result borrows its points from borrow_from if that is not nullptr, and owns a heap allocation otherwise
+		glyph_data to_glyph_data(glyph_metrics metrics, float global_x_min, float global_y_min, glyph_scratch_arena* borrow_from) noexcept;
 
 		void translate(float dx, float dy) noexcept;
 
@@ -319,6 +434,11 @@ private:
 
 	codepoint_mapper_data m_codepoint_mapper;
 
+	// Glyph id of every codepoint, in native byte order. Built by build_cmap_table, and immutable from then on.
+	// The first 0x1100 entries hold the page of each block of 256 codepoints up to 0x10FFFF. The pages of 256 glyph ids follow.
+	// Page 0 maps everything to glyph 0 and stands in for all blocks without any mapped codepoints.
+	mutable std::atomic<const uint16_t*> m_cmap_table{ nullptr };
+
 	const void* m_loca_tbl;
 
 	const void* m_glyf_tbl;
@@ -341,14 +461,37 @@ public:
 
 	float line_height() const noexcept;
 
+	uint32_t glyph_cnt() const noexcept;
+
+	// Fingerprint of the file's contents, combined from the checksums and lengths in its table directory, so no table data is read.
+	uint64_t content_hash() const noexcept;
+
 	glyph_data get_glyph_data_from_codepoint(char32_t codepoint) const noexcept;
 
 	glyph_metrics get_glyph_metrics_from_codept(char32_t codepoint) const noexcept;
 
 	uint32_t get_glyph_id_from_codept(char32_t codepoint) const noexcept;
 
+	// Replaces the binary search through the font's cmap subtable with a direct-mapped table of all its codepoints.
+	// Afterwards, get_glyph_id_from_codept and map_codepoints take a constant number of memory accesses per codepoint.
+	// The table takes 512 bytes per block of 256 codepoints containing any mapped ones, plus 8.5 KiB.
+	// Does nothing if the table already exists. Safe to call from several threads at once, which then all share one table.
+	void build_cmap_table() const noexcept;
+
+	// Writes the glyph id of each of codepoints to out_glyph_ids, which must be at least as long. Builds the cmap table if it does not exist yet.
+	void map_codepoints(och::range<const char32_t> codepoints, och::range<uint32_t> out_glyph_ids) const noexcept;
+
 	glyph_data get_glyph_data_from_id(uint32_t glyph_id) const noexcept;
 
+	// Same as get_glyph_data_from_id, but decodes the glyph entirely within scratch, which is reset first.
+	// The result borrows from scratch, so it is only valid until scratch is reset again, such as by decoding the next glyph with it.
+	glyph_data get_glyph_data_from_id(uint32_t glyph_id, glyph_scratch_arena& scratch) const noexcept;
+
+	glyph_data get_glyph_data_from_codepoint(char32_t codepoint, glyph_scratch_arena& scratch) const noexcept;
+
+	// Appends the outlines and metrics of the glyphs ids[0] to ids[n - 1] to out, in that order.
+	void decode_glyphs(const uint32_t* ids, size_t n, outline_batch& out) const noexcept;
+
 	glyph_metrics get_glyph_metrics_from_id(uint32_t glyph_id) const noexcept;
 
 	operator bool() const noexcept;
@@ -357,7 +500,7 @@ private:
 
 	const void* get_table(table_tag tag);
 
-	internal_glyph_data get_glyph_data_recursive(uint32_t glyph_id, uint32_t& out_glyph_id_for_metrics_to_use) const noexcept;
+	internal_glyph_data get_glyph_data_recursive(uint32_t glyph_id, uint32_t& out_glyph_id_for_metrics_to_use, glyph_scratch_arena& scratch) const noexcept;
 
 	const och::vec2& find_glyph_point_in_internal_composite(internal_glyph_data* components, uint16_t point_idx) const noexcept;
 